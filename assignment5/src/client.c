@@ -109,12 +109,20 @@ int main(int argc, char *argv[])
         if(res == 1 && buffer[0] == '\n'){
             break;
         }
-        if((res = read(s, buffer, sizeof(buffer)-1)) <= 0){
-            fprintf(stderr,"Connection closed by server\n");
-            exit(EXIT_FAILURE);
+        if(buffer[len-1] != '\n'){
+            /* the rest of a long request line */
+            continue;
         }
-        buffer[res] = 0;
-        printf("%s\n",buffer);
+        /* a response ends with a line feed, and may span several reads */
+        do{
+            if((res = read(s, buffer, sizeof(buffer)-1)) <= 0){
+                fprintf(stderr,"Connection closed by server\n");
+                exit(EXIT_FAILURE);
+            }
+            buffer[res] = 0;
+            fputs(buffer, stdout);
+        }while(buffer[res-1] != '\n');
+        fflush(stdout);
     }
     close(s);
 
@@ -0,0 +1,350 @@
+#!/bin/bash
+
+# Default port number
+PORT=8080
+
+# Parse arguments for port number (optional)
+while getopts "p:" opt; do
+    case $opt in
+        p) PORT=$OPTARG ;;
+        *) echo "Usage: $0 [-p port] [1|2|3|4]"; exit 1 ;;
+    esac
+done
+
+# Shift so that $1 now points to the test set selection (if provided)
+shift $((OPTIND-1))
+
+if [ -z "$1" ]; then
+    echo "Usage: $0 [-p port] [1|2|3|4]"
+    exit 1
+fi
+
+TEST_SET=$1
+
+# The server is started by the script itself, with its files in here
+OUTPUT_DIR="./output"
+if [[ -d $OUTPUT_DIR ]]; then
+    rm -rf $OUTPUT_DIR
+fi
+mkdir -p $OUTPUT_DIR
+
+WAL="$OUTPUT_DIR/skvs.wal"
+SERVER_PID=
+
+fail() {
+    echo -e "\033[31mTest Failed: $1\033[0m"
+    [ -n "$SERVER_PID" ] && kill -9 $SERVER_PID 2>/dev/null
+    exit 1
+}
+
+# Start the server with the given options and wait for it to listen
+start_server() {
+    ./server -p $PORT "$@" > "$OUTPUT_DIR/server.log" 2>&1 &
+    SERVER_PID=$!
+    for _ in $(seq 50); do
+        if (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null; then
+            return 0
+        fi
+        kill -0 $SERVER_PID 2>/dev/null || break
+        sleep 0.1
+    done
+    fail "the server did not start with '$*'"
+}
+
+# Stop the server cleanly
+stop_server() {
+    kill -INT $SERVER_PID 2>/dev/null
+    wait $SERVER_PID 2>/dev/null
+    SERVER_PID=
+}
+
+# Send the requests, one per argument, on a single connection
+send_requests() {
+    printf '%s\n' "$@" | ./client -p $PORT
+}
+
+# Send a request and check its response
+check_request() {
+    local response
+    response=$(send_requests "$1")
+    if [[ "$response" != *"$2"* ]]; then
+        fail "expected '$2' for '$1', got '$response'"
+    fi
+    echo "Request '$1': '$2' verified successfully."
+}
+
+# Print the version GETS responds with for the key
+get_version() {
+    local response
+    response=$(send_requests "GETS $1")
+    [[ "$response" =~ ^[0-9]+\  ]] ||
+        fail "expected 'version value' for 'GETS $1', got '$response'"
+    echo "${response%% *}"
+}
+
+# Check that a version is above the one before it
+check_newer() {
+    if (( $2 <= $1 )); then
+        fail "version $2 is not above $1 $3"
+    fi
+    echo "Version $2 above $1 $3 verified successfully."
+}
+
+# Open a connection of our own on fd 3, kept open across requests
+open_conn() {
+    exec 3<>/dev/tcp/127.0.0.1/$PORT || fail "could not connect"
+}
+
+close_conn() {
+    exec 3<&-
+}
+
+# Send the requests on the connection, all in a single write
+send_conn() {
+    printf '%s\n' "$@" >&3
+}
+
+# Read a response line from the connection and check it
+expect_response() {
+    local line
+    IFS= read -r -t 5 line <&3 || fail "no response, expected '$1'"
+    [[ "$line" == "$1" ]] || fail "expected '$1', got '$line'"
+    echo "Response '$1' verified successfully."
+}
+
+# Read the lines of a STATS response from the connection, up to END
+read_stats() {
+    local line
+    STATS=
+    while IFS= read -r -t 5 line <&3; do
+        [[ "$line" == "END" ]] && return 0
+        STATS+="$line"$'\n'
+    done
+    fail "no END after the STATS lines"
+}
+
+# Check a figure of the last STATS response
+check_stat() {
+    local value
+    value=$(awk -v name="$1" '$1 == "STAT" && $2 == name { print $3 }' \
+        <<< "$STATS")
+    [[ "$value" == "$2" ]] || fail "expected STAT $1 $2, got '$value'"
+    echo "STAT $1 $2 verified successfully."
+}
+
+echo "=== Starting Test Set $TEST_SET ==="
+
+case $TEST_SET in
+    1)
+        # Versions order the writes of a key, and CAS and INCR act on them
+        start_server -w $WAL
+        check_request "CREATE hello world" "CREATE OK"
+        check_request "GETS hello" " world"
+        V1=$(get_version hello)
+        check_request "CAS hello $V1 snu" "CAS OK"
+        check_request "CAS hello $V1 again" "VERSION MISMATCH"
+        check_request "READ hello" "snu"
+        V2=$(get_version hello)
+        check_newer $V1 $V2 "after a CAS"
+        check_request "CAS hello $V2 again" "CAS OK"
+        check_request "CAS bye 1 snu" "NOT FOUND"
+
+        check_request "CREATE count 41" "CREATE OK"
+        check_request "INCR count" "42"
+        check_request "DECR count 50" "-8"
+        check_request "INCR count x" "INVALID CMD"
+        check_request "INCR hello" "NOT A NUMBER"
+        check_request "INCR bye" "NOT FOUND"
+        check_request "CREATE max 9223372036854775806" "CREATE OK"
+        check_request "INCR max" "9223372036854775807"
+        check_request "INCR max" "OUT OF RANGE"
+        check_request "READ max" "9223372036854775807"
+        check_request "CREATE min -9223372036854775807" "CREATE OK"
+        check_request "DECR min" "-9223372036854775808"
+        check_request "DECR min" "OUT OF RANGE"
+
+        # a key deleted and created again does not reuse a version
+        V3=$(get_version hello)
+        check_request "DELETE hello" "DELETE OK"
+        check_request "CREATE hello world" "CREATE OK"
+        V4=$(get_version hello)
+        check_newer $V3 $V4 "after a delete and create"
+        stop_server
+
+        # nor does one restored by a restart
+        start_server -w $WAL
+        check_request "READ hello" "world"
+        V5=$(get_version hello)
+        check_newer $V4 $V5 "after a restart"
+        check_request "CAS hello $V4 snu" "VERSION MISMATCH"
+        check_request "CAS hello $V5 snu" "CAS OK"
+        check_request "READ count" "-8"
+        stop_server
+        ;;
+    2)
+        # Keys expire at their ttl, whether or not the wheel has run yet
+        start_server -t 1
+        check_request "CREATE hello world" "CREATE OK"
+        check_request "EXPIRE bye 1" "NOT FOUND"
+        check_request "CREATE bye snu 0" "INVALID CMD"
+        open_conn
+
+        # The one worker sweeps after serving, and when idle for a second,
+        # firing a timer at the 100 ms tick after its expiry. Starting
+        # early in a tick, the keys are expired but not swept yet after a
+        # second, until the worker sweeps again.
+        while (( 10#$(date +%N) / 1000000 % 100 < 10 ||
+                 10#$(date +%N) / 1000000 % 100 > 40 )); do
+            sleep 0.005
+        done
+        send_conn "CREATE temp value 1" "CREATE idle value 1" \
+            "CREATE keep value 1" "EXPIRE keep 0" "READ temp"
+        expect_response "CREATE OK"
+        expect_response "CREATE OK"
+        expect_response "CREATE OK"
+        expect_response "EXPIRE OK"
+        expect_response "value"
+
+        sleep 1.4
+        send_conn "STATS" "READ temp" "READ keep"
+        read_stats
+        check_stat curr_items 4
+        expect_response "NOT FOUND"
+        expect_response "value"
+
+        # that request woke the worker, whose wheel reclaimed the key that
+        # was not read since
+        sleep 0.2
+        send_conn "STATS"
+        read_stats
+        check_stat curr_items 2
+        close_conn
+        check_request "READ keep" "value"
+        check_request "EXPIRE temp 1" "NOT FOUND"
+        stop_server
+        ;;
+    3)
+        # SCAN and PREFIX page through the keys in order
+        start_server
+        check_request "CREATE apple1 red" "CREATE OK"
+        check_request "SCAN a z" "INVALID CMD"
+        check_request "PREFIX apple" "INVALID CMD"
+        stop_server
+
+        start_server -x
+        for key in apple3 apple1 banana apple5 cherry apple4 apple2 applf; do
+            check_request "CREATE $key v$key" "CREATE OK"
+        done
+        check_request "CREATE gone soon" "CREATE OK"
+        check_request "DELETE gone" "DELETE OK"
+        open_conn
+
+        send_conn "SCAN a z 3"
+        expect_response "apple1 vapple1"
+        expect_response "apple2 vapple2"
+        expect_response "apple3 vapple3"
+        expect_response "NEXT apple4"
+        send_conn "SCAN apple4 z 3"
+        expect_response "apple4 vapple4"
+        expect_response "apple5 vapple5"
+        expect_response "applf vapplf"
+        expect_response "NEXT banana"
+        send_conn "SCAN banana z 3"
+        expect_response "banana vbanana"
+        expect_response "cherry vcherry"
+        expect_response "END"
+        # to is not in the range
+        send_conn "SCAN apple5 banana"
+        expect_response "apple5 vapple5"
+        expect_response "applf vapplf"
+        expect_response "END"
+
+        # keys past the prefix end the scan
+        send_conn "PREFIX apple"
+        expect_response "apple1 vapple1"
+        expect_response "apple2 vapple2"
+        expect_response "apple3 vapple3"
+        expect_response "apple4 vapple4"
+        expect_response "apple5 vapple5"
+        expect_response "END"
+        send_conn "PREFIX apple 2"
+        expect_response "apple1 vapple1"
+        expect_response "apple2 vapple2"
+        expect_response "NEXT apple3"
+        send_conn "PREFIX apple 2 apple3"
+        expect_response "apple3 vapple3"
+        expect_response "apple4 vapple4"
+        expect_response "NEXT apple5"
+        send_conn "PREFIX apple 2 apple5"
+        expect_response "apple5 vapple5"
+        expect_response "END"
+        send_conn "PREFIX gone"
+        expect_response "END"
+
+        # at most MAX_MULTI_KEYS at a time
+        send_conn "SCAN a z 128"
+        for key in apple1 apple2 apple3 apple4 apple5 applf banana cherry; do
+            expect_response "$key v$key"
+        done
+        expect_response "END"
+        send_conn "SCAN a z 129" "SCAN a z 0" "PREFIX apple 129"
+        expect_response "INVALID CMD"
+        expect_response "INVALID CMD"
+        expect_response "INVALID CMD"
+        close_conn
+        stop_server
+        ;;
+    4)
+        # Entries stay within -m, and the keys being read stay in
+        LIMIT=200000
+        VALUE=$(printf 'x%.0s' $(seq 100))
+        start_server -m $LIMIT
+        {
+            for ((j = 0; j < 10; j++)); do
+                echo "CREATE hot$j hot"
+            done
+            # about five times what fits, reading the hot keys meanwhile
+            for ((i = 0; i < 5000; i++)); do
+                echo "CREATE key$i $VALUE"
+                if (( i % 100 == 99 )); then
+                    for ((j = 0; j < 10; j++)); do
+                        echo "READ hot$j"
+                    done
+                fi
+            done
+            for ((j = 0; j < 10; j++)); do
+                echo "READ hot$j"
+            done
+            echo "STATS"
+        } > "$OUTPUT_DIR/requests.txt"
+        ./client -p $PORT < "$OUTPUT_DIR/requests.txt" \
+            > "$OUTPUT_DIR/responses.txt"
+
+        CREATED=$(grep -c "^CREATE OK$" "$OUTPUT_DIR/responses.txt")
+        (( CREATED == 5010 )) || fail "$CREATED of 5010 inserts succeeded"
+        echo "All 5010 inserts past the budget verified successfully."
+        HOT=$(grep -c "^hot$" "$OUTPUT_DIR/responses.txt")
+        (( HOT == 510 )) || fail "$HOT of 510 reads of the hot keys hit"
+        echo "All 510 reads of the hot keys verified successfully."
+
+        STATS=$(grep "^STAT " "$OUTPUT_DIR/responses.txt")
+        BYTES=$(awk '$2 == "bytes" { print $3 }' <<< "$STATS")
+        EVICTIONS=$(awk '$2 == "evictions" { print $3 }' <<< "$STATS")
+        ITEMS=$(awk '$2 == "curr_items" { print $3 }' <<< "$STATS")
+        check_stat limit_maxbytes $LIMIT
+        (( BYTES > 0 && BYTES <= LIMIT )) ||
+            fail "STAT bytes $BYTES is not within $LIMIT"
+        echo "STAT bytes $BYTES within $LIMIT verified successfully."
+        (( EVICTIONS > 0 && ITEMS + EVICTIONS == 5010 )) ||
+            fail "STAT evictions $EVICTIONS and curr_items $ITEMS do not add up"
+        echo "STAT evictions $EVICTIONS verified successfully."
+        stop_server
+        ;;
+    *)
+        echo "Invalid test set number. Use 1, 2, 3, or 4."
+        exit 1
+        ;;
+esac
+
+echo -e "\033[32mTest Passed: All conditions satisfied for Test Set $TEST_SET.\033[0m"
+exit 0
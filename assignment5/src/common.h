@@ -8,7 +8,9 @@
 #include <errno.h>
 /*---------------------------------------------------------------------------*/
 #define MAX_KEY_LEN 32
+#define MAX_MULTI_KEYS 128
 #define BUFFER_SIZE 4096
+#define MAX_VALUE_SIZE (1 << 20)
 #define DEFAULT_PORT 8080
 #define DEFAULT_LOOPBACK_IP "127.0.0.1"
 #define DEFAULT_ANY_IP "0.0.0.0"
@@ -16,6 +18,9 @@
 #define NUM_THREADS 10
 #define RWLOCK_DELAY 0
 #define TIMEOUT 1
+#define CACHE_LINE_SIZE 64
+#define MAX_EVENTS 64
+#define MAX_PENDING (1 << 20)
 /*---------------------------------------------------------------------------*/
 #ifdef DEBUG
 #define DEBUG_PRINT(...)                                               \
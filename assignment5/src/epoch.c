@@ -0,0 +1,175 @@
+/*---------------------------------------------------------------------------*/
+/* epoch.c                                                                   */
+/* Author: Yeonjae Kim                                                       */
+/*---------------------------------------------------------------------------*/
+#include "epoch.h"
+/*---------------------------------------------------------------------------*/
+/* retire this many objects between attempts to advance the epoch */
+#define EPOCH_BATCH 64
+/* retired objects are kept by the epoch they were retired in, mod 3 */
+#define EPOCH_LISTS 3
+/*---------------------------------------------------------------------------*/
+/* per-thread record, kept on its own cache line */
+struct epoch_rec
+{
+    /* (observed epoch << 1) | active, read by other threads */
+    atomic_uint state;
+    struct epoch_rec *next;
+
+    /* owned by the thread */
+    int nest;
+    unsigned int retired_count;
+    unsigned int limbo_epoch[EPOCH_LISTS];
+    struct epoch_entry *limbo[EPOCH_LISTS];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+/*---------------------------------------------------------------------------*/
+static atomic_uint g_epoch;
+static _Atomic(struct epoch_rec *) g_recs;
+static __thread struct epoch_rec *t_rec;
+/*---------------------------------------------------------------------------*/
+/* returns the calling thread's record, registering it on first use */
+static struct epoch_rec *epoch_rec(void)
+{
+    struct epoch_rec *rec = t_rec, *head;
+
+    if (rec)
+    {
+        return rec;
+    }
+
+    rec = aligned_alloc(CACHE_LINE_SIZE, sizeof(struct epoch_rec));
+    if (rec == NULL)
+    {
+        perror("aligned_alloc");
+        abort();
+    }
+    memset(rec, 0, sizeof(*rec));
+
+    /* records are only ever pushed, so a lock-free push is enough */
+    head = atomic_load(&g_recs);
+    do
+    {
+        rec->next = head;
+    } while (!atomic_compare_exchange_weak(&g_recs, &head, rec));
+
+    t_rec = rec;
+    return rec;
+}
+/*---------------------------------------------------------------------------*/
+static void free_list(struct epoch_entry *e)
+{
+    struct epoch_entry *next;
+
+    while (e)
+    {
+        next = e->next;
+        e->free_fn(e);
+        e = next;
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* advances the global epoch if every active thread has observed it */
+static void epoch_try_advance(void)
+{
+    struct epoch_rec *rec;
+    unsigned int epoch, state;
+
+    epoch = atomic_load(&g_epoch);
+    for (rec = atomic_load(&g_recs); rec; rec = rec->next)
+    {
+        state = atomic_load(&rec->state);
+        /* the state keeps the low 31 bits of the epoch */
+        if ((state & 1) && (state >> 1) != ((epoch << 1) >> 1))
+        {
+            return;
+        }
+    }
+    atomic_compare_exchange_strong(&g_epoch, &epoch, epoch + 1);
+}
+/*---------------------------------------------------------------------------*/
+/* frees the objects of this thread retired at least two epochs ago */
+static void epoch_reclaim(struct epoch_rec *rec)
+{
+    unsigned int epoch = atomic_load(&g_epoch);
+    int i;
+
+    for (i = 0; i < EPOCH_LISTS; i++)
+    {
+        if (rec->limbo[i] && epoch - rec->limbo_epoch[i] >= 2)
+        {
+            free_list(rec->limbo[i]);
+            rec->limbo[i] = NULL;
+        }
+    }
+}
+/*---------------------------------------------------------------------------*/
+void epoch_enter(void)
+{
+    struct epoch_rec *rec = epoch_rec();
+
+    if (rec->nest++ > 0)
+    {
+        return;
+    }
+
+    atomic_store_explicit(&rec->state, (atomic_load(&g_epoch) << 1) | 1,
+                          memory_order_relaxed);
+    /* publish being active before touching any shared pointer */
+    atomic_thread_fence(memory_order_seq_cst);
+}
+/*---------------------------------------------------------------------------*/
+void epoch_exit(void)
+{
+    struct epoch_rec *rec = t_rec;
+
+    if (--rec->nest > 0)
+    {
+        return;
+    }
+
+    atomic_store_explicit(&rec->state, 0, memory_order_release);
+}
+/*---------------------------------------------------------------------------*/
+void epoch_retire(struct epoch_entry *entry,
+                  void (*free_fn)(struct epoch_entry *))
+{
+    struct epoch_rec *rec = epoch_rec();
+    unsigned int epoch;
+    int i;
+
+    entry->free_fn = free_fn;
+
+    /* the object was unlinked before this load, so tag it with it */
+    epoch = atomic_load(&g_epoch);
+    i = epoch % EPOCH_LISTS;
+    if (rec->limbo[i] && rec->limbo_epoch[i] != epoch)
+    {
+        /* left over from three epochs ago */
+        free_list(rec->limbo[i]);
+        rec->limbo[i] = NULL;
+    }
+    rec->limbo_epoch[i] = epoch;
+    entry->next = rec->limbo[i];
+    rec->limbo[i] = entry;
+
+    if (++rec->retired_count % EPOCH_BATCH == 0)
+    {
+        epoch_try_advance();
+        epoch_reclaim(rec);
+    }
+}
+/*---------------------------------------------------------------------------*/
+void epoch_drain(void)
+{
+    struct epoch_rec *rec;
+    int i;
+
+    for (rec = atomic_load(&g_recs); rec; rec = rec->next)
+    {
+        for (i = 0; i < EPOCH_LISTS; i++)
+        {
+            free_list(rec->limbo[i]);
+            rec->limbo[i] = NULL;
+        }
+    }
+}
@@ -0,0 +1,60 @@
+/*---------------------------------------------------------------------------*/
+/* epoch.h                                                                   */
+/* Author: Yeonjae Kim                                                       */
+/*---------------------------------------------------------------------------*/
+#ifndef _EPOCH_H
+#define _EPOCH_H
+/*---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "common.h"
+/*---------------------------------------------------------------------------*/
+/*
+ * epoch-based reclamation.
+ *
+ * readers traverse shared structures without locks between epoch_enter()
+ * and epoch_exit(). writers unlink an object and hand it to
+ * epoch_retire() instead of freeing it. the object is freed only after
+ * every thread that was inside a read-side section at that time has left
+ * it, i.e., once the global epoch has advanced twice.
+ *
+ * a retired object is kept on a list through an entry embedded in it, so
+ * that retiring allocates nothing and cannot fail.
+ */
+/*---------------------------------------------------------------------------*/
+struct epoch_entry
+{
+    void (*free_fn)(struct epoch_entry *);
+    struct epoch_entry *next;
+};
+/* the object of type holding entry as member */
+#define epoch_container(entry, type, member) \
+    ((type *)((char *)(entry) - offsetof(type, member)))
+/*---------------------------------------------------------------------------*/
+/**
+ * begins a read-side critical section. sections may nest.
+ */
+void epoch_enter(void);
+/*---------------------------------------------------------------------------*/
+/**
+ * ends a read-side critical section.
+ */
+void epoch_exit(void);
+/*---------------------------------------------------------------------------*/
+/**
+ * defers free_fn(entry) until no reader can still reference the object
+ * entry is embedded in, which free_fn finds with epoch_container().
+ */
+void epoch_retire(struct epoch_entry *entry,
+                  void (*free_fn)(struct epoch_entry *));
+/*---------------------------------------------------------------------------*/
+/**
+ * frees every retired object right away.
+ * only call this when no other thread is inside a read-side section.
+ */
+void epoch_drain(void);
+/*---------------------------------------------------------------------------*/
+#endif // _EPOCH_H
@@ -3,314 +3,2321 @@
 /* Author: Junghan Yoon, KyoungSoo Park                                      */
 /* Modified by: Yeonjae Kim                                                  */
 /*---------------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <time.h>
+#include <unistd.h>
 #include "hashtable.h"
+#include "epoch.h"
+#include "oatable.h"
+#include "slab.h"
 /*---------------------------------------------------------------------------*/
-int hash(const char *key, size_t hash_size)
+value_t *value_alloc(size_t len)
+{
+    value_t *value = slab_alloc(sizeof(value_t) + len + 1);
+
+    if (value == NULL)
+    {
+        return NULL;
+    }
+    atomic_init(&value->refcnt, 1);
+    value->len = len;
+    value->expire_at = 0;
+    value->version = 0;
+    value->referenced = 0;
+    value->data = value->inline_data;
+    value->data[len] = '\0';
+
+    return value;
+}
+/*---------------------------------------------------------------------------*/
+value_t *value_new(const char *data, size_t len)
+{
+    value_t *value = value_alloc(len);
+
+    if (value == NULL)
+    {
+        return NULL;
+    }
+    memcpy(value->data, data, len);
+
+    return value;
+}
+/*---------------------------------------------------------------------------*/
+value_t *value_wrap(const char *data, size_t len)
+{
+    value_t *value = slab_alloc(sizeof(value_t));
+
+    if (value == NULL)
+    {
+        return NULL;
+    }
+    atomic_init(&value->refcnt, 1);
+    value->len = len;
+    value->expire_at = 0;
+    value->version = 0;
+    value->referenced = 0;
+    value->data = (char *)data;
+
+    return value;
+}
+/*---------------------------------------------------------------------------*/
+size_t value_bytes(const value_t *value)
+{
+    return sizeof(value_t) + (value->data == value->inline_data ?
+                              value->len + 1 : 0);
+}
+/*---------------------------------------------------------------------------*/
+value_t *value_get(value_t *value)
+{
+    atomic_fetch_add_explicit(&value->refcnt, 1, memory_order_relaxed);
+
+    return value;
+}
+/*---------------------------------------------------------------------------*/
+void value_put(value_t *value)
+{
+    if (atomic_fetch_sub_explicit(&value->refcnt, 1,
+                                  memory_order_acq_rel) == 1)
+    {
+        slab_free(value, value_bytes(value));
+    }
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * tells whether the value has expired. the expiry of a value in the
+ * table may change under lock-free readers, hence the atomic load.
+ */
+static inline int value_expired(const value_t *value)
+{
+    uint64_t at = __atomic_load_n(&value->expire_at, __ATOMIC_RELAXED);
+
+    return at && at <= ttl_now();
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * marks a value as read for the clock hand, with no lock. the bit is
+ * only written when clear, so that hot values are not written over and
+ * over.
+ */
+static inline void value_touch(value_t *value)
+{
+    if (!__atomic_load_n(&value->referenced, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&value->referenced, 1, __ATOMIC_RELAXED);
+    }
+}
+/*---------------------------------------------------------------------------*/
+static inline uint64_t wy_mix(uint64_t a, uint64_t b)
+{
+    __uint128_t r = (__uint128_t)a * b;
+
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+/*---------------------------------------------------------------------------*/
+static inline uint64_t wy_read8(const unsigned char *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+/*---------------------------------------------------------------------------*/
+static inline uint64_t wy_read4(const unsigned char *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+/*---------------------------------------------------------------------------*/
+uint64_t hash_wyhash(const char *key, size_t len, uint64_t seed)
+{
+    static const uint64_t secret[2] = {0xa0761d6478bd642full,
+                                       0xe7037ed1a0b428dbull};
+    const unsigned char *p = (const unsigned char *)key;
+    uint64_t a, b;
+    size_t i;
+
+    seed ^= wy_mix(seed ^ secret[0], secret[1]);
+    if (len <= 16)
+    {
+        if (len >= 4)
+        {
+            /* overlapping reads cover 4 to 16 bytes */
+            a = (wy_read4(p) << 32) | wy_read4(p + ((len >> 3) << 2));
+            b = (wy_read4(p + len - 4) << 32) |
+                wy_read4(p + len - 4 - ((len >> 3) << 2));
+        }
+        else if (len > 0)
+        {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) |
+                p[len - 1];
+            b = 0;
+        }
+        else
+        {
+            a = b = 0;
+        }
+    }
+    else
+    {
+        for (i = len; i > 16; i -= 16, p += 16)
+        {
+            seed = wy_mix(wy_read8(p) ^ secret[1], wy_read8(p + 8) ^ seed);
+        }
+        /* the last 16 bytes, overlapping the ones already mixed */
+        a = wy_read8(p + i - 16);
+        b = wy_read8(p + i - 8);
+    }
+
+    return wy_mix(secret[1] ^ len, wy_mix(a ^ secret[1], b ^ seed));
+}
+/*---------------------------------------------------------------------------*/
+uint64_t hash_shift_add(const char *key, size_t len, uint64_t seed)
+{
+    unsigned int hash = 0;
+    size_t i;
+
+    (void)seed;
+    for (i = 0; i < len; i++)
+    {
+        hash = (hash << 5) + key[i];
+    }
+
+    return hash;
+}
+/*---------------------------------------------------------------------------*/
+/* hashes a key once per operation, for both placement and comparison */
+uint64_t hash_key(hashtable_t *table, const char *key)
+{
+    return table->hash_fn(key, strlen(key), table->seed);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * counts the NUMA nodes online, as the kernel lists them, e.g., "0-3".
+ * returns 1 when it cannot tell.
+ */
+static int numa_nodes(void)
+{
+    static int nodes;
+    char buf[64], *p;
+    FILE *fp;
+    int n = 1;
+
+    if (nodes)
+    {
+        return nodes;
+    }
+    fp = fopen("/sys/devices/system/node/online", "r");
+    if (fp != NULL)
+    {
+        if (fgets(buf, sizeof(buf), fp) != NULL)
+        {
+            /* the highest node comes last */
+            p = buf + strcspn(buf, "\n");
+            while (p > buf && isdigit((unsigned char)p[-1]))
+            {
+                p--;
+            }
+            n = atoi(p) + 1;
+        }
+        fclose(fp);
+    }
+    nodes = n;
+
+    return nodes;
+}
+/*---------------------------------------------------------------------------*/
+/* whether table_alloc() maps len bytes apart and interleaves them */
+static inline int table_interleaved(size_t len)
+{
+    return numa_nodes() > 1 && len >= (size_t)sysconf(_SC_PAGESIZE);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * allocates len zeroed bytes aligned to a cache line, for the lock
+ * stripes and the bucket arrays. on a machine of several NUMA nodes, a
+ * large one is mapped apart with its pages interleaved over the nodes, so
+ * that no single node serves every lookup. free it with table_free().
+ * returns NULL when any internal errors occur.
+ */
+static void *table_alloc(size_t len)
+{
+    unsigned long mask;
+    void *p;
+    int nodes;
+
+    if (table_interleaved(len))
+    {
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+        {
+            return NULL;
+        }
+        /* placed as the pages are touched, and zeroed already */
+        nodes = numa_nodes();
+        mask = nodes >= 8 * (int)sizeof(mask) ? ~0ul : (1ul << nodes) - 1;
+        if (syscall(SYS_mbind, p, len, MPOL_INTERLEAVE, &mask,
+                    8 * sizeof(mask), 0) != 0)
+        {
+            DEBUG_PRINT("mbind() failed, leaving pages to first touch");
+        }
+        return p;
+    }
+
+    if (posix_memalign(&p, CACHE_LINE_SIZE, len) != 0)
+    {
+        return NULL;
+    }
+    memset(p, 0, len);
+
+    return p;
+}
+/*---------------------------------------------------------------------------*/
+static void table_free(void *p, size_t len)
+{
+    if (p == NULL)
+    {
+        return;
+    }
+    if (table_interleaved(len))
+    {
+        munmap(p, len);
+        return;
+    }
+    free(p);
+}
+/*---------------------------------------------------------------------------*/
+static bucket_array_t *array_new(size_t size)
+{
+    bucket_array_t *array = malloc(sizeof(bucket_array_t));
+
+    if (array == NULL)
+    {
+        return NULL;
+    }
+    array->size = size;
+    array->buckets = table_alloc(size * sizeof(node_t *));
+    array->bucket_sizes = table_alloc(size * sizeof(size_t));
+    array->migrated = NULL;
+    if (array->buckets == NULL || array->bucket_sizes == NULL)
+    {
+        table_free(array->buckets, size * sizeof(node_t *));
+        table_free(array->bucket_sizes, size * sizeof(size_t));
+        free(array);
+        return NULL;
+    }
+
+    return array;
+}
+/*---------------------------------------------------------------------------*/
+static void array_free(void *arg)
+{
+    bucket_array_t *array = arg;
+
+    table_free(array->buckets, array->size * sizeof(node_t *));
+    table_free(array->bucket_sizes, array->size * sizeof(size_t));
+    table_free(array->migrated, array->size);
+    free(array);
+}
+/*---------------------------------------------------------------------------*/
+static void node_free(void *arg)
+{
+    node_t *node = arg;
+
+    if (node->key_size)
+    {
+        slab_free(node->key, node->key_size);
+    }
+    value_put(node->value);
+    slab_free(node, sizeof(node_t));
+}
+/*---------------------------------------------------------------------------*/
+/* frees a node whose key and value were handed over to a copy */
+static void node_shell_free(void *arg)
+{
+    slab_free(arg, sizeof(node_t));
+}
+/*---------------------------------------------------------------------------*/
+/* the callbacks of epoch_retire(), for the objects the entries are in */
+static void array_retired(struct epoch_entry *entry)
+{
+    array_free(epoch_container(entry, bucket_array_t, retire));
+}
+/*---------------------------------------------------------------------------*/
+static void node_retired(struct epoch_entry *entry)
+{
+    node_free(epoch_container(entry, node_t, retire));
+}
+/*---------------------------------------------------------------------------*/
+static void node_shell_retired(struct epoch_entry *entry)
+{
+    node_shell_free(epoch_container(entry, node_t, retire));
+}
+/*---------------------------------------------------------------------------*/
+static void value_retired(struct epoch_entry *entry)
+{
+    value_put(epoch_container(entry, value_t, retire));
+}
+/*---------------------------------------------------------------------------*/
+/* frees the nodes still owned by the array */
+static void array_free_nodes(bucket_array_t *array)
+{
+    node_t *node, *tmp;
+    size_t i;
+
+    for (i = 0; i < array->size; i++)
+    {
+        if (array->migrated && array->migrated[i])
+        {
+            /* owned by the bigger array now */
+            continue;
+        }
+        node = array->buckets[i];
+        while (node)
+        {
+            tmp = node;
+            node = node->next;
+            node_free(tmp);
+        }
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* frees the entries with whatever holds them */
+static void hash_free_entries(hashtable_t *table)
+{
+    if (table->oa)
+    {
+        oa_destroy(table->oa);
+        return;
+    }
+    if (table->old)
+    {
+        array_free_nodes(table->old);
+        array_free(table->old);
+    }
+    array_free_nodes(table->cur);
+    array_free(table->cur);
+}
+/*---------------------------------------------------------------------------*/
+/* draws a random seed, falling back to the clock without getrandom() */
+static uint64_t hash_seed(void)
+{
+    struct timespec ts;
+    uint64_t seed;
+
+    if (getrandom(&seed, sizeof(seed), 0) == sizeof(seed))
+    {
+        return seed;
+    }
+    DEBUG_PRINT("getrandom() failed, seeding from the clock");
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return ((uint64_t)ts.tv_sec << 32) ^ ts.tv_nsec ^ getpid();
+}
+/*---------------------------------------------------------------------------*/
+hashtable_t *hash_init(size_t hash_size, size_t buckets_per_lock, int delay,
+                       int flags)
+{
+    TRACE_PRINT();
+    int ret, policy = RWLOCK_WRITER_PREF;
+    hashtable_t *table;
+    struct timespec now;
+    size_t i, j;
+
+    if (buckets_per_lock == 0)
+    {
+        DEBUG_PRINT("A lock stripe needs at least one bucket");
+        return NULL;
+    }
+    table = calloc(1, sizeof(hashtable_t));
+    if (table == NULL)
+    {
+        DEBUG_PRINT("Failed to allocate memory for hash table");
+        return NULL;
+    }
+
+    /* every array size must be a multiple of the stripes */
+    table->num_locks = (hash_size + buckets_per_lock - 1) / buckets_per_lock;
+    hash_size = table->num_locks * buckets_per_lock;
+    table->lockfree_read = !!(flags & HASH_LOCKFREE_READ);
+    table->hash_fn = hash_wyhash;
+    table->seed = hash_seed();
+
+    if (flags & HASH_OPEN_ADDRESSING)
+    {
+        if (table->lockfree_read)
+        {
+            /* slots are moved around under the write lock */
+            DEBUG_PRINT("Lock-free reads need the chained engine");
+            free(table);
+            return NULL;
+        }
+        /* a shard per stripe, each growing by itself */
+        table->oa = oa_init(table->num_locks);
+        if (table->oa == NULL)
+        {
+            free(table);
+            return NULL;
+        }
+    }
+    else
+    {
+        table->cur = array_new(hash_size);
+        if (table->cur == NULL)
+        {
+            DEBUG_PRINT("Failed to allocate memory for hash table buckets");
+            free(table);
+            return NULL;
+        }
+    }
+
+    table->stripes = table_alloc(table->num_locks * sizeof(hash_stripe_t));
+    if (table->stripes == NULL)
+    {
+        DEBUG_PRINT("Failed to allocate memory for hash table locks");
+        hash_free_entries(table);
+        free(table);
+        return NULL;
+    }
+    atomic_init(&table->bytes, 0);
+    atomic_init(&table->evict_hand, 0);
+    atomic_init(&table->evictions, 0);
+
+    table->ttl = ttl_init();
+    if (table->ttl == NULL)
+    {
+        DEBUG_PRINT("Failed to allocate memory for hash table timers");
+        hash_free_entries(table);
+        table_free(table->stripes, table->num_locks * sizeof(hash_stripe_t));
+        free(table);
+        return NULL;
+    }
+    atomic_init(&table->ttl_used, 0);
+
+    if (flags & HASH_LOCK_FAIR)
+    {
+        policy = RWLOCK_PHASE_FAIR;
+    }
+    else if (flags & HASH_LOCK_MUTEX)
+    {
+        policy = RWLOCK_MUTEX;
+    }
+    clock_gettime(CLOCK_REALTIME, &now);
+    for (i = 0; i < table->num_locks; i++)
+    {
+        /*
+         * versions go on from the time in ns, which is past any version a
+         * previous table gave out, unless a stripe of it stored more than
+         * one value per ns it was up, or the clock was set back since.
+         */
+        table->stripes[i].version = (uint64_t)now.tv_sec * 1000000000 +
+                                    now.tv_nsec;
+        ret = rwlock_init_policy(&table->stripes[i].lock, delay, policy);
+        if (ret != 0)
+        {
+            DEBUG_PRINT("Failed to initialize read-write lock");
+            for (j = 0; j < i; j++)
+            {
+                rwlock_destroy(&table->stripes[j].lock);
+            }
+            hash_free_entries(table);
+            ttl_destroy(table->ttl);
+            table_free(table->stripes,
+                       table->num_locks * sizeof(hash_stripe_t));
+            free(table);
+            return NULL;
+        }
+    }
+
+    if (flags & HASH_ORDERED_INDEX)
+    {
+        table->index = skip_init(policy);
+        if (table->index == NULL)
+        {
+            hash_destroy(table);
+            return NULL;
+        }
+    }
+
+    return table;
+}
+/*---------------------------------------------------------------------------*/
+int hash_set_function(hashtable_t *table, hash_fn_t fn)
+{
+    TRACE_PRINT();
+    size_t i;
+
+    for (i = 0; i < table->num_locks; i++)
+    {
+        if (table->stripes[i].entries)
+        {
+            DEBUG_PRINT("Cannot change the hash of a non-empty table");
+            return -1;
+        }
+    }
+    table->hash_fn = fn;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+int hash_set_seed(hashtable_t *table, uint64_t seed)
+{
+    TRACE_PRINT();
+
+    if (hash_count(table))
+    {
+        DEBUG_PRINT("Cannot change the seed of a non-empty table");
+        return -1;
+    }
+    table->seed = seed;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+int hash_reserve(hashtable_t *table, size_t count)
+{
+    TRACE_PRINT();
+    bucket_array_t *array;
+    size_t size;
+
+    if (hash_count(table))
+    {
+        DEBUG_PRINT("Cannot resize a non-empty table up front");
+        return -1;
+    }
+    if (table->oa)
+    {
+        /* shards grow by themselves */
+        return 0;
+    }
+
+    /* half the maximum load, so that a fuller stripe does not grow it */
+    size = table->cur->size;
+    while (size * HASH_MAX_LOAD < count * 2)
+    {
+        size *= 2;
+    }
+    if (size == table->cur->size)
+    {
+        return 0;
+    }
+    array = array_new(size);
+    if (array == NULL)
+    {
+        DEBUG_PRINT("Failed to allocate memory for hash table buckets");
+        return -1;
+    }
+    array_free(table->cur);
+    table->cur = array;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+void hash_set_limit(hashtable_t *table, size_t bytes)
+{
+    TRACE_PRINT();
+
+    table->mem_limit = bytes;
+}
+/*---------------------------------------------------------------------------*/
+int hash_set_hot(hashtable_t *table, const char *key, int on)
+{
+    TRACE_PRINT();
+    uint64_t h = hash_key(table, key);
+
+    return rwlock_set_big_reader(&table->stripes[h % table->num_locks].lock, on);
+}
+/*---------------------------------------------------------------------------*/
+void hash_set_log(hashtable_t *table, hash_log_fn_t fn, void *arg)
+{
+    TRACE_PRINT();
+
+    table->log_arg = arg;
+    table->log_fn = fn;
+}
+/*---------------------------------------------------------------------------*/
+int hash_destroy(hashtable_t *table)
+{
+    TRACE_PRINT();
+    size_t i;
+
+    hash_free_entries(table);
+
+    for (i = 0; i < table->num_locks; i++)
+    {
+        if (rwlock_destroy(&table->stripes[i].lock) != 0)
+        {
+            DEBUG_PRINT("Failed to destroy read-write lock");
+            return -1;
+        }
+    }
+
+    /* no reader is left, so free what is still waiting for a grace period */
+    epoch_drain();
+
+    ttl_destroy(table->ttl);
+    skip_destroy(table->index);
+    table_free(table->stripes, table->num_locks * sizeof(hash_stripe_t));
+    free(table);
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * starts doubling the table, unless a resize is already running.
+ * the caller should be in an epoch section.
+ */
+static void hash_grow(hashtable_t *table)
+{
+    bucket_array_t *cur, *next;
+    int expected = 0;
+
+    if (!atomic_compare_exchange_strong(&table->resizing, &expected, 1))
+    {
+        return;
+    }
+
+    cur = __atomic_load_n(&table->cur, __ATOMIC_ACQUIRE);
+    next = array_new(cur->size * 2);
+    cur->migrated = table_alloc(cur->size);
+    if (next == NULL || cur->migrated == NULL)
+    {
+        DEBUG_PRINT("Failed to allocate memory to grow hash table");
+        if (next)
+        {
+            array_free(next);
+        }
+        table_free(cur->migrated, cur->size);
+        cur->migrated = NULL;
+        atomic_store(&table->resizing, 0);
+        return;
+    }
+
+    __atomic_store_n(&table->migrate_next, 0, __ATOMIC_RELAXED);
+    atomic_store(&table->migrated_count, 0);
+
+    /* lookups load cur before old, so old must be visible first */
+    __atomic_store_n(&table->old, cur, __ATOMIC_RELEASE);
+    __atomic_store_n(&table->cur, next, __ATOMIC_RELEASE);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * moves bucket b of old to cur. the caller holds the write lock of its
+ * stripe, and is in an epoch section.
+ * with lock-free readers, which may be walking the old chain right now,
+ * the nodes are copied and the old ones retired; otherwise they are
+ * simply relinked.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success.
+ */
+static int
+migrate_bucket(hashtable_t *table, bucket_array_t *old, bucket_array_t *cur,
+               size_t b)
+{
+    node_t *node, *next, *copies = NULL, *copy;
+    size_t index;
+
+    if (old->migrated[b])
+    {
+        return 0;
+    }
+
+    if (table->lockfree_read)
+    {
+        /* allocate every copy first, so that a failure changes nothing */
+        for (node = old->buckets[b]; node; node = node->next)
+        {
+            copy = slab_alloc(sizeof(node_t));
+            if (copy == NULL)
+            {
+                while (copies)
+                {
+                    copy = copies->next;
+                    node_shell_free(copies);
+                    copies = copy;
+                }
+                return -1;
+            }
+            *copy = *node;
+            copy->next = copies;
+            copies = copy;
+        }
+    }
+
+    for (node = old->buckets[b]; node; node = next)
+    {
+        next = node->next;
+        if (table->lockfree_read)
+        {
+            copy = copies;
+            copies = copies->next;
+        }
+        else
+        {
+            copy = node;
+        }
+        index = copy->hash % cur->size;
+        copy->next = cur->buckets[index];
+        __atomic_store_n(&cur->buckets[index], copy, __ATOMIC_RELEASE);
+        cur->bucket_sizes[index]++;
+    }
+
+    /* lookups of this bucket go to cur from now on */
+    __atomic_store_n(&old->migrated[b], 1, __ATOMIC_RELEASE);
+
+    if (table->lockfree_read)
+    {
+        /* the copies own the keys and the values now */
+        for (node = old->buckets[b]; node; node = next)
+        {
+            next = node->next;
+            epoch_retire(&node->retire, node_shell_retired);
+        }
+    }
+    else
+    {
+        old->buckets[b] = NULL;
+    }
+    old->bucket_sizes[b] = 0;
+
+    if (atomic_fetch_add(&table->migrated_count, 1) + 1 == old->size)
+    {
+        /* that was the last bucket */
+        __atomic_store_n(&table->old, NULL, __ATOMIC_RELEASE);
+        epoch_retire(&old->retire, array_retired);
+        atomic_store(&table->resizing, 0);
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * migrates a few old buckets in the background.
+ * the cursor walks the old buckets stripe by stripe, so that a batch is
+ * migrated under a single stripe lock.
+ * the caller holds no bucket lock, and is in an epoch section.
+ */
+static void hash_migrate_some(hashtable_t *table)
+{
+    bucket_array_t *old, *cur;
+    rwlock_t *lock;
+    size_t k, n, per, s;
+
+    cur = __atomic_load_n(&table->cur, __ATOMIC_ACQUIRE);
+    old = __atomic_load_n(&table->old, __ATOMIC_ACQUIRE);
+    if (old == NULL || old == cur)
+    {
+        return;
+    }
+    k = __atomic_load_n(&table->migrate_next, __ATOMIC_RELAXED);
+    if (k >= old->size)
+    {
+        return;
+    }
+
+    /* the k-th bucket of the walk is the (k % per)-th one of stripe s */
+    per = old->size / table->num_locks;
+    s = k / per;
+    lock = &table->stripes[s].lock;
+    rwlock_write_lock(lock);
+    if (__atomic_load_n(&table->old, __ATOMIC_ACQUIRE) != old)
+    {
+        rwlock_write_unlock(lock);
+        return;
+    }
+    for (n = 0; n < HASH_MIGRATE_BATCH && k + n < (s + 1) * per; n++)
+    {
+        if (migrate_bucket(table, old, cur,
+                           s + (k + n) % per * table->num_locks) < 0)
+        {
+            break;
+        }
+    }
+    rwlock_write_unlock(lock);
+
+    /* someone else may have advanced it already */
+    __atomic_compare_exchange_n(&table->migrate_next, &k, k + n, 0,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+/*---------------------------------------------------------------------------*/
+/* where a key lives, for operations on a locked stripe */
+struct slot
+{
+    bucket_array_t *array;
+    size_t index;
+};
+/*---------------------------------------------------------------------------*/
+/**
+ * finds the bucket of the key with hash h. the caller is in an epoch
+ * section, and holds the stripe lock unless it is a lock-free reader.
+ * for writes, the caller holds the stripe write lock, and an unmoved old
+ * bucket is migrated first so that the write lands in the current array.
+ * returns -1 when the migration fails.
+ * returns 0 on success.
+ */
+static int
+locate(hashtable_t *table, uint64_t h, int write, struct slot *slot)
+{
+    bucket_array_t *old, *cur;
+    size_t b;
+
+    /* see hash_grow() for the order */
+    cur = __atomic_load_n(&table->cur, __ATOMIC_ACQUIRE);
+    old = __atomic_load_n(&table->old, __ATOMIC_ACQUIRE);
+
+    if (old && old != cur)
+    {
+        b = h % old->size;
+        if (!__atomic_load_n(&old->migrated[b], __ATOMIC_ACQUIRE))
+        {
+            if (!write)
+            {
+                slot->array = old;
+                slot->index = b;
+                return 0;
+            }
+            if (migrate_bucket(table, old, cur, b) < 0)
+            {
+                return -1;
+            }
+        }
+    }
+
+    slot->array = cur;
+    slot->index = h % cur->size;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * finds the node of key with hash h in a bucket, and its predecessor if
+ * asked. hashes are compared first, so strcmp() mostly runs on a match.
+ * the caller either holds the bucket lock or is in an epoch section;
+ * links are loaded with acquire semantics to pair with the writers'
+ * release stores in the latter case.
+ */
+static node_t *
+bucket_lookup(struct slot *slot, uint64_t h, const char *key, node_t **prev)
+{
+    node_t *node, *p = NULL;
+
+    node = __atomic_load_n(&slot->array->buckets[slot->index],
+                           __ATOMIC_ACQUIRE);
+    while (node)
+    {
+        if (node->hash == h && strcmp(node->key, key) == 0)
+        {
+            break;
+        }
+        p = node;
+        node = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+    }
+    if (prev)
+    {
+        *prev = p;
+    }
+
+    return node;
+}
+/*---------------------------------------------------------------------------*/
+/* heap bytes a node takes with its key and value */
+static inline size_t node_bytes(const node_t *node)
+{
+    return sizeof(node_t) + node->key_size + value_bytes(node->value);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * hash_insert() on a write-locked stripe of the chained engine.
+ * the node takes over the reference to value, and points at key without
+ * a copy when set mapped. the writes of the engine set *delta as those
+ * of oatable.h do.
+ */
+static int
+chain_insert(hashtable_t *table, uint64_t h,
+             const char *key, value_t *value, int mapped, ssize_t *delta)
+{
+    struct slot slot;
+    node_t *node;
+
+    if (locate(table, h, 1, &slot) < 0)
+    {
+        return -1;
+    }
+    if (bucket_lookup(&slot, h, key, NULL))
+    {
+        return 0;
+    }
+
+    node = (node_t *)slab_alloc(sizeof(node_t));
+    if (node == NULL)
+        return -1;
+
+    if (mapped)
+    {
+        node->key_size = 0;
+        node->key = (char *)key;
+    }
+    else
+    {
+        node->key_size = strlen(key) + 1;
+        node->key = (char *)slab_alloc(node->key_size);
+        if (node->key == NULL) {
+            slab_free(node, sizeof(node_t));
+            return -1;
+        }
+        memcpy(node->key, key, node->key_size);
+    }
+    node->hash = h;
+    node->value = value;
+    *delta = node_bytes(node);
+
+    /* the node must be complete before lock-free readers can reach it */
+    node->next = slot.array->buckets[slot.index];
+    __atomic_store_n(&slot.array->buckets[slot.index], node,
+                     __ATOMIC_RELEASE);
+    slot.array->bucket_sizes[slot.index]++;
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+/* hash_search() on a read-locked stripe of the chained engine, or in an
+ * epoch section */
+static int
+chain_search(hashtable_t *table, uint64_t h,
+             const char *key, value_t **value)
+{
+    struct slot slot;
+    node_t *node;
+
+    locate(table, h, 0, &slot);
+    node = bucket_lookup(&slot, h, key, NULL);
+    if (node == NULL)
+    {
+        return 0;
+    }
+    *value = value_get(__atomic_load_n(&node->value, __ATOMIC_ACQUIRE));
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+/* hash_update() on a write-locked stripe of the chained engine,
+ * taking over the reference to value on success */
+static int
+chain_update(hashtable_t *table, uint64_t h,
+             const char *key, value_t *value, ssize_t *delta)
+{
+    struct slot slot;
+    node_t *node;
+    value_t *old_value;
+
+    if (locate(table, h, 1, &slot) < 0)
+    {
+        return -1;
+    }
+    node = bucket_lookup(&slot, h, key, NULL);
+    if (node == NULL)
+    {
+        return 0;
+    }
+
+    old_value = node->value;
+    if (value->expire_at == 0)
+    {
+        /* the new value is not published yet, so it is a plain store */
+        value->expire_at = __atomic_load_n(&old_value->expire_at,
+                                           __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&node->value, value, __ATOMIC_RELEASE);
+    *delta = (ssize_t)value_bytes(value) - (ssize_t)value_bytes(old_value);
+
+    /*
+     * readers still holding the old value keep it alive. a lock-free
+     * reader may have loaded the pointer without a reference yet, so
+     * the table's reference is dropped after a grace period.
+     */
+    if (table->lockfree_read)
+    {
+        epoch_retire(&old_value->retire, value_retired);
+    }
+    else
+    {
+        value_put(old_value);
+    }
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+/* hash_delete() on a write-locked stripe of the chained engine */
+static int
+chain_delete(hashtable_t *table, uint64_t h, const char *key,
+             ssize_t *delta)
+{
+    struct slot slot;
+    node_t *node, *prev;
+
+    if (locate(table, h, 1, &slot) < 0)
+    {
+        return -1;
+    }
+    node = bucket_lookup(&slot, h, key, &prev);
+    if (node == NULL)
+    {
+        return 0;
+    }
+
+    /* lock-free readers on the node can still follow its next link */
+    if (prev)
+    {
+        __atomic_store_n(&prev->next, node->next, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        __atomic_store_n(&slot.array->buckets[slot.index], node->next,
+                         __ATOMIC_RELEASE);
+    }
+    slot.array->bucket_sizes[slot.index]--;
+    *delta = -(ssize_t)node_bytes(node);
+
+    if (table->lockfree_read)
+    {
+        epoch_retire(&node->retire, node_retired);
+    }
+    else
+    {
+        node_free(node);
+    }
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * oa_evict() for the chained engine, with the hand counting the buckets
+ * of stripe s in the current array. the hand clears the referenced bits
+ * of a bucket at a time, and an old bucket is migrated first, as for a
+ * write.
+ */
+static int
+chain_evict(hashtable_t *table, size_t s, const char *keep,
+            uint64_t *h, char *key)
+{
+    struct slot slot;
+    node_t *node, *victim;
+    size_t per, n, b;
+
+    per = __atomic_load_n(&table->cur, __ATOMIC_ACQUIRE)->size /
+          table->num_locks;
+    for (n = 0; n < per; n++)
+    {
+        /* the bucket index stands in for a hash of the stripe */
+        b = s + table->stripes[s].clock_hand++ % per * table->num_locks;
+        if (locate(table, b, 1, &slot) < 0)
+        {
+            return 0;
+        }
+        victim = NULL;
+        for (node = slot.array->buckets[slot.index]; node; node = node->next)
+        {
+            if (__atomic_load_n(&node->value->referenced, __ATOMIC_RELAXED))
+            {
+                __atomic_store_n(&node->value->referenced, 0,
+                                 __ATOMIC_RELAXED);
+            }
+            else if (victim == NULL &&
+                     (keep == NULL || strcmp(node->key, keep) != 0))
+            {
+                victim = node;
+            }
+        }
+        if (victim)
+        {
+            *h = victim->hash;
+            strcpy(key, victim->key);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* tells the log hook about a change, under the stripe write lock */
+static inline void
+hash_log(hashtable_t *table, int op, const char *key, const value_t *value)
+{
+    if (table->log_fn)
+    {
+        table->log_fn(table->log_arg, op, key, value);
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* counts the bytes an entry of the stripe of h took or gave up */
+static inline void stripe_account(hashtable_t *table, uint64_t h,
+                                  ssize_t delta)
+{
+    table->stripes[h % table->num_locks].bytes += delta;
+    /* wraps back as it is given up, so a negative delta just adds */
+    atomic_fetch_add_explicit(&table->bytes, delta, memory_order_relaxed);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * the operations on a locked stripe, with whichever engine is in use.
+ * bucket_insert() and bucket_update() take over the reference to value
+ * on success only, and log an expiry the entry ends up with right after
+ * the change.
+ */
+static int
+bucket_insert(hashtable_t *table, uint64_t h,
+              const char *key, value_t *value, int mapped)
+{
+    ssize_t delta;
+    int ret, indexed = 0;
+
+    /* linked first, so that a key in the table is always in the index */
+    if (table->index)
+    {
+        indexed = skip_insert(table->index, key);
+        if (indexed < 0)
+        {
+            return -1;
+        }
+    }
+    /* not published yet, so a plain store */
+    value->version = ++table->stripes[h % table->num_locks].version;
+    ret = table->oa ? oa_insert(table->oa, h, key, value, &delta) :
+                      chain_insert(table, h, key, value, mapped, &delta);
+    if (ret <= 0 && indexed > 0)
+    {
+        skip_delete(table->index, key);
+    }
+    if (ret > 0)
+    {
+        table->stripes[h % table->num_locks].entries++;
+        stripe_account(table, h, delta);
+        hash_log(table, HASH_OP_INSERT, key, value);
+        if (value->expire_at)
+        {
+            hash_log(table, HASH_OP_EXPIRE, key, value);
+        }
+    }
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+static int
+bucket_search(hashtable_t *table, uint64_t h,
+              const char *key, value_t **value)
+{
+    return table->oa ? oa_search(table->oa, h, key, value) :
+                       chain_search(table, h, key, value);
+}
+/*---------------------------------------------------------------------------*/
+static int
+bucket_update(hashtable_t *table, uint64_t h,
+              const char *key, value_t *value)
+{
+    ssize_t delta;
+    int ret;
+
+    value->version = ++table->stripes[h % table->num_locks].version;
+    ret = table->oa ? oa_update(table->oa, h, key, value, &delta) :
+                      chain_update(table, h, key, value, &delta);
+    if (ret > 0)
+    {
+        stripe_account(table, h, delta);
+        hash_log(table, HASH_OP_UPDATE, key, value);
+        if (value->expire_at)
+        {
+            hash_log(table, HASH_OP_EXPIRE, key, value);
+        }
+    }
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+static int
+bucket_delete(hashtable_t *table, uint64_t h, const char *key)
+{
+    ssize_t delta;
+    int ret;
+
+    ret = table->oa ? oa_delete(table->oa, h, key, &delta) :
+                      chain_delete(table, h, key, &delta);
+    if (ret > 0)
+    {
+        table->stripes[h % table->num_locks].entries--;
+        stripe_account(table, h, delta);
+        if (table->index)
+        {
+            skip_delete(table->index, key);
+        }
+        hash_log(table, HASH_OP_DELETE, key, NULL);
+    }
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * tells whether the stripe of h holds more entries than its share of the
+ * buckets should. with a uniform hash, every stripe fills up at the same
+ * rate, so this tracks the load factor without a shared counter.
+ * the caller holds the stripe lock.
+ */
+static int hash_overloaded(hashtable_t *table, uint64_t h)
+{
+    bucket_array_t *cur = __atomic_load_n(&table->cur, __ATOMIC_ACQUIRE);
+
+    if (table->oa)
+    {
+        /* shards grow by themselves */
+        return 0;
+    }
+
+    return table->stripes[h % table->num_locks].entries >
+           cur->size / table->num_locks * HASH_MAX_LOAD;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * deletes key if it has expired, before a write goes on as if it had
+ * never been there. the caller holds the stripe write lock.
+ * returns 1 when it was deleted.
+ * returns 0 otherwise.
+ */
+static int stripe_reap(hashtable_t *table, uint64_t h, const char *key)
+{
+    value_t *value;
+    int expired;
+
+    if (!atomic_load_explicit(&table->ttl_used, memory_order_relaxed) ||
+        bucket_search(table, h, key, &value) <= 0)
+    {
+        return 0;
+    }
+    expired = value_expired(value);
+    value_put(value);
+
+    return expired && bucket_delete(table, h, key) > 0;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * marks the table as having expiries, before the first one is stored, so
+ * that a write seeing an expired entry knows to reap it.
+ */
+static inline void hash_use_ttl(hashtable_t *table)
+{
+    if (!atomic_load_explicit(&table->ttl_used, memory_order_relaxed))
+    {
+        atomic_store(&table->ttl_used, 1);
+    }
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * evicts an entry of stripe s other than keep, as the clock hand of the
+ * stripe picks it. the caller holds the stripe write lock.
+ * returns 1 when an entry was evicted.
+ * returns 0 when there is none to evict.
+ */
+static int stripe_evict(hashtable_t *table, size_t s, const char *keep)
+{
+    char key[MAX_KEY_LEN + 1];
+    uint64_t h;
+    int ret;
+
+    ret = table->oa ? oa_evict(table->oa, s, keep, &h, key) :
+                      chain_evict(table, s, keep, &h, key);
+    if (ret <= 0 || bucket_delete(table, h, key) <= 0)
+    {
+        return 0;
+    }
+    atomic_fetch_add_explicit(&table->evictions, 1, memory_order_relaxed);
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * evicts entries other than keep, just written, while the entries take
+ * more than the budget. the stripes give up an entry in turn, as the hand
+ * of the table passes them, and the clock hand of each stripe picks it.
+ * a stripe whose entries were all read since its hand last passed gives
+ * up none this turn, so that they are spared unless they are not read
+ * again before the next.
+ * the caller holds no stripe lock.
+ */
+static void hash_trim(hashtable_t *table, const char *keep)
+{
+    size_t s, missed = 0;
+
+    while (atomic_load_explicit(&table->bytes, memory_order_relaxed) >
+           table->mem_limit && missed < 2 * table->num_locks)
+    {
+        s = atomic_fetch_add_explicit(&table->evict_hand, 1,
+                                      memory_order_relaxed) %
+            table->num_locks;
+        rwlock_write_lock(&table->stripes[s].lock);
+        /* two full turns without an eviction leave only keep */
+        missed = stripe_evict(table, s, keep) ? 0 : missed + 1;
+        rwlock_write_unlock(&table->stripes[s].lock);
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* background work after a write of keep, with no stripe lock held */
+static void hash_after_write(hashtable_t *table, int grow, const char *keep)
+{
+    if (grow)
+    {
+        hash_grow(table);
+    }
+    if (__atomic_load_n(&table->old, __ATOMIC_ACQUIRE))
+    {
+        hash_migrate_some(table);
+    }
+    if (table->mem_limit)
+    {
+        hash_trim(table, keep);
+    }
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * bucket_insert() in place of an expired entry of the key, if any, and
+ * within the budget, if any.
+ */
+static int
+bucket_insert_fresh(hashtable_t *table, uint64_t h,
+                    const char *key, value_t *value, int mapped)
+{
+    size_t s = h % table->num_locks;
+    int ret, i, missed;
+
+    ret = bucket_insert(table, h, key, value, mapped);
+    if (ret == 0 && stripe_reap(table, h, key))
+    {
+        ret = bucket_insert(table, h, key, value, mapped);
+    }
+    if (ret < 0 && table->mem_limit)
+    {
+        /*
+         * out of memory, so make some room and try once more. a round
+         * that only clears referenced entries is followed by another.
+         */
+        for (i = 0, missed = 0; i < HASH_EVICT_BATCH && missed < 2;)
+        {
+            if (stripe_evict(table, s, NULL))
+            {
+                i++;
+            }
+            else
+            {
+                missed++;
+            }
+        }
+        if (i > 0)
+        {
+            ret = bucket_insert(table, h, key, value, mapped);
+        }
+    }
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+/* inserts value, taking over the reference on success */
+static int
+stripe_insert(hashtable_t *table, uint64_t h, const char *key,
+              value_t *value, int mapped)
+{
+    rwlock_t *lock;
+    uint64_t expire_at = value->expire_at;
+    int ret, grow;
+
+    if (expire_at)
+    {
+        hash_use_ttl(table);
+    }
+    epoch_enter();
+    lock = &table->stripes[h % table->num_locks].lock;
+    rwlock_write_lock(lock);
+    ret = bucket_insert_fresh(table, h, key, value, mapped);
+    grow = ret > 0 && hash_overloaded(table, h);
+    rwlock_write_unlock(lock);
+    hash_after_write(table, grow, key);
+    epoch_exit();
+
+    /* a timer that fires before it is added finds the entry expired */
+    if (ret > 0 && expire_at)
+    {
+        ttl_add(table->ttl, h, key, expire_at);
+    }
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+int hash_insert(hashtable_t *table, const char *key, const char *value)
 {
     TRACE_PRINT();
-    unsigned int hash = 0;
-    while (*key)
+
+/*---------------------------------------------------------------------------*/
+    /* edit here */
+    return hash_insert_len(table, key, value, strlen(value));
+/*---------------------------------------------------------------------------*/
+}
+/*---------------------------------------------------------------------------*/
+int hash_insert_len(hashtable_t *table, const char *key,
+                    const char *value, size_t len)
+{
+    TRACE_PRINT();
+    value_t *v;
+    int ret;
+
+    /* copied before locking, to keep the copy out of the critical section */
+    v = value_new(value, len);
+    if (v == NULL)
+    {
+        return -1;
+    }
+    ret = hash_insert_value(table, key, v);
+    if (ret <= 0)
+    {
+        value_put(v);
+    }
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+int hash_insert_value(hashtable_t *table, const char *key, value_t *value)
+{
+    TRACE_PRINT();
+
+    return stripe_insert(table, hash_key(table, key), key, value, 0);
+}
+/*---------------------------------------------------------------------------*/
+int hash_insert_mapped(hashtable_t *table, uint64_t h, const char *key,
+                       value_t *value)
+{
+    TRACE_PRINT();
+    uint64_t expire_at = value->expire_at;
+    int ret, grow;
+
+    if (expire_at)
+    {
+        hash_use_ttl(table);
+    }
+    /* nobody else sees the table yet, so the stripe lock is left out */
+    epoch_enter();
+    ret = bucket_insert_fresh(table, h, key, value, 1);
+    grow = ret > 0 && hash_overloaded(table, h);
+    hash_after_write(table, grow, key);
+    epoch_exit();
+
+    if (ret > 0 && expire_at)
+    {
+        ttl_add(table->ttl, h, key, expire_at);
+    }
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+int hash_search(hashtable_t *table, const char *key, value_t **value)
+{
+    TRACE_PRINT();
+    rwlock_t *lock;
+    uint64_t h = hash_key(table, key);
+    int ret;
+
+/*---------------------------------------------------------------------------*/
+    /* edit here */
+    epoch_enter();
+    if (table->lockfree_read)
+    {
+        ret = bucket_search(table, h, key, value);
+    }
+    else
+    {
+        lock = &table->stripes[h % table->num_locks].lock;
+        rwlock_read_lock(lock);
+        ret = bucket_search(table, h, key, value);
+        rwlock_read_unlock(lock);
+    }
+    epoch_exit();
+/*---------------------------------------------------------------------------*/
+
+    if (ret > 0 && value_expired(*value))
+    {
+        /* gone already, whether or not it has been reclaimed */
+        value_put(*value);
+        return 0;
+    }
+    if (ret > 0)
+    {
+        value_touch(*value);
+    }
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+int hash_update(hashtable_t *table, const char *key, const char *value)
+{
+    TRACE_PRINT();
+
+/*---------------------------------------------------------------------------*/
+    /* edit here */
+    return hash_update_len(table, key, value, strlen(value));
+/*---------------------------------------------------------------------------*/
+}
+/*---------------------------------------------------------------------------*/
+int hash_update_len(hashtable_t *table, const char *key,
+                    const char *value, size_t len)
+{
+    TRACE_PRINT();
+    value_t *v;
+    int ret;
+
+    /* copied before locking, as for an insert */
+    v = value_new(value, len);
+    if (v == NULL)
+    {
+        return -1;
+    }
+    ret = hash_update_value(table, key, v);
+    if (ret <= 0)
+    {
+        value_put(v);
+    }
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+int hash_update_value(hashtable_t *table, const char *key, value_t *value)
+{
+    TRACE_PRINT();
+    rwlock_t *lock;
+    uint64_t h = hash_key(table, key);
+    uint64_t expire_at = value->expire_at;
+    int ret;
+
+    if (expire_at)
+    {
+        hash_use_ttl(table);
+    }
+    epoch_enter();
+    lock = &table->stripes[h % table->num_locks].lock;
+    rwlock_write_lock(lock);
+    stripe_reap(table, h, key);
+    ret = bucket_update(table, h, key, value);
+    rwlock_write_unlock(lock);
+    hash_after_write(table, 0, key);
+    epoch_exit();
+
+    if (ret > 0 && expire_at)
+    {
+        ttl_add(table->ttl, h, key, expire_at);
+    }
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+int hash_cas(hashtable_t *table, const char *key, uint64_t version,
+             value_t *value)
+{
+    TRACE_PRINT();
+    rwlock_t *lock;
+    uint64_t h = hash_key(table, key);
+    uint64_t expire_at = value->expire_at;
+    value_t *cur;
+    int ret;
+
+    if (expire_at)
+    {
+        hash_use_ttl(table);
+    }
+    epoch_enter();
+    lock = &table->stripes[h % table->num_locks].lock;
+    rwlock_write_lock(lock);
+    stripe_reap(table, h, key);
+    ret = bucket_search(table, h, key, &cur);
+    if (ret > 0)
+    {
+        ret = cur->version == version ? 1 : HASH_ERR_VERSION;
+        value_put(cur);
+    }
+    if (ret > 0)
+    {
+        ret = bucket_update(table, h, key, value);
+    }
+    rwlock_write_unlock(lock);
+    hash_after_write(table, 0, key);
+    epoch_exit();
+
+    if (ret > 0 && expire_at)
+    {
+        ttl_add(table->ttl, h, key, expire_at);
+    }
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * parses a value as a decimal integer, with an optional minus sign.
+ * returns HASH_ERR_NAN when it is not one that fits 64 bits.
+ * returns 1 on success.
+ */
+static int value_int(const value_t *value, int64_t *n)
+{
+    char *end;
+
+    if (value->len == 0 ||
+        !(isdigit((unsigned char)value->data[0]) || value->data[0] == '-'))
+    {
+        return HASH_ERR_NAN;
+    }
+    errno = 0;
+    *n = strtoll(value->data, &end, 10);
+    if (errno || end != value->data + value->len)
+    {
+        return HASH_ERR_NAN;
+    }
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+int hash_incr(hashtable_t *table, const char *key, int64_t delta,
+              int64_t *result)
+{
+    TRACE_PRINT();
+    char buf[sizeof("-9223372036854775808")];
+    rwlock_t *lock;
+    uint64_t h = hash_key(table, key);
+    value_t *cur, *value;
+    int64_t n;
+    int ret;
+
+    epoch_enter();
+    lock = &table->stripes[h % table->num_locks].lock;
+    rwlock_write_lock(lock);
+    stripe_reap(table, h, key);
+    ret = bucket_search(table, h, key, &cur);
+    if (ret > 0)
+    {
+        ret = value_int(cur, &n);
+        value_put(cur);
+    }
+    if (ret > 0 && __builtin_add_overflow(n, delta, &n))
+    {
+        ret = HASH_ERR_RANGE;
+    }
+    if (ret > 0)
+    {
+        /* the sum is only known under the lock, so it is built here */
+        value = value_new(buf, snprintf(buf, sizeof(buf), "%lld",
+                                        (long long)n));
+        ret = value ? bucket_update(table, h, key, value) : -1;
+        if (ret <= 0 && value)
+        {
+            value_put(value);
+        }
+    }
+    if (ret > 0)
+    {
+        *result = n;
+    }
+    rwlock_write_unlock(lock);
+    hash_after_write(table, 0, key);
+    epoch_exit();
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+int hash_delete(hashtable_t *table, const char *key)
+{
+    TRACE_PRINT();
+    rwlock_t *lock;
+    uint64_t h = hash_key(table, key);
+    int ret;
+
+/*---------------------------------------------------------------------------*/
+    /* edit here */
+    epoch_enter();
+    lock = &table->stripes[h % table->num_locks].lock;
+    rwlock_write_lock(lock);
+    stripe_reap(table, h, key);
+    ret = bucket_delete(table, h, key);
+    rwlock_write_unlock(lock);
+    hash_after_write(table, 0, NULL);
+    epoch_exit();
+/*---------------------------------------------------------------------------*/
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+int hash_set_expiry(hashtable_t *table, const char *key, uint64_t expire_at)
+{
+    TRACE_PRINT();
+    rwlock_t *lock;
+    uint64_t h = hash_key(table, key);
+    value_t *value;
+    int ret;
+
+    if (expire_at)
     {
-        hash = (hash << 5) + *key++;
+        hash_use_ttl(table);
     }
+    epoch_enter();
+    lock = &table->stripes[h % table->num_locks].lock;
+    rwlock_write_lock(lock);
+    stripe_reap(table, h, key);
+    ret = bucket_search(table, h, key, &value);
+    if (ret > 0)
+    {
+        /* in place, as the value stays the same */
+        __atomic_store_n(&value->expire_at, expire_at, __ATOMIC_RELAXED);
+        hash_log(table, HASH_OP_EXPIRE, key, value);
+        value_put(value);
+    }
+    rwlock_write_unlock(lock);
+    hash_after_write(table, 0, NULL);
+    epoch_exit();
 
-    return hash % hash_size;
+    if (ret > 0 && expire_at)
+    {
+        ttl_add(table->ttl, h, key, expire_at);
+    }
+
+    return ret;
 }
 /*---------------------------------------------------------------------------*/
-hashtable_t *hash_init(size_t hash_size, int delay)
+/* reclaims key if its timer was the last word on it */
+static void hash_expire_key(void *arg, uint64_t h, const char *key)
 {
-    TRACE_PRINT();
-    int i, j, ret;
-    hashtable_t *table = malloc(sizeof(hashtable_t));
+    hashtable_t *table = arg;
+    rwlock_t *lock;
 
-    if (table == NULL)
+    epoch_enter();
+    lock = &table->stripes[h % table->num_locks].lock;
+    rwlock_write_lock(lock);
+    /* otherwise, deleted or given a later expiry meanwhile */
+    stripe_reap(table, h, key);
+    rwlock_write_unlock(lock);
+    hash_after_write(table, 0, NULL);
+    epoch_exit();
+}
+/*---------------------------------------------------------------------------*/
+int hash_expire(hashtable_t *table)
+{
+    if (!atomic_load_explicit(&table->ttl_used, memory_order_relaxed))
     {
-        DEBUG_PRINT("Failed to allocate memory for hash table");
-        return NULL;
+        return 0;
     }
 
-    table->hash_size = hash_size;
-    table->total_entries = 0;
+    return ttl_expire(table->ttl, ttl_now(), hash_expire_key, table);
+}
+/*---------------------------------------------------------------------------*/
+/* a key of a multi-key operation, ordered by stripe and then by position */
+struct mkey
+{
+    uint64_t hash;
+    unsigned int stripe;
+    int pos;
+};
+/*---------------------------------------------------------------------------*/
+static int mkey_cmp(const void *a, const void *b)
+{
+    const struct mkey *x = a, *y = b;
 
-    table->buckets = malloc(hash_size * sizeof(node_t *));
-    if (table->buckets == NULL)
+    if (x->stripe != y->stripe)
     {
-        DEBUG_PRINT("Failed to allocate memory for hash table buckets");
-        free(table);
-        return NULL;
+        return x->stripe < y->stripe ? -1 : 1;
     }
 
-    table->locks = malloc(hash_size * sizeof(rwlock_t));
-    if (table->locks == NULL)
+    return x->pos - y->pos;
+}
+/*---------------------------------------------------------------------------*/
+/* arguments of a multi-key operation */
+struct mop
+{
+    const char **keys;
+    value_t **values;      // input values, or output values found
+};
+/*---------------------------------------------------------------------------*/
+/**
+ * runs op for n keys, grouping them by stripe so that each stripe lock is
+ * taken once. keys in the same stripe are handled in the given order.
+ */
+static int
+hash_multi(hashtable_t *table, int write, int n, struct mop *m, int *results,
+           int (*op)(hashtable_t *, uint64_t, struct mop *, int))
+{
+    struct mkey order[MAX_MULTI_KEYS];
+    rwlock_t *lock;
+    int i, j, grow = 0;
+
+    if (n > MAX_MULTI_KEYS)
     {
-        DEBUG_PRINT("Failed to allocate memory for hash table locks");
-        free(table->buckets);
-        free(table);
-        return NULL;
+        return -1;
     }
 
-    table->bucket_sizes = malloc(hash_size * sizeof(*table->bucket_sizes));
-    if (table->bucket_sizes == NULL)
+    for (i = 0; i < n; i++)
     {
-        DEBUG_PRINT("Failed to allocate memory for hash table bucket sizes");
-        free(table->buckets);
-        free(table->locks);
-        free(table);
-        return NULL;
+        order[i].hash = hash_key(table, m->keys[i]);
+        order[i].stripe = order[i].hash % table->num_locks;
+        order[i].pos = i;
     }
+    qsort(order, n, sizeof(struct mkey), mkey_cmp);
 
-    for (i = 0; i < hash_size; i++)
+    epoch_enter();
+    if (!write && table->lockfree_read)
     {
-        table->buckets[i] = NULL;
-        table->bucket_sizes[i] = 0;
-        ret = rwlock_init(&table->locks[i], delay);
-        if (ret != 0)
+        for (i = 0; i < n; i++)
         {
-            DEBUG_PRINT("Failed to initialize read-write lock");
-            for (j = 0; j < i; j++)
-            {
-                rwlock_destroy(&table->locks[j]);
-            }
-            free(table->buckets);
-            free(table->locks);
-            free(table->bucket_sizes);
-            free(table);
-            return NULL;
+            results[order[i].pos] = op(table, order[i].hash, m,
+                                       order[i].pos);
         }
+        epoch_exit();
+        return 0;
     }
 
-    return table;
-}
-/*---------------------------------------------------------------------------*/
-int hash_destroy(hashtable_t *table)
-{
-    TRACE_PRINT();
-    node_t *node, *tmp;
-    int i;
-
-    for (i = 0; i < table->hash_size; i++)
+    for (i = 0; i < n; i = j)
     {
-        node = table->buckets[i];
-        while (node)
+        lock = &table->stripes[order[i].stripe].lock;
+        if (write)
         {
-            tmp = node;
-            node = node->next;
-            free(tmp->key);
-            free(tmp->value);
-            free(tmp);
+            rwlock_write_lock(lock);
         }
-        if (rwlock_destroy(&table->locks[i]) != 0)
+        else
         {
-            DEBUG_PRINT("Failed to destroy read-write lock");
-            return -1;
+            rwlock_read_lock(lock);
+        }
+
+        for (j = i; j < n && order[j].stripe == order[i].stripe; j++)
+        {
+            results[order[j].pos] = op(table, order[j].hash, m,
+                                       order[j].pos);
+        }
+        if (write && hash_overloaded(table, order[i].hash))
+        {
+            grow = 1;
         }
+
+        if (write)
+        {
+            rwlock_write_unlock(lock);
+        }
+        else
+        {
+            rwlock_read_unlock(lock);
+        }
+    }
+    if (write)
+    {
+        hash_after_write(table, grow, NULL);
     }
+    epoch_exit();
 
-    free(table->buckets);
-    free(table->locks);
-    free(table->bucket_sizes);
-    free(table);
-    
     return 0;
 }
 /*---------------------------------------------------------------------------*/
-int hash_insert(hashtable_t *table, const char *key, const char *value)
+static int
+multi_insert(hashtable_t *table, uint64_t h, struct mop *m, int pos)
 {
-    TRACE_PRINT();
-    node_t *node;
-    rwlock_t *lock;
-    unsigned int index = hash(key, table->hash_size);
+    if (m->values[pos] == NULL)
+    {
+        /* could not be copied */
+        return -1;
+    }
 
+    return bucket_insert_fresh(table, h, m->keys[pos], m->values[pos], 0);
+}
 /*---------------------------------------------------------------------------*/
-    /* edit here */
-    lock = &table->locks[index];
-    rwlock_write_lock(lock);
+static int
+multi_search(hashtable_t *table, uint64_t h, struct mop *m, int pos)
+{
+    value_t *value;
 
-    node = table->buckets[index];
-    while(node){
-        if(strcmp(node->key, key)==0){
-            rwlock_write_unlock(lock);
-            return 0;
-        }
-        node = node->next;
+    if (bucket_search(table, h, m->keys[pos], &value) <= 0)
+    {
+        return 0;
     }
-    
-    node = (node_t *)malloc(sizeof(node_t));
-    if (node == NULL)
-        return -1;
-
-    node->key_size = strlen(key) + 1;
-    node->key = (char *)malloc(node->key_size);
-    if (node->key == NULL) {
-        free(node);
-        return -1;
+    if (value_expired(value))
+    {
+        value_put(value);
+        return 0;
     }
+    value_touch(value);
+    m->values[pos] = value;
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+multi_delete(hashtable_t *table, uint64_t h, struct mop *m, int pos)
+{
+    stripe_reap(table, h, m->keys[pos]);
 
-    strncpy(node->key, key, node->key_size);
+    return bucket_delete(table, h, m->keys[pos]);
+}
+/*---------------------------------------------------------------------------*/
+int hash_minsert(hashtable_t *table, int n, const char **keys,
+                 const char **values, int *results)
+{
+    TRACE_PRINT();
+    value_t *made[MAX_MULTI_KEYS];
+    struct mop m = {keys, made};
+    int i, ret;
 
-    node->value_size = strlen(value) + 1;
-    node->value = (char *)malloc(node->value_size);
-    if (node->value == NULL) {
-        free(node->key);
-        free(node);
+    if (n > MAX_MULTI_KEYS)
+    {
         return -1;
     }
-    strncpy(node->value, value, node->value_size);
-    
-    node->next = table->buckets[index];
-    table->buckets[index] = node;
-    table->bucket_sizes[index]++;
-
-    rwlock_write_unlock(lock);
+    /* copied before locking, as in hash_insert() */
+    for (i = 0; i < n; i++)
+    {
+        made[i] = value_new(values[i], strlen(values[i]));
+    }
+    ret = hash_multi(table, 1, n, &m, results, multi_insert);
+    for (i = 0; i < n; i++)
+    {
+        if (made[i] && (ret < 0 || results[i] <= 0))
+        {
+            value_put(made[i]);
+        }
+    }
 
-    
+    return ret;
+}
 /*---------------------------------------------------------------------------*/
+int hash_msearch(hashtable_t *table, int n, const char **keys,
+                 value_t **values, int *results)
+{
+    TRACE_PRINT();
+    struct mop m = {keys, values};
 
-    /* inserted */
-    return 1;
+    return hash_multi(table, 0, n, &m, results, multi_search);
 }
 /*---------------------------------------------------------------------------*/
-int hash_search(hashtable_t *table, const char *key, const char **value)
+int hash_mdelete(hashtable_t *table, int n, const char **keys, int *results)
 {
     TRACE_PRINT();
-    node_t *node;
-    rwlock_t *lock;
-    unsigned int index = hash(key, table->hash_size);
+    struct mop m = {keys, NULL};
 
+    return hash_multi(table, 1, n, &m, results, multi_delete);
+}
 /*---------------------------------------------------------------------------*/
-    /* edit here */
-    lock = &table->locks[index];
-    rwlock_read_lock(lock);
-    node = table->buckets[index];
-    while(node){
-        if(strcmp(node->key, key)==0){
-            *value = strdup(node->value);
-            rwlock_read_unlock(lock);
-            return 1;
+int hash_scan(hashtable_t *table, const char *from, const char *to,
+              const char *prefix, int n, char (*keys)[MAX_KEY_LEN + 1],
+              value_t **values, char *next)
+{
+    TRACE_PRINT();
+    char found[MAX_MULTI_KEYS + 1][MAX_KEY_LEN + 1];
+    const char *names[MAX_MULTI_KEYS];
+    value_t *v[MAX_MULTI_KEYS];
+    int results[MAX_MULTI_KEYS];
+    int count, i, j;
+
+    if (table->index == NULL || n < 1 || n > MAX_MULTI_KEYS)
+    {
+        return -1;
+    }
+
+    /* one more than asked for, to tell where the next scan goes on */
+    count = skip_scan(table->index, from, to, prefix, found, n + 1);
+    if (count > n)
+    {
+        memcpy(next, found[n], MAX_KEY_LEN + 1);
+        count = n;
+    }
+    else
+    {
+        next[0] = '\0';
+    }
+
+    /* searched with the index unlocked, which no stripe lock nests in */
+    for (i = 0; i < count; i++)
+    {
+        names[i] = found[i];
+    }
+    hash_msearch(table, count, names, v, results);
+    for (i = j = 0; i < count; i++)
+    {
+        if (results[i] > 0)
+        {
+            memcpy(keys[j], found[i], MAX_KEY_LEN + 1);
+            values[j++] = v[i];
         }
-        node = node->next;
     }
-    rwlock_read_unlock(lock);
-    
+
+    return j;
+}
 /*---------------------------------------------------------------------------*/
+void hash_freeze(hashtable_t *table)
+{
+    TRACE_PRINT();
+    size_t s;
 
-    /* key not found */
-    return 0;
+    /* no one else holds two stripe locks, so any order is deadlock-free */
+    for (s = 0; s < table->num_locks; s++)
+    {
+        rwlock_write_lock(&table->stripes[s].lock);
+    }
 }
 /*---------------------------------------------------------------------------*/
-int hash_update(hashtable_t *table, const char *key, const char *value)
+void hash_thaw(hashtable_t *table)
 {
     TRACE_PRINT();
-    node_t *node;
-    rwlock_t *lock;
-    char *new_value;
-    unsigned int index = hash(key, table->hash_size);
+    size_t s;
 
+    for (s = 0; s < table->num_locks; s++)
+    {
+        rwlock_write_unlock(&table->stripes[s].lock);
+    }
+}
 /*---------------------------------------------------------------------------*/
-    /* edit here */
-    lock = &table->locks[index];
+/* visits the entries an array still owns */
+static int
+array_foreach(bucket_array_t *array, hash_visit_fn_t fn, void *arg)
+{
+    node_t *node;
+    size_t i;
 
-    rwlock_write_lock(lock);
-    node = table->buckets[index];
-    while(node){
-        if(strcmp(node->key, key)==0){
-            size_t new_value_size = strlen(value) + 1;
-            new_value = (char *)malloc(new_value_size);
-            if (new_value == NULL){
-                rwlock_write_unlock(lock);
+    for (i = 0; i < array->size; i++)
+    {
+        if (array->migrated && array->migrated[i])
+        {
+            continue;
+        }
+        for (node = array->buckets[i]; node; node = node->next)
+        {
+            if (fn(arg, node->hash, node->key, node->value) < 0)
+            {
                 return -1;
             }
-            free(node->value);
-            strncpy(new_value, value, new_value_size);
-            new_value[new_value_size] = 0;
-            node->value = new_value;
-            node->value_size = new_value_size;
-            
-            rwlock_write_unlock(lock);
-            return 1;
         }
-        node = node->next;
     }
-    rwlock_write_unlock(lock);
-    
-/*---------------------------------------------------------------------------*/
 
-    /* key not found */
     return 0;
 }
 /*---------------------------------------------------------------------------*/
-int hash_delete(hashtable_t *table, const char *key)
+size_t hash_count(hashtable_t *table)
+{
+    size_t s, n = 0;
+
+    for (s = 0; s < table->num_locks; s++)
+    {
+        n += table->stripes[s].entries;
+    }
+
+    return n;
+}
+/*---------------------------------------------------------------------------*/
+int hash_foreach(hashtable_t *table, hash_visit_fn_t fn, void *arg)
 {
     TRACE_PRINT();
-    node_t *node, *prev;
-    rwlock_t *lock;
-    unsigned int index = hash(key, table->hash_size);
 
+    if (table->oa)
+    {
+        return oa_foreach(table->oa, fn, arg);
+    }
+    /* a resize may have been caught between setting old and cur */
+    if (table->old && table->old != table->cur &&
+        array_foreach(table->old, fn, arg) < 0)
+    {
+        return -1;
+    }
+
+    return array_foreach(table->cur, fn, arg);
+}
 /*---------------------------------------------------------------------------*/
-    /* edit here */
-    lock = &table->locks[index];
-    prev = NULL;
-    rwlock_write_lock(lock);
-    node = table->buckets[index];
-    while(node){
-        if(strcmp(node->key, key) == 0){
-            free(node->key);
-            free(node->value);
-            if(prev){
-                prev->next = node->next;
-                free(node);
+void hash_chain_stats(hashtable_t *table, hash_stats_t *stats)
+{
+    TRACE_PRINT();
+    bucket_array_t *arrays[2];
+    size_t s, b, n, probes = 0;
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+    epoch_enter();
+    for (s = 0; s < table->num_locks; s++)
+    {
+        rwlock_read_lock(&table->stripes[s].lock);
+        stats->entries += table->stripes[s].entries;
+        stats->bytes += table->stripes[s].bytes;
+        if (table->oa)
+        {
+            oa_chain_stats(table->oa, s, stats, &probes);
+            rwlock_read_unlock(&table->stripes[s].lock);
+            continue;
+        }
+
+        /* see hash_grow() for the order */
+        arrays[0] = __atomic_load_n(&table->cur, __ATOMIC_ACQUIRE);
+        arrays[1] = __atomic_load_n(&table->old, __ATOMIC_ACQUIRE);
+        for (i = 0; i < 2; i++)
+        {
+            if (arrays[i] == NULL || (i == 1 && arrays[1] == arrays[0]))
+            {
+                continue;
             }
-            else{
-                table->buckets[index] = node->next;
-                free(node);
+            /* migrated buckets are counted as empty */
+            for (b = s; b < arrays[i]->size; b += table->num_locks)
+            {
+                n = arrays[i]->bucket_sizes[b];
+                if (i == 0 || n)
+                {
+                    /* an old array adds the buckets not migrated yet */
+                    stats->chains[n < HASH_CHAIN_HIST ?
+                                  n : HASH_CHAIN_HIST - 1]++;
+                }
+                if (n)
+                {
+                    stats->used_buckets++;
+                    if (n > stats->max_chain)
+                    {
+                        stats->max_chain = n;
+                    }
+                }
             }
-            table->bucket_sizes[index]--;
-            rwlock_write_unlock(lock);
-            return 1;
         }
+        rwlock_read_unlock(&table->stripes[s].lock);
+    }
+    if (!table->oa)
+    {
+        stats->buckets = __atomic_load_n(&table->cur, __ATOMIC_ACQUIRE)->size;
+    }
+    stats->evictions = atomic_load(&table->evictions);
+    epoch_exit();
 
-        prev = node;
-        node = node->next;
+    if (table->oa && stats->entries)
+    {
+        stats->mean_chain = (double)probes / stats->entries;
     }
-    rwlock_write_unlock(lock);
+    else if (stats->used_buckets)
+    {
+        stats->mean_chain = (double)stats->entries / stats->used_buckets;
+    }
+}
 /*---------------------------------------------------------------------------*/
-
-    /* key not found */
-    return 0;
+static inline uint64_t prof_wait_ns(const struct rwlock_prof *prof)
+{
+    return prof->read_wait_ns + prof->write_wait_ns;
 }
 /*---------------------------------------------------------------------------*/
-/* function to dump the contents of the hash table, including locks status */
-void hash_dump(hashtable_t *table)
+int hash_lock_profile(hashtable_t *table, hash_lock_prof_t *top, size_t n)
 {
     TRACE_PRINT();
-    node_t *node;
-    int i;
-    int total_entries = 0;
+    struct rwlock_prof prof;
+    size_t s, found = 0, i;
 
-    printf("[Hash Table Dump]");
-    for (i = 0; i < table->hash_size; i++)
+    for (s = 0; s < table->num_locks; s++)
     {
-        total_entries += table->bucket_sizes[i];
+        if (rwlock_profile(&table->stripes[s].lock, &prof) < 0)
+        {
+            return -1;
+        }
+        if (prof_wait_ns(&prof) == 0)
+        {
+            continue;
+        }
+        /* insertion into the few kept so far, longest first */
+        i = found < n ? found++ : n;
+        while (i > 0 && prof_wait_ns(&top[i - 1].prof) < prof_wait_ns(&prof))
+        {
+            if (i < n)
+            {
+                top[i] = top[i - 1];
+            }
+            i--;
+        }
+        if (i < n)
+        {
+            top[i].stripe = s;
+            top[i].entries = __atomic_load_n(&table->stripes[s].entries,
+                                             __ATOMIC_RELAXED);
+            top[i].prof = prof;
+        }
     }
-    table->total_entries = total_entries;
-    printf("Total Entries: %ld\n", table->total_entries);
 
-    for (i = 0; i < table->hash_size; i++)
+    return found;
+}
+/*---------------------------------------------------------------------------*/
+/* dumps the buckets of an array that it still owns */
+static void array_dump(hashtable_t *table, bucket_array_t *array)
+{
+    node_t *node;
+    size_t i;
+    int read_count, write_count;
+
+    for (i = 0; i < array->size; i++)
     {
-        if (!table->bucket_sizes[i])
+        if (!array->bucket_sizes[i])
         {
             continue;
         }
-        printf("Bucket %d: %ld entries\n", i, table->bucket_sizes[i]);
+        printf("Bucket %ld: %ld entries\n", i, array->bucket_sizes[i]);
+        rwlock_counts(&table->stripes[i % table->num_locks].lock,
+                      &read_count, &write_count);
         printf("  Lock State -> Read Count: %d, Write Count: %d\n",
-               table->locks[i].read_count, table->locks[i].write_count);
-        node = table->buckets[i];
+               read_count, write_count);
+        node = array->buckets[i];
         while (node)
         {
             printf("    Key:   %s\n"
-                   "    Value: %s\n", node->key, node->value);
+                   "    Value: %s\n", node->key, node->value->data);
             node = node->next;
         }
     }
+}
+/*---------------------------------------------------------------------------*/
+/* function to dump the contents of the hash table, including locks status */
+void hash_dump(hashtable_t *table)
+{
+    TRACE_PRINT();
+    size_t total_entries = 0;
+    hash_stats_t stats;
+    struct slab_stats mem;
+    int read_count, write_count;
+    size_t i;
+
+    printf("[Hash Table Dump]");
+    for (i = 0; i < table->num_locks; i++)
+    {
+        total_entries += table->stripes[i].entries;
+    }
+    table->total_entries = total_entries;
+    printf("Total Entries: %ld\n", table->total_entries);
+    hash_chain_stats(table, &stats);
+    printf("Buckets: %ld (%ld used), Chains: max %ld, mean %.2f\n",
+           stats.buckets, stats.used_buckets, stats.max_chain,
+           stats.mean_chain);
+    slab_stats(&mem);
+    printf("Memory: %ld bytes in use, %ld reserved\n",
+           mem.in_use, mem.reserved);
+    printf("Entries: %ld bytes, budget %ld (0: none), %ld evicted\n",
+           stats.bytes, table->mem_limit, stats.evictions);
+
+    if (table->oa)
+    {
+        for (i = 0; i < table->num_locks; i++)
+        {
+            if (!table->stripes[i].entries)
+            {
+                continue;
+            }
+            printf("Shard %zu: %ld entries\n", i, table->stripes[i].entries);
+            rwlock_counts(&table->stripes[i].lock, &read_count, &write_count);
+            printf("  Lock State -> Read Count: %d, Write Count: %d\n",
+                   read_count, write_count);
+            oa_dump_shard(table->oa, i);
+        }
+        printf("End of Dump\n");
+        return;
+    }
+
+    if (table->old)
+    {
+        /* buckets not migrated yet */
+        array_dump(table, table->old);
+    }
+    array_dump(table, table->cur);
     printf("End of Dump\n");
-}
\ No newline at end of file
+}
@@ -8,38 +8,292 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/types.h>
 #include "rwlock.h"
+#include "epoch.h"
+#include "ttl.h"
+#include "skiplist.h"
 #include "common.h"
 /*---------------------------------------------------------------------------*/
 #define DEFAULT_HASH_SIZE 1024
+#define DEFAULT_BUCKETS_PER_LOCK 1
+/* the table doubles when the entries per bucket exceed this */
+#define HASH_MAX_LOAD 2
+/* buckets migrated in the background by every write during a resize */
+#define HASH_MIGRATE_BATCH 4
+/* entries evicted to make room when an allocation fails under a budget */
+#define HASH_EVICT_BATCH 8
+/* chain lengths told apart by hash_chain_stats(), the last one and up */
+#define HASH_CHAIN_HIST 8
+/* hash_init() flags */
+#define HASH_LOCKFREE_READ 0x1 // searches take no lock, see epoch.h
+#define HASH_OPEN_ADDRESSING 0x2 // open-addressing engine, see oatable.h
+#define HASH_LOCK_FAIR 0x4 // phase-fair stripe locks, see rwlock.h
+#define HASH_LOCK_MUTEX 0x8 // mutex stripe locks, see rwlock.h
+#define HASH_ORDERED_INDEX 0x10 // keys kept in order too, see hash_scan()
+/*---------------------------------------------------------------------------*/
+/* changes reported to the log hook */
+#define HASH_OP_INSERT 1
+#define HASH_OP_UPDATE 2
+#define HASH_OP_DELETE 3
+#define HASH_OP_EXPIRE 4 // value holds the new expiry, right after the change
+/* errors of the conditional writes, apart from -1 */
+#define HASH_ERR_VERSION -2 // hash_cas(): the entry has another version
+#define HASH_ERR_NAN -3 // hash_incr(): the value is not a decimal integer
+#define HASH_ERR_RANGE -4 // hash_incr(): the result does not fit 64 bits
+/* hashes len bytes of key, seeded so that collisions cannot be precomputed */
+typedef uint64_t (*hash_fn_t)(const char *key, size_t len, uint64_t seed);
+/*---------------------------------------------------------------------------*/
+/* reference-counted value, shared by the table and in-flight responses */
+typedef struct value_t
+{
+    atomic_int refcnt;
+    unsigned char referenced; // read since the clock hand last passed
+    size_t len;            // without the null terminator
+    uint64_t expire_at;    // ms since the epoch, or 0 to never expire
+    uint64_t version;      // given by the table as it is stored
+    char *data;            // null-terminated, inline or in a mapped snapshot
+    struct epoch_entry retire; // links it while lock-free readers drain
+    char inline_data[];    // data of a value copied to the heap
+} value_t;
+/* value is NULL for HASH_OP_DELETE, and the entry's for HASH_OP_EXPIRE */
+typedef void (*hash_log_fn_t)(void *arg, int op, const char *key,
+                              const value_t *value);
+/* called for every entry by hash_foreach(), which stops when it returns -1 */
+typedef int (*hash_visit_fn_t)(void *arg, uint64_t hash, const char *key,
+                               const value_t *value);
 /*---------------------------------------------------------------------------*/
 typedef struct node_t
 {
     char *key;
-    size_t key_size;
-    char *value;
-    size_t value_size;
+    size_t key_size;       // 0 when the key lives in a mapped snapshot
+    uint64_t hash;         // compared before the key itself
+    value_t *value;        // holds one reference
     struct node_t *next;
+    struct epoch_entry retire; // links it while lock-free readers drain
 } node_t;
 /*---------------------------------------------------------------------------*/
-typedef struct hashtable_t
+typedef struct bucket_array_t
 {
+    size_t size;
     node_t **buckets;
-    rwlock_t *locks;
-    size_t *bucket_sizes; // number of entries in each bucket
+    size_t *bucket_sizes;     // number of entries in each bucket
+    unsigned char *migrated;  // set when moved to a bigger array
+    struct epoch_entry retire; // links it while lock-free readers drain
+} bucket_array_t;
+/*---------------------------------------------------------------------------*/
+/*
+ * a lock stripe and the counters it guards, on cache lines of their own,
+ * so that writers of neighbouring stripes do not share any.
+ */
+typedef struct hash_stripe_t
+{
+    rwlock_t lock;
+    size_t entries;           // number of entries under the stripe
+    size_t bytes;             // bytes of the entries under the stripe
+    size_t clock_hand;        // bucket eviction goes on at
+    uint64_t version;         // last one given to a value of the stripe
+} __attribute__((aligned(CACHE_LINE_SIZE))) hash_stripe_t;
+/*---------------------------------------------------------------------------*/
+/*
+ * the table grows online. when it runs out of room, a twice as large
+ * bucket array becomes current, and the buckets of the old one are moved
+ * over one at a time: on demand by any write that hashes to an unmoved
+ * bucket, and a few more by every write in the background. lookups check
+ * the old array until their bucket has been moved.
+ *
+ * lock stripes are independent of the bucket count. a key always maps to
+ * stripe hash % num_locks, and since every array size is a multiple of
+ * num_locks, an old bucket and both buckets it splits into share a
+ * stripe, which is all migrating a bucket needs to hold.
+ */
+typedef struct hashtable_t
+{
+    bucket_array_t *cur;      // array new entries go to
+    bucket_array_t *old;      // array being migrated from, or NULL
+    size_t migrate_next;      // next old bucket to migrate in the background
+    atomic_size_t migrated_count;
+    atomic_int resizing;
+    hash_stripe_t *stripes;
+    size_t num_locks;
     size_t total_entries;
-    size_t hash_size;
+    int lockfree_read;
+    struct oatable_t *oa;     // replaces the bucket arrays when set
+    hash_fn_t hash_fn;
+    uint64_t seed;            // random per table
+    hash_log_fn_t log_fn;     // called for every change, or NULL
+    void *log_arg;
+    struct ttl_wheel *ttl;    // expiry timers of the entries
+    atomic_int ttl_used;      // set once any entry is given an expiry
+    size_t mem_limit;         // budget of all the stripes, or 0 for none
+    atomic_size_t bytes;      // taken by the entries of all the stripes
+    atomic_size_t evict_hand; // stripe to evict from next, modulo num_locks
+    atomic_size_t evictions;
+    struct skiplist *index;   // the keys in order, or NULL
 } hashtable_t;
 /*---------------------------------------------------------------------------*/
+/* distribution of the entries over the buckets */
+typedef struct hash_stats_t
+{
+    size_t entries;
+    size_t buckets;           // buckets, or slots with open addressing
+    size_t used_buckets;      // buckets holding any entry
+    size_t max_chain;         // longest chain, or groups probed for an entry
+    double mean_chain;        // mean chain of the used buckets, or probe
+    size_t bytes;             // taken by the entries, see hash_set_limit()
+    size_t evictions;         // entries evicted to stay within the budget
+    /*
+     * buckets by the entries they hold, or with open addressing, entries
+     * by the groups probed to find them, HASH_CHAIN_HIST - 1 and more in
+     * the last one.
+     */
+    size_t chains[HASH_CHAIN_HIST];
+} hash_stats_t;
+/* contention of a lock stripe, see hash_lock_profile() */
+typedef struct hash_lock_prof_t
+{
+    size_t stripe;
+    size_t entries;           // under the stripe when read
+    struct rwlock_prof prof;
+} hash_lock_prof_t;
+/*---------------------------------------------------------------------------*/
+/**
+ * allocates a value of len bytes for the caller to fill in, e.g., as
+ * they are received. the caller owns the only reference.
+ * returns NULL when any internal errors occur.
+ */
+value_t *value_alloc(size_t len);
+/*---------------------------------------------------------------------------*/
+/**
+ * allocates a value holding a copy of len bytes of data.
+ * the caller owns the only reference.
+ * returns NULL when any internal errors occur.
+ */
+value_t *value_new(const char *data, size_t len);
+/*---------------------------------------------------------------------------*/
+/**
+ * allocates a value referring to len bytes at data, which must be
+ * null-terminated and stay valid as long as the value lives, e.g., an
+ * entry of a mapped snapshot. the caller owns the only reference.
+ * returns NULL when any internal errors occur.
+ */
+value_t *value_wrap(const char *data, size_t len);
+/*---------------------------------------------------------------------------*/
+/**
+ * returns the heap bytes the value takes: its header, and its data
+ * unless it lives in a mapped snapshot.
+ */
+size_t value_bytes(const value_t *value);
+/*---------------------------------------------------------------------------*/
+/**
+ * takes a reference to the value.
+ */
+value_t *value_get(value_t *value);
+/*---------------------------------------------------------------------------*/
+/**
+ * drops a reference to the value, and frees it with the last one.
+ */
+void value_put(value_t *value);
+/*---------------------------------------------------------------------------*/
+/**
+ * 64-bit hash in the style of wyhash: 8-byte reads folded with 128-bit
+ * multiplies. this is the default hash of a table.
+ */
+uint64_t hash_wyhash(const char *key, size_t len, uint64_t seed);
+/*---------------------------------------------------------------------------*/
+/**
+ * the former shift-add hash, which ignores the seed and clusters similar
+ * keys. kept to compare distributions, with chained buckets only: its 32
+ * bits leave OA_H1() at 0, so HASH_OPEN_ADDRESSING would start every probe
+ * at the first group.
+ */
+uint64_t hash_shift_add(const char *key, size_t len, uint64_t seed);
+/*---------------------------------------------------------------------------*/
+/**
+ * hashes key with the function and the seed of the table.
+ */
+uint64_t hash_key(hashtable_t *table, const char *key);
+/*---------------------------------------------------------------------------*/
+/**
+ * initializes a hash table with hash_size buckets, and a lock stripe for
+ * every buckets_per_lock of them, rounding hash_size up to a multiple.
+ * the stripes, and the bucket arrays but for small ones, are interleaved
+ * over the NUMA nodes when there are several.
+ * with HASH_LOCKFREE_READ, searches traverse the buckets with atomic loads
+ * only, and writers defer freeing unlinked nodes and values by epochs.
+ * writers still serialize on the bucket locks either way.
+ * with HASH_OPEN_ADDRESSING, entries are kept in an open-addressing table
+ * sharded by lock stripe instead of chained buckets. it cannot be combined
+ * with HASH_LOCKFREE_READ.
+ * the stripe locks are writer-preferring, or of the policy HASH_LOCK_FAIR
+ * or HASH_LOCK_MUTEX asks for.
+ * with HASH_ORDERED_INDEX, every key is also linked into a skip list, in
+ * the order of its bytes, for hash_scan(). every insert and delete then
+ * also takes the lock of one of the SKIP_SHARDS shards of the list, by a
+ * hash of the key, and hash_scan() takes the lock of every shard shared.
+ */
+hashtable_t *hash_init(size_t hash_size, size_t buckets_per_lock, int delay,
+                       int flags);
+/*---------------------------------------------------------------------------*/
+/**
+ * replaces the hash function of a table. the table should be empty.
+ * returns -1 when the table holds any entry.
+ * returns 0 on success.
+ */
+int hash_set_function(hashtable_t *table, hash_fn_t fn);
+/*---------------------------------------------------------------------------*/
 /**
- * calculates hash of key
+ * replaces the random seed of a table, e.g., with the one the hashes of
+ * a snapshot were made with. the table should be empty.
+ * returns -1 when the table holds any entry.
+ * returns 0 on success.
  */
-int hash(const char *key, size_t hash_size);
+int hash_set_seed(hashtable_t *table, uint64_t seed);
 /*---------------------------------------------------------------------------*/
 /**
- * initializes a hash table
+ * sizes the buckets of an empty table for count entries up front, so that
+ * loading them does not resize it over and over.
+ * returns -1 when the table holds any entry, or any errors occur.
+ * returns 0 on success.
  */
-hashtable_t *hash_init(size_t hash_size, int delay);
+int hash_reserve(hashtable_t *table, size_t count);
+/*---------------------------------------------------------------------------*/
+/**
+ * bounds the bytes the entries take, counting each key, value and the
+ * node or slot holding them, to bytes, or lifts the bound with 0.
+ * the bytes of all the stripes are counted together, and a write that
+ * takes the table past the budget evicts cold entries until it fits
+ * again, once it has let go of its stripe lock. the stripes give them up
+ * in turn, and within a stripe a clock hand finds them: an entry read
+ * since the hand last passed it is spared once, and any other one goes,
+ * so that a burst of writes does not push out the entries being read.
+ * the budget is exceeded only by the writes still in progress, and by
+ * an entry that is too large for it alone, as an entry never evicts
+ * itself. an allocation failing on insert evicts a few entries of the
+ * stripe and retries. evictions reach the log hook as deletes.
+ */
+void hash_set_limit(hashtable_t *table, size_t bytes);
+/*---------------------------------------------------------------------------*/
+/**
+ * flags the lock stripe of key as hot, or clears the flag with on 0.
+ * a hot stripe takes a big-reader lock, whose readers do not share a
+ * cache line, for a key most threads read at once. its writers are the
+ * slower for it, as they wait on every reader slot.
+ * the key need not be in the table.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success.
+ */
+int hash_set_hot(hashtable_t *table, const char *key, int on);
+/*---------------------------------------------------------------------------*/
+/**
+ * sets a hook called after every successful insert, update and delete,
+ * including those of the multi-key operations. it runs under the stripe
+ * write lock, so the changes to a key reach it in the order they are
+ * applied. NULL turns it off.
+ */
+void hash_set_log(hashtable_t *table, hash_log_fn_t fn, void *arg);
 /*---------------------------------------------------------------------------*/
 /**
  * destroys a hash table
@@ -54,14 +308,41 @@ int hash_destroy(hashtable_t *table);
  */
 int hash_insert(hashtable_t *table, const char *key, const char *value);
 /*---------------------------------------------------------------------------*/
+/**
+ * hash_insert() with a value of len bytes, which may hold any byte.
+ */
+int hash_insert_len(hashtable_t *table, const char *key,
+                    const char *value, size_t len);
+/*---------------------------------------------------------------------------*/
+/**
+ * hash_insert() with a value the caller has built, whose reference the
+ * table takes over on success.
+ */
+int hash_insert_value(hashtable_t *table, const char *key, value_t *value);
+/*---------------------------------------------------------------------------*/
+/**
+ * inserts an entry of a mapped snapshot, with h the hash_key() of key.
+ * the chained engine keeps pointing at key rather than copying it, so key
+ * must stay valid as long as the table. on success, the table takes over
+ * the caller's reference to value.
+ * it takes no stripe lock, and is only for loading a table that no other
+ * thread uses yet.
+ * returns as hash_insert() would.
+ */
+int hash_insert_mapped(hashtable_t *table, uint64_t h, const char *key,
+                       value_t *value);
+/*---------------------------------------------------------------------------*/
 /**
  * searches a key-value pair in the hash table,
  * and modify the given value pointer to point found value.
+ * the found value is not copied; the caller gets a reference to it and
+ * should release it with value_put(). a later update or delete of the key
+ * does not free the value until then.
  * returns -1 when any internal errors occur.
  * returns 1 when successfully found.
  * returns 0 when there is no such key found.
  */
-int hash_search(hashtable_t *table, const char *key, const char **value);
+int hash_search(hashtable_t *table, const char *key, value_t **value);
 /*---------------------------------------------------------------------------*/
 /**
  * updates a key-value pair in the hash table.
@@ -71,6 +352,18 @@ int hash_search(hashtable_t *table, const char *key, const char **value);
  */
 int hash_update(hashtable_t *table, const char *key, const char *value);
 /*---------------------------------------------------------------------------*/
+/**
+ * hash_update() with a value of len bytes, which may hold any byte.
+ */
+int hash_update_len(hashtable_t *table, const char *key,
+                    const char *value, size_t len);
+/*---------------------------------------------------------------------------*/
+/**
+ * hash_update() with a value the caller has built, whose reference the
+ * table takes over on success.
+ */
+int hash_update_value(hashtable_t *table, const char *key, value_t *value);
+/*---------------------------------------------------------------------------*/
 /**
  * deletes a key-value pair from the hash table.
  * returns -1 when any internal errors occur.
@@ -79,6 +372,150 @@ int hash_update(hashtable_t *table, const char *key, const char *value);
  */
 int hash_delete(hashtable_t *table, const char *key);
 /*---------------------------------------------------------------------------*/
+/*
+ * every value an insert or update stores gets the next version of its
+ * lock stripe, so the versions of a key only ever grow, even across a
+ * delete and a new insert, and a value read never has the version of
+ * another one stored under the key. the log and snapshots do not keep
+ * versions, but a new table starts its stripes at the time in ns, so
+ * that a version from before a restart does not match a value after it.
+ */
+/**
+ * updates key as hash_update_value() does, but only if the version of
+ * its value is version, checking both under the stripe write lock.
+ * returns -1 when any internal errors occur.
+ * returns HASH_ERR_VERSION when the value has another version.
+ * returns 1 when successfully updated.
+ * returns 0 when there is no such key found.
+ */
+int hash_cas(hashtable_t *table, const char *key, uint64_t version,
+             value_t *value);
+/*---------------------------------------------------------------------------*/
+/**
+ * adds delta to the value of key, a decimal integer that fits 64 bits,
+ * and stores the sum in its place as a new version, keeping the expiry.
+ * the sum is also set to *result.
+ * returns -1 when any internal errors occur.
+ * returns HASH_ERR_NAN when the value is not such an integer.
+ * returns HASH_ERR_RANGE when the sum does not fit 64 bits.
+ * returns 1 when successfully updated.
+ * returns 0 when there is no such key found.
+ */
+int hash_incr(hashtable_t *table, const char *key, int64_t delta,
+              int64_t *result);
+/*---------------------------------------------------------------------------*/
+/*
+ * entries expire at the expire_at of their value. an insert or update
+ * with a value whose expire_at is set puts a timer on the table's wheel,
+ * and an update with one that is not keeps the expiry the entry had.
+ * an expired entry is gone for every operation at once: searches do not
+ * find it, and writes reclaim it under the stripe lock before going on.
+ * the ones nobody touches are reclaimed by hash_expire() as their timers
+ * fire, so that no operation ever scans the buckets for them. every
+ * reclaimed entry reaches the log hook as a delete.
+ */
+/**
+ * sets the expiry of key to expire_at, in ms since the epoch, or makes
+ * it never expire with 0.
+ * returns -1 when any internal errors occur.
+ * returns 1 when successfully set.
+ * returns 0 when there is no such key found.
+ */
+int hash_set_expiry(hashtable_t *table, const char *key, uint64_t expire_at);
+/*---------------------------------------------------------------------------*/
+/**
+ * reclaims the entries whose timers have fired, a batch at a time, for
+ * the threads of the server to call now and then.
+ * returns the number of timers that fired.
+ */
+int hash_expire(hashtable_t *table);
+/*---------------------------------------------------------------------------*/
+/**
+ * inserts n key-value pairs, taking each bucket lock once.
+ * results[i] is set as hash_insert() would return for keys[i].
+ * returns -1 when n exceeds MAX_MULTI_KEYS.
+ * returns 0 on success.
+ */
+int hash_minsert(hashtable_t *table, int n, const char **keys,
+                 const char **values, int *results);
+/*---------------------------------------------------------------------------*/
+/**
+ * searches n keys, taking each bucket lock once.
+ * results[i] and values[i] are set as hash_search() would for keys[i].
+ * returns -1 when n exceeds MAX_MULTI_KEYS.
+ * returns 0 on success.
+ */
+int hash_msearch(hashtable_t *table, int n, const char **keys,
+                 value_t **values, int *results);
+/*---------------------------------------------------------------------------*/
+/**
+ * deletes n keys, taking each bucket lock once.
+ * results[i] is set as hash_delete() would return for keys[i].
+ * returns -1 when n exceeds MAX_MULTI_KEYS.
+ * returns 0 on success.
+ */
+int hash_mdelete(hashtable_t *table, int n, const char **keys, int *results);
+/*---------------------------------------------------------------------------*/
+/**
+ * finds at most n keys in order, from from on, below to unless it is
+ * NULL, and starting with prefix unless it is NULL, with the ordered
+ * index, and searches them as hash_msearch() would. a key deleted
+ * between the two is left out, so fewer may be found than are in range.
+ * keys holds the keys found, and values[i] a reference to the value of
+ * keys[i], for the caller to release with value_put().
+ * *next is set to the key the scan would go on at, or to the empty
+ * string when there is none in range.
+ * returns -1 when the table has no ordered index, or n exceeds
+ * MAX_MULTI_KEYS.
+ * returns the number of keys found on success.
+ */
+int hash_scan(hashtable_t *table, const char *from, const char *to,
+              const char *prefix, int n, char (*keys)[MAX_KEY_LEN + 1],
+              value_t **values, char *next);
+/*---------------------------------------------------------------------------*/
+/**
+ * takes every stripe write lock, so that no change is in flight and none
+ * starts until hash_thaw(). lock-free reads go on. the log hook sees no
+ * change in between either, so the table matches the log at that point.
+ */
+void hash_freeze(hashtable_t *table);
+/*---------------------------------------------------------------------------*/
+/**
+ * releases the locks taken by hash_freeze().
+ */
+void hash_thaw(hashtable_t *table);
+/*---------------------------------------------------------------------------*/
+/**
+ * counts the entries, taking no lock. it is exact while the table is
+ * frozen.
+ */
+size_t hash_count(hashtable_t *table);
+/*---------------------------------------------------------------------------*/
+/**
+ * calls fn for every entry, taking no lock at all. it is only safe while
+ * nothing else changes the table, e.g., in a child process forked while
+ * the table was frozen.
+ * returns -1 as soon as fn does.
+ * returns 0 on success.
+ */
+int hash_foreach(hashtable_t *table, hash_visit_fn_t fn, void *arg);
+/*---------------------------------------------------------------------------*/
+/**
+ * collects how evenly the entries are spread, and the bytes and
+ * evictions of the entries, taking each stripe's read lock in turn.
+ */
+void hash_chain_stats(hashtable_t *table, hash_stats_t *stats);
+/*---------------------------------------------------------------------------*/
+/**
+ * finds the n lock stripes whose threads waited the longest for them,
+ * read and write waits together, and fills top with their profiles,
+ * longest first. it takes no lock. a stripe nobody waited for is left
+ * out, so fewer may be found.
+ * returns -1 when the locks are built without RWLOCK_PROFILE.
+ * returns the number of stripes found on success.
+ */
+int hash_lock_profile(hashtable_t *table, hash_lock_prof_t *top, size_t n);
+/*---------------------------------------------------------------------------*/
 /**
  * dump the hash table
  */
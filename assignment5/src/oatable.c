@@ -0,0 +1,475 @@
+/*---------------------------------------------------------------------------*/
+/* oatable.c                                                                 */
+/* Author: Yeonjae Kim                                                       */
+/*---------------------------------------------------------------------------*/
+#include "oatable.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+/*---------------------------------------------------------------------------*/
+/* returns a bit mask of the slots in a group whose control byte is b */
+static inline unsigned int
+oa_match(const unsigned char *ctrl, unsigned char b)
+{
+#ifdef __SSE2__
+    __m128i group = _mm_load_si128((const __m128i *)ctrl);
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)b)));
+#else
+    unsigned int mask = 0;
+    int i;
+
+    for (i = 0; i < OA_GROUP_SIZE; i++)
+    {
+        if (ctrl[i] == b)
+        {
+            mask |= 1u << i;
+        }
+    }
+
+    return mask;
+#endif
+}
+/*---------------------------------------------------------------------------*/
+/* returns a bit mask of the empty or deleted slots in a group */
+static inline unsigned int oa_match_free(const unsigned char *ctrl)
+{
+#ifdef __SSE2__
+    /* only empty and deleted have the high bit set */
+    return _mm_movemask_epi8(_mm_load_si128((const __m128i *)ctrl));
+#else
+    unsigned int mask = 0;
+    int i;
+
+    for (i = 0; i < OA_GROUP_SIZE; i++)
+    {
+        if (ctrl[i] & 0x80)
+        {
+            mask |= 1u << i;
+        }
+    }
+
+    return mask;
+#endif
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * allocates the slots of a shard with the given capacity.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success.
+ */
+static int oa_shard_alloc(oa_shard_t *shard, size_t capacity)
+{
+    void *ctrl, *slots;
+
+    if (posix_memalign(&ctrl, CACHE_LINE_SIZE, capacity) != 0)
+    {
+        return -1;
+    }
+    if (posix_memalign(&slots, CACHE_LINE_SIZE,
+                       capacity * sizeof(oa_slot_t)) != 0)
+    {
+        free(ctrl);
+        return -1;
+    }
+    memset(ctrl, OA_EMPTY, capacity);
+
+    shard->ctrl = ctrl;
+    shard->slots = slots;
+    shard->capacity = capacity;
+    shard->count = 0;
+    shard->used = 0;
+    shard->hand = 0;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * finds the slot of a key in a shard.
+ * groups are probed in triangular order, which visits every group since
+ * their count is a power of two, until a group with an empty slot.
+ * returns NULL when there is no such key.
+ */
+static oa_slot_t *
+oa_find(oa_shard_t *shard, uint64_t hash, const char *key, size_t key_len)
+{
+    size_t mask = shard->capacity / OA_GROUP_SIZE - 1;
+    size_t group = OA_H1(hash) & mask, step;
+    unsigned char *ctrl;
+    unsigned int bits;
+    oa_slot_t *slot;
+
+    for (step = 0; step <= mask; step++)
+    {
+        ctrl = shard->ctrl + group * OA_GROUP_SIZE;
+        bits = oa_match(ctrl, OA_H2(hash));
+        while (bits)
+        {
+            slot = &shard->slots[group * OA_GROUP_SIZE +
+                                 __builtin_ctz(bits)];
+            if (slot->hash == hash && slot->key_len == key_len &&
+                memcmp(slot->key, key, key_len) == 0)
+            {
+                return slot;
+            }
+            bits &= bits - 1;
+        }
+        if (oa_match(ctrl, OA_EMPTY))
+        {
+            return NULL;
+        }
+        group = (group + step + 1) & mask;
+    }
+
+    return NULL;
+}
+/*---------------------------------------------------------------------------*/
+/* returns the index of the first empty or deleted slot for hash */
+static size_t oa_find_free(oa_shard_t *shard, uint64_t hash)
+{
+    size_t mask = shard->capacity / OA_GROUP_SIZE - 1;
+    size_t group = OA_H1(hash) & mask, step;
+    unsigned int bits;
+
+    /* the load limit leaves a free slot somewhere */
+    for (step = 0;; step++)
+    {
+        bits = oa_match_free(shard->ctrl + group * OA_GROUP_SIZE);
+        if (bits)
+        {
+            return group * OA_GROUP_SIZE + __builtin_ctz(bits);
+        }
+        group = (group + step + 1) & mask;
+    }
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * rehashes a shard, doubling it unless dropping the deleted slots makes
+ * enough room.
+ * the clock hand starts over, so the entries it has cleared on this round
+ * are marked referenced again; moved ahead of it, they would otherwise
+ * lose their second chance.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success.
+ */
+static int oa_rehash(oa_shard_t *shard)
+{
+    oa_shard_t old = *shard;
+    size_t capacity = old.capacity, i, j;
+
+    if (old.count >= capacity / 2)
+    {
+        capacity *= 2;
+    }
+    if (oa_shard_alloc(shard, capacity) < 0)
+    {
+        *shard = old;
+        return -1;
+    }
+
+    for (i = 0; i < old.capacity; i++)
+    {
+        if (old.ctrl[i] & 0x80)
+        {
+            continue;
+        }
+        if (i < old.hand)
+        {
+            __atomic_store_n(&old.slots[i].value->referenced, 1,
+                             __ATOMIC_RELAXED);
+        }
+        j = oa_find_free(shard, old.slots[i].hash);
+        shard->ctrl[j] = old.ctrl[i];
+        shard->slots[j] = old.slots[i];
+    }
+    shard->count = shard->used = old.count;
+
+    free(old.ctrl);
+    free(old.slots);
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+oatable_t *oa_init(size_t num_shards)
+{
+    TRACE_PRINT();
+    oatable_t *oa = malloc(sizeof(oatable_t));
+    size_t i, j;
+
+    if (oa == NULL)
+    {
+        DEBUG_PRINT("Failed to allocate memory for open-addressing table");
+        return NULL;
+    }
+    if (posix_memalign((void **)&oa->shards, CACHE_LINE_SIZE,
+                       num_shards * sizeof(oa_shard_t)) != 0)
+    {
+        DEBUG_PRINT("Failed to allocate memory for shards");
+        free(oa);
+        return NULL;
+    }
+    oa->num_shards = num_shards;
+
+    for (i = 0; i < num_shards; i++)
+    {
+        if (oa_shard_alloc(&oa->shards[i], OA_GROUP_SIZE) < 0)
+        {
+            DEBUG_PRINT("Failed to allocate memory for shard slots");
+            for (j = 0; j < i; j++)
+            {
+                free(oa->shards[j].ctrl);
+                free(oa->shards[j].slots);
+            }
+            free(oa->shards);
+            free(oa);
+            return NULL;
+        }
+    }
+
+    return oa;
+}
+/*---------------------------------------------------------------------------*/
+void oa_destroy(oatable_t *oa)
+{
+    TRACE_PRINT();
+    oa_shard_t *shard;
+    size_t i, j;
+
+    for (i = 0; i < oa->num_shards; i++)
+    {
+        shard = &oa->shards[i];
+        for (j = 0; j < shard->capacity; j++)
+        {
+            if (!(shard->ctrl[j] & 0x80))
+            {
+                value_put(shard->slots[j].value);
+            }
+        }
+        free(shard->ctrl);
+        free(shard->slots);
+    }
+    free(oa->shards);
+    free(oa);
+}
+/*---------------------------------------------------------------------------*/
+int oa_insert(oatable_t *oa, uint64_t hash,
+              const char *key, value_t *value, ssize_t *delta)
+{
+    TRACE_PRINT();
+    oa_shard_t *shard = &oa->shards[hash % oa->num_shards];
+    size_t key_len = strlen(key), i;
+    oa_slot_t *slot;
+
+    if (oa_find(shard, hash, key, key_len))
+    {
+        return 0;
+    }
+    if (shard->used + 1 > OA_MAX_USED(shard->capacity) &&
+        oa_rehash(shard) < 0)
+    {
+        DEBUG_PRINT("Failed to grow shard");
+        return -1;
+    }
+
+    i = oa_find_free(shard, hash);
+    slot = &shard->slots[i];
+    slot->value = value;
+    memcpy(slot->key, key, key_len + 1);
+    slot->key_len = key_len;
+    slot->hash = hash;
+
+    if (shard->ctrl[i] == OA_EMPTY)
+    {
+        shard->used++;
+    }
+    shard->ctrl[i] = OA_H2(hash);
+    shard->count++;
+    *delta = sizeof(oa_slot_t) + value_bytes(value);
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+int oa_search(oatable_t *oa, uint64_t hash,
+              const char *key, value_t **value)
+{
+    TRACE_PRINT();
+    oa_shard_t *shard = &oa->shards[hash % oa->num_shards];
+    oa_slot_t *slot;
+
+    slot = oa_find(shard, hash, key, strlen(key));
+    if (slot == NULL)
+    {
+        return 0;
+    }
+    *value = value_get(slot->value);
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+int oa_update(oatable_t *oa, uint64_t hash,
+              const char *key, value_t *value, ssize_t *delta)
+{
+    TRACE_PRINT();
+    oa_shard_t *shard = &oa->shards[hash % oa->num_shards];
+    oa_slot_t *slot;
+
+    slot = oa_find(shard, hash, key, strlen(key));
+    if (slot == NULL)
+    {
+        return 0;
+    }
+
+    if (value->expire_at == 0)
+    {
+        /* keeps the expiry the entry had */
+        value->expire_at = slot->value->expire_at;
+    }
+    *delta = (ssize_t)value_bytes(value) - (ssize_t)value_bytes(slot->value);
+    value_put(slot->value);
+    slot->value = value;
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+int oa_delete(oatable_t *oa, uint64_t hash, const char *key,
+              ssize_t *delta)
+{
+    TRACE_PRINT();
+    oa_shard_t *shard = &oa->shards[hash % oa->num_shards];
+    oa_slot_t *slot;
+    size_t i, group;
+
+    slot = oa_find(shard, hash, key, strlen(key));
+    if (slot == NULL)
+    {
+        return 0;
+    }
+    *delta = -(ssize_t)(sizeof(oa_slot_t) + value_bytes(slot->value));
+    value_put(slot->value);
+
+    /*
+     * a probe only goes past a group without empty slots, so in a group
+     * that has one, the slot can be emptied instead of marked deleted.
+     */
+    i = slot - shard->slots;
+    group = i / OA_GROUP_SIZE * OA_GROUP_SIZE;
+    if (oa_match(shard->ctrl + group, OA_EMPTY))
+    {
+        shard->ctrl[i] = OA_EMPTY;
+        shard->used--;
+    }
+    else
+    {
+        shard->ctrl[i] = OA_DELETED;
+    }
+    shard->count--;
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+int oa_evict(oatable_t *oa, size_t shard, const char *keep,
+             uint64_t *hash, char *key)
+{
+    oa_shard_t *s = &oa->shards[shard];
+    oa_slot_t *slot;
+    size_t n, i;
+
+    /* a single round, so that a cleared entry is spared until the next */
+    for (n = 0; n < s->capacity; n++)
+    {
+        i = s->hand;
+        s->hand = (i + 1) % s->capacity;
+        if (s->ctrl[i] & 0x80)
+        {
+            continue;
+        }
+        slot = &s->slots[i];
+        if (__atomic_load_n(&slot->value->referenced, __ATOMIC_RELAXED))
+        {
+            __atomic_store_n(&slot->value->referenced, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (keep && strcmp(slot->key, keep) == 0)
+        {
+            continue;
+        }
+        *hash = slot->hash;
+        memcpy(key, slot->key, slot->key_len + 1);
+        return 1;
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+void oa_chain_stats(oatable_t *oa, size_t shard, hash_stats_t *stats,
+                    size_t *probes)
+{
+    oa_shard_t *s = &oa->shards[shard];
+    size_t mask = s->capacity / OA_GROUP_SIZE - 1;
+    size_t i, group, step;
+
+    stats->buckets += s->capacity;
+    stats->used_buckets += s->count;
+    for (i = 0; i < s->capacity; i++)
+    {
+        if (s->ctrl[i] & 0x80)
+        {
+            continue;
+        }
+        /* replay the probe up to the entry's group */
+        group = OA_H1(s->slots[i].hash) & mask;
+        for (step = 0; group != i / OA_GROUP_SIZE; step++)
+        {
+            group = (group + step + 1) & mask;
+        }
+        *probes += step + 1;
+        stats->chains[step + 1 < HASH_CHAIN_HIST ?
+                      step + 1 : HASH_CHAIN_HIST - 1]++;
+        if (step + 1 > stats->max_chain)
+        {
+            stats->max_chain = step + 1;
+        }
+    }
+}
+/*---------------------------------------------------------------------------*/
+int oa_foreach(oatable_t *oa, hash_visit_fn_t fn, void *arg)
+{
+    oa_shard_t *s;
+    size_t i, j;
+
+    for (i = 0; i < oa->num_shards; i++)
+    {
+        s = &oa->shards[i];
+        for (j = 0; j < s->capacity; j++)
+        {
+            if (s->ctrl[j] & 0x80)
+            {
+                /* empty or deleted */
+                continue;
+            }
+            if (fn(arg, s->slots[j].hash, s->slots[j].key,
+                   s->slots[j].value) < 0)
+            {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+void oa_dump_shard(oatable_t *oa, size_t shard)
+{
+    oa_shard_t *s = &oa->shards[shard];
+    size_t i;
+
+    for (i = 0; i < s->capacity; i++)
+    {
+        if (s->ctrl[i] & 0x80)
+        {
+            continue;
+        }
+        printf("    Key:   %s\n"
+               "    Value: %s\n", s->slots[i].key, s->slots[i].value->data);
+    }
+}
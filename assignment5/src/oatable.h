@@ -0,0 +1,127 @@
+/*---------------------------------------------------------------------------*/
+/* oatable.h                                                                 */
+/* Author: Yeonjae Kim                                                       */
+/*---------------------------------------------------------------------------*/
+#ifndef _OATABLE_H
+#define _OATABLE_H
+/*---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hashtable.h"
+#include "common.h"
+/*---------------------------------------------------------------------------*/
+/*
+ * open-addressing table engine, selected with HASH_OPEN_ADDRESSING.
+ *
+ * the table is split into shards, one per lock stripe of the hash table,
+ * and the caller holds the stripe lock of a shard while calling into it.
+ * each shard keeps a control byte per slot, either empty, deleted, or 7
+ * bits of the key's hash. slots are probed a group at a time:
+ * the group's control bytes are compared against the hash bits at once,
+ * and only the matching slots are looked at. keys are stored inline in
+ * the slots, which take a cache line each; values stay out of line since
+ * they are handed out by reference.
+ *
+ * the shard is picked from the low end of the hash, and the group and
+ * the control byte from its upper half, so the engine expects a hash
+ * that mixes all 64 bits.
+ *
+ * a shard grows by rehashing into a larger one under its write lock.
+ * lock-free reads are not supported.
+ */
+/*---------------------------------------------------------------------------*/
+#define OA_GROUP_SIZE 16 // slots probed at once, one SSE2 register
+#define OA_EMPTY 0x80
+#define OA_DELETED 0xfe
+/* bits of the hash giving the control byte, and the first group probed */
+#define OA_H2(hash) (((hash) >> 25) & 0x7f)
+#define OA_H1(hash) ((hash) >> 32)
+/* a shard is rehashed when full and deleted slots exceed 7/8 of it */
+#define OA_MAX_USED(capacity) ((capacity) - (capacity) / 8)
+/*---------------------------------------------------------------------------*/
+typedef struct oa_slot_t
+{
+    char key[MAX_KEY_LEN + 1];
+    unsigned char key_len;
+    uint64_t hash;         // so that rehashing needs no key
+    value_t *value;        // holds one reference
+} __attribute__((aligned(CACHE_LINE_SIZE))) oa_slot_t;
+/*---------------------------------------------------------------------------*/
+typedef struct oa_shard_t
+{
+    unsigned char *ctrl;   // control byte of each slot
+    oa_slot_t *slots;
+    size_t capacity;       // power of two, at least OA_GROUP_SIZE
+    size_t count;          // live entries
+    size_t used;           // live entries and deleted slots
+    size_t hand;           // next slot oa_evict() looks at
+} __attribute__((aligned(CACHE_LINE_SIZE))) oa_shard_t;
+/*---------------------------------------------------------------------------*/
+typedef struct oatable_t
+{
+    oa_shard_t *shards;
+    size_t num_shards;
+} oatable_t;
+/*---------------------------------------------------------------------------*/
+/**
+ * initializes an open-addressing table with num_shards shards.
+ * returns NULL when any internal errors occur.
+ */
+oatable_t *oa_init(size_t num_shards);
+/*---------------------------------------------------------------------------*/
+/**
+ * destroys an open-addressing table.
+ */
+void oa_destroy(oatable_t *oa);
+/*---------------------------------------------------------------------------*/
+/**
+ * the operations below take the key's hash, and work on shard
+ * hash % num_shards, whose lock the caller holds. they return as the
+ * hash_*() function of the same name would.
+ * oa_insert() and oa_update() take over the caller's reference to value
+ * on success. on success, the writes set *delta to the bytes the
+ * entries of the shard gained, negative for a delete.
+ */
+int oa_insert(oatable_t *oa, uint64_t hash,
+              const char *key, value_t *value, ssize_t *delta);
+int oa_search(oatable_t *oa, uint64_t hash,
+              const char *key, value_t **value);
+int oa_update(oatable_t *oa, uint64_t hash,
+              const char *key, value_t *value, ssize_t *delta);
+int oa_delete(oatable_t *oa, uint64_t hash, const char *key,
+              ssize_t *delta);
+/*---------------------------------------------------------------------------*/
+/**
+ * picks an entry of a shard to evict, moving the shard's clock hand over
+ * the slots: an entry referenced since the hand last passed is cleared
+ * and spared, and the first one that is not is picked, unless its key is
+ * keep. sets *hash and key, which has room for MAX_KEY_LEN.
+ * returns 1 when an entry was picked.
+ * returns 0 when a whole round of the hand found none to evict, which the
+ * next round may, once the entries it cleared are not referenced again.
+ */
+int oa_evict(oatable_t *oa, size_t shard, const char *keep,
+             uint64_t *hash, char *key);
+/*---------------------------------------------------------------------------*/
+/**
+ * adds the slots, entries and probe lengths of a shard to stats, their
+ * histogram included, and the sum of the groups probed to find each
+ * entry to probes.
+ */
+void oa_chain_stats(oatable_t *oa, size_t shard, hash_stats_t *stats,
+                    size_t *probes);
+/*---------------------------------------------------------------------------*/
+/**
+ * calls fn for every entry of every shard, holding no lock.
+ * returns -1 as soon as fn does.
+ * returns 0 on success.
+ */
+int oa_foreach(oatable_t *oa, hash_visit_fn_t fn, void *arg);
+/*---------------------------------------------------------------------------*/
+/**
+ * prints the entries of a shard.
+ */
+void oa_dump_shard(oatable_t *oa, size_t shard);
+/*---------------------------------------------------------------------------*/
+#endif // _OATABLE_H
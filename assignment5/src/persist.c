@@ -0,0 +1,122 @@
+/*---------------------------------------------------------------------------*/
+/* persist.c                                                                 */
+/* Author: Yeonjae Kim                                                       */
+/*---------------------------------------------------------------------------*/
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include "persist.h"
+/*---------------------------------------------------------------------------*/
+static uint32_t g_crc_table[256];
+/*---------------------------------------------------------------------------*/
+/* built at load time, so that no caller ever races on it */
+__attribute__((constructor)) static void crc_init(void)
+{
+    uint32_t c;
+    int i, k;
+
+    for (i = 0; i < 256; i++)
+    {
+        c = i;
+        for (k = 0; k < 8; k++)
+        {
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        }
+        g_crc_table[i] = c;
+    }
+}
+/*---------------------------------------------------------------------------*/
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    crc = ~crc;
+    while (len--)
+    {
+        crc = g_crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+/*---------------------------------------------------------------------------*/
+int write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = write(fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+int pwrite_all(int fd, const void *buf, size_t len, off_t off)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = pwrite(fd, p, len, off);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        off += n;
+        len -= n;
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+int sync_dir(const char *path)
+{
+    char dir[PATH_MAX];
+    const char *slash;
+    size_t len;
+    int fd, ret;
+
+    slash = strrchr(path, '/');
+    if (slash == NULL)
+    {
+        strcpy(dir, ".");
+    }
+    else
+    {
+        len = slash == path ? 1 : (size_t)(slash - path);
+        if (len >= sizeof(dir))
+        {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memcpy(dir, path, len);
+        dir[len] = '\0';
+    }
+
+    fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    ret = fsync(fd);
+    close(fd);
+
+    return ret;
+}
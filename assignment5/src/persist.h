@@ -0,0 +1,48 @@
+/*---------------------------------------------------------------------------*/
+/* persist.h                                                                 */
+/* Author: Yeonjae Kim                                                       */
+/*---------------------------------------------------------------------------*/
+#ifndef _PERSIST_H
+#define _PERSIST_H
+/*---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "common.h"
+/*---------------------------------------------------------------------------*/
+/*
+ * helpers shared by the write-ahead log and the snapshots. none of them
+ * allocates or takes a lock, so a child forked from a multithreaded
+ * server may use them.
+ */
+/*---------------------------------------------------------------------------*/
+/**
+ * continues a CRC-32 (IEEE) over len more bytes, starting from 0.
+ */
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len);
+/*---------------------------------------------------------------------------*/
+/**
+ * writes the whole buffer, retrying short writes.
+ * returns -1 when any errors occur.
+ * returns 0 on success.
+ */
+int write_all(int fd, const void *buf, size_t len);
+/*---------------------------------------------------------------------------*/
+/**
+ * writes the whole buffer at offset off, retrying short writes.
+ * returns -1 when any errors occur.
+ * returns 0 on success.
+ */
+int pwrite_all(int fd, const void *buf, size_t len, off_t off);
+/*---------------------------------------------------------------------------*/
+/**
+ * syncs the directory holding path, so that a file created or renamed
+ * there survives a crash.
+ * returns -1 when any errors occur.
+ * returns 0 on success.
+ */
+int sync_dir(const char *path);
+/*---------------------------------------------------------------------------*/
+#endif // _PERSIST_H
@@ -0,0 +1,252 @@
+#!/bin/bash
+
+# Default port number
+PORT=8080
+
+# Parse arguments for port number (optional)
+while getopts "p:" opt; do
+    case $opt in
+        p) PORT=$OPTARG ;;
+        *) echo "Usage: $0 [-p port] [1|2|3]"; exit 1 ;;
+    esac
+done
+
+# Shift so that $1 now points to the test set selection (if provided)
+shift $((OPTIND-1))
+
+if [ -z "$1" ]; then
+    echo "Usage: $0 [-p port] [1|2|3]"
+    exit 1
+fi
+
+TEST_SET=$1
+
+# The server is started by the script itself, with its files in here
+OUTPUT_DIR="./output"
+if [[ -d $OUTPUT_DIR ]]; then
+    rm -rf $OUTPUT_DIR
+fi
+mkdir -p $OUTPUT_DIR
+
+SNAPSHOT="$OUTPUT_DIR/skvs.snap"
+WAL="$OUTPUT_DIR/skvs.wal"
+SERVER_PID=
+
+fail() {
+    echo -e "\033[31mTest Failed: $1\033[0m"
+    [ -n "$SERVER_PID" ] && kill -9 $SERVER_PID 2>/dev/null
+    exit 1
+}
+
+# Start the server with the given options and wait for it to listen
+start_server() {
+    ./server -p $PORT "$@" > "$OUTPUT_DIR/server.log" 2>&1 &
+    SERVER_PID=$!
+    for _ in $(seq 50); do
+        if (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null; then
+            return 0
+        fi
+        kill -0 $SERVER_PID 2>/dev/null || break
+        sleep 0.1
+    done
+    fail "the server did not start with '$*'"
+}
+
+# Stop the server cleanly, or with the given signal
+stop_server() {
+    kill -${1:-INT} $SERVER_PID 2>/dev/null
+    wait $SERVER_PID 2>/dev/null
+    SERVER_PID=
+}
+
+# Expect the server to refuse the options, and to say why
+refuse_server() {
+    local reason=$1
+    shift
+    timeout 5 ./server -p $PORT "$@" > "$OUTPUT_DIR/server.log" 2>&1
+    local status=$?
+    if [[ $status -eq 0 || $status -eq 124 || $status -gt 128 ]]; then
+        fail "the server did not refuse '$*' cleanly (exit status $status)"
+    fi
+    grep -q "$reason" "$OUTPUT_DIR/server.log" ||
+        fail "'$reason' missing from the server output"
+    echo "Server refused '$*': '$reason' verified successfully."
+}
+
+# Send the requests, one per argument, on a single connection
+send_requests() {
+    printf '%s\n' "$@" | ./client -p $PORT
+}
+
+# Send a request and check its response
+check_request() {
+    local response
+    response=$(send_requests "$1")
+    if [[ "$response" != *"$2"* ]]; then
+        fail "expected '$2' for '$1', got '$response'"
+    fi
+    echo "Request '$1': '$2' verified successfully."
+}
+
+# Take a snapshot and wait for the child to finish writing it
+take_snapshot() {
+    check_request "SNAPSHOT" "SNAPSHOT STARTED"
+    for _ in $(seq 50); do
+        if [[ -f $SNAPSHOT && ! -f $SNAPSHOT.tmp ]]; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    fail "the snapshot was not written"
+}
+
+# Rewrite fields of the first index entry of a snapshot, keeping its crc
+# valid so that the entry itself is what gets checked
+patch_snapshot() {
+    python3 - "$@" <<'EOF'
+import struct, sys, zlib
+path, field, value = sys.argv[1], sys.argv[2], int(sys.argv[3], 0)
+data = bytearray(open(path, 'rb').read())
+count, data_off = struct.unpack_from('<Q8xQ', data, 16)
+ent = 64
+if field == 'value_off':
+    struct.pack_into('<Q', data, ent + 8, value)
+elif field == 'value_len':
+    struct.pack_into('<I', data, ent + 24, value)
+elif field == 'terminator':
+    off, = struct.unpack_from('<Q', data, ent + 8)
+    length, = struct.unpack_from('<I', data, ent + 24)
+    data[off + length] = value
+struct.pack_into('<I', data, 48, zlib.crc32(bytes(data[64:data_off])))
+open(path, 'wb').write(data)
+EOF
+}
+
+# Wait for the command to succeed, for 5 seconds at most
+wait_until() {
+    for _ in $(seq 50); do
+        "$@" && return 0
+        sleep 0.1
+    done
+    return 1
+}
+
+# Append the bytes to the log, as a crashed write would have left them
+tear_log() {
+    printf "$1" >> $WAL
+}
+
+echo "=== Starting Test Set $TEST_SET ==="
+
+case $TEST_SET in
+    1)
+        # A corrupt or truncated snapshot is refused, never served from
+        start_server -f $SNAPSHOT
+        check_request "CREATE hello world" "CREATE OK"
+        check_request "CREATE bye snu" "CREATE OK"
+        take_snapshot
+        stop_server
+        cp $SNAPSHOT $SNAPSHOT.good
+
+        start_server -f $SNAPSHOT
+        check_request "READ hello" "world"
+        check_request "READ bye" "snu"
+        stop_server
+
+        patch_snapshot $SNAPSHOT value_off 0x8000000000000000
+        refuse_server "is corrupt" -f $SNAPSHOT
+
+        cp $SNAPSHOT.good $SNAPSHOT
+        patch_snapshot $SNAPSHOT value_len 0xffffffff
+        refuse_server "is corrupt" -f $SNAPSHOT
+
+        cp $SNAPSHOT.good $SNAPSHOT
+        patch_snapshot $SNAPSHOT terminator 0x21
+        refuse_server "is corrupt" -f $SNAPSHOT
+
+        cp $SNAPSHOT.good $SNAPSHOT
+        truncate -s -1 $SNAPSHOT
+        refuse_server "is corrupt" -f $SNAPSHOT
+
+        cp $SNAPSHOT.good $SNAPSHOT
+        truncate -s 100 $SNAPSHOT
+        refuse_server "is corrupt" -f $SNAPSHOT
+        ;;
+    2)
+        # Acknowledged writes survive a kill, and a torn tail is cut off
+        start_server -w $WAL
+        check_request "CREATE hello world" "CREATE OK"
+        check_request "CREATE bye snu" "CREATE OK"
+        check_request "UPDATE hello again" "UPDATE OK"
+        check_request "DELETE bye" "DELETE OK"
+        stop_server 9
+
+        # the first bytes of a record header
+        tear_log '\x12\x34\x56\x78\x01\x05'
+        start_server -w $WAL
+        check_request "READ hello" "again"
+        check_request "READ bye" "NOT FOUND"
+        # new records must follow the intact ones to be replayed
+        check_request "CREATE after torn" "CREATE OK"
+        stop_server 9
+
+        # a whole record that fails its crc
+        tear_log '\x00\x00\x00\x00\x01\x01\x00\x00\x01\x00\x00\x00xy'
+        start_server -w $WAL
+        check_request "READ hello" "again"
+        check_request "READ after" "torn"
+        check_request "READ x" "NOT FOUND"
+        check_request "CREATE later corrupt" "CREATE OK"
+        stop_server 9
+
+        start_server -w $WAL
+        check_request "READ after" "torn"
+        check_request "READ later" "corrupt"
+        stop_server
+        ;;
+    3)
+        # A snapshot that did not complete leaves <wal>.old, which is
+        # replayed over the previous snapshot
+        start_server -w $WAL -f $SNAPSHOT
+        check_request "CREATE hello world" "CREATE OK"
+        check_request "CREATE bye snu" "CREATE OK"
+        take_snapshot
+        wait_until test ! -f $WAL.old || fail "$WAL.old kept after a snapshot"
+
+        # the next snapshot cannot be written, after the log is rotated
+        mkdir $SNAPSHOT.tmp
+        check_request "UPDATE hello again" "UPDATE OK"
+        check_request "DELETE bye" "DELETE OK"
+        check_request "CREATE old log" "CREATE OK"
+        check_request "SNAPSHOT" "SNAPSHOT STARTED"
+        wait_until test -f $WAL.old || fail "$WAL was not rotated"
+        check_request "CREATE new log" "CREATE OK"
+        stop_server 9
+        rmdir $SNAPSHOT.tmp
+
+        start_server -w $WAL -f $SNAPSHOT
+        check_request "READ hello" "again"
+        check_request "READ bye" "NOT FOUND"
+        check_request "READ old" "log"
+        check_request "READ new" "log"
+
+        # a snapshot that completes drops it
+        take_snapshot
+        wait_until test ! -f $WAL.old || fail "$WAL.old kept after a snapshot"
+        stop_server 9
+
+        start_server -w $WAL -f $SNAPSHOT
+        check_request "READ hello" "again"
+        check_request "READ bye" "NOT FOUND"
+        check_request "READ old" "log"
+        check_request "READ new" "log"
+        stop_server
+        ;;
+    *)
+        echo "Invalid test set number. Use 1, 2, or 3."
+        exit 1
+        ;;
+esac
+
+echo -e "\033[32mTest Passed: All conditions satisfied for Test Set $TEST_SET.\033[0m"
+exit 0
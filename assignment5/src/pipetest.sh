@@ -0,0 +1,232 @@
+#!/bin/bash
+
+# Default port number
+PORT=8080
+
+# Parse arguments for port number (optional)
+while getopts "p:" opt; do
+    case $opt in
+        p) PORT=$OPTARG ;;
+        *) echo "Usage: $0 [-p port] [1|2|3|4]"; exit 1 ;;
+    esac
+done
+
+# Shift so that $1 now points to the test set selection (if provided)
+shift $((OPTIND-1))
+
+if [ -z "$1" ]; then
+    echo "Usage: $0 [-p port] [1|2|3|4]"
+    exit 1
+fi
+
+TEST_SET=$1
+
+# The server is started by the script itself, with its output in here
+OUTPUT_DIR="./output"
+if [[ -d $OUTPUT_DIR ]]; then
+    rm -rf $OUTPUT_DIR
+fi
+mkdir -p $OUTPUT_DIR
+
+SERVER_PID=
+
+fail() {
+    echo -e "\033[31mTest Failed: $1\033[0m"
+    [ -n "$SERVER_PID" ] && kill -9 $SERVER_PID 2>/dev/null
+    exit 1
+}
+
+# Start the server with the given options and wait for it to listen
+start_server() {
+    ./server -p $PORT "$@" > "$OUTPUT_DIR/server.log" 2>&1 &
+    SERVER_PID=$!
+    for _ in $(seq 50); do
+        if (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null; then
+            return 0
+        fi
+        kill -0 $SERVER_PID 2>/dev/null || break
+        sleep 0.1
+    done
+    fail "the server did not start with '$*'"
+}
+
+# Stop the server cleanly
+stop_server() {
+    kill -INT $SERVER_PID 2>/dev/null
+    wait $SERVER_PID 2>/dev/null
+    SERVER_PID=
+}
+
+# Open a connection of our own on fd 3, to write requests in any pieces
+open_conn() {
+    exec 3<>/dev/tcp/127.0.0.1/$PORT || fail "could not connect"
+}
+
+close_conn() {
+    exec 3<&-
+}
+
+# Send the bytes as they are, escapes included, in a single write
+send_raw() {
+    printf "$1" >&3
+}
+
+# Read a response line for each argument, and check them in order
+expect_responses() {
+    local line
+    for expected in "$@"; do
+        IFS= read -r -t 5 line <&3 || fail "no response, expected '$expected'"
+        if [[ "$line" != "$expected" ]]; then
+            fail "expected '$expected', got '$line'"
+        fi
+        echo "Response '$expected' verified successfully."
+    done
+}
+
+# Print, in hex, a binary request: opcode, key, value in hex, and req_id
+bin_request() {
+    printf '80%02x%02x00%08x%08x' $1 ${#2} $(( ${#3} / 2 )) $4
+    printf '%s' "$2" | od -An -tx1 | tr -d ' \n'
+    printf '%s' "$3"
+}
+
+# Print, in hex, a binary response: opcode, status, value in hex, and req_id
+bin_response() {
+    printf '81%02x00%02x%08x%08x%s' $1 $2 $(( ${#3} / 2 )) $4 "$3"
+}
+
+# Send bytes given in hex, in a single write
+send_hex() {
+    printf "$(sed 's/../\\x&/g' <<< "$1")" >&3
+}
+
+# Read as many bytes as the responses given in hex, and check them
+expect_hex() {
+    local expected="$*" got
+    expected=${expected// /}
+    got=$(timeout 5 head -c $(( ${#expected} / 2 )) <&3 | od -An -tx1 |
+          tr -d ' \n')
+    [[ "$got" == "$expected" ]] || fail "expected $expected, got '$got'"
+    echo "Binary responses $expected verified successfully."
+}
+
+echo "=== Starting Test Set $TEST_SET ==="
+
+case $TEST_SET in
+    1)
+        # Requests sent back to back are all served, in order
+        start_server
+        open_conn
+        send_raw "CREATE hello world\nCREATE bye snu\nREAD hello\nREAD bye\n"
+        expect_responses "CREATE OK" "CREATE OK" "world" "snu"
+        send_raw "UPDATE hello 1\nREAD hello\nDELETE hello\nREAD hello\nREAD bye\n"
+        expect_responses "UPDATE OK" "1" "DELETE OK" "NOT FOUND" "snu"
+        close_conn
+        stop_server
+        ;;
+    2)
+        # A request split over several writes is served once it is whole
+        start_server
+        open_conn
+        send_raw "CRE"
+        sleep 0.2
+        send_raw "ATE hel"
+        sleep 0.2
+        send_raw "lo wor"
+        sleep 0.2
+        send_raw "ld"
+        sleep 0.2
+        send_raw "\n"
+        expect_responses "CREATE OK"
+        # and one that ends in the middle of the next
+        send_raw "READ hello\nRE"
+        expect_responses "world"
+        sleep 0.2
+        send_raw "AD hello\nCREATE bye s"
+        expect_responses "world"
+        sleep 0.2
+        send_raw "nu\nREAD bye\n"
+        expect_responses "CREATE OK" "snu"
+        close_conn
+        stop_server
+        ;;
+    3)
+        # A deep pipeline is answered in full, even when read only later
+        COUNT=20000
+        start_server
+        open_conn
+        for ((i = 0; i < COUNT; i++)); do
+            echo "CREATE key$i value$i"
+        done > "$OUTPUT_DIR/requests.txt"
+        for ((i = 0; i < COUNT; i++)); do
+            echo "READ key$i"
+        done >> "$OUTPUT_DIR/requests.txt"
+        for ((i = 0; i < COUNT; i++)); do
+            echo "CREATE OK"
+        done > "$OUTPUT_DIR/expected.txt"
+        for ((i = 0; i < COUNT; i++)); do
+            echo "value$i"
+        done >> "$OUTPUT_DIR/expected.txt"
+
+        # Written in the background, as the server stops reading while the
+        # responses are not read
+        cat "$OUTPUT_DIR/requests.txt" >&3 &
+        WRITER_PID=$!
+        sleep 1
+        timeout 30 head -n $((2 * COUNT)) <&3 > "$OUTPUT_DIR/responses.txt"
+        wait $WRITER_PID
+        cmp -s "$OUTPUT_DIR/expected.txt" "$OUTPUT_DIR/responses.txt" ||
+            fail "the responses to the pipeline differ, see $OUTPUT_DIR"
+        echo "Responses to $((2 * COUNT)) pipelined requests verified successfully."
+        close_conn
+        stop_server
+        ;;
+    4)
+        # Binary frames carry any bytes, and pipeline like text lines
+        CREATE=0 READ=1 UPDATE=2 DELETE=3
+        OK=0 NOT_FOUND=1 COLLISION=2
+        # "a b", NUL, "c d", a line feed and NUL
+        VALUE=612062006320640a00
+        start_server
+        open_conn
+        send_hex "$(bin_request $CREATE bin $VALUE 1)"
+        expect_hex "$(bin_response $CREATE $OK '' 1)"
+        send_hex "$(bin_request $READ bin '' 2)"
+        expect_hex "$(bin_response $READ $OK $VALUE 2)"
+
+        # a frame split inside its header, and then inside its key
+        FRAME=$(bin_request $READ bin '' 3)
+        send_hex "${FRAME:0:10}"
+        sleep 0.2
+        send_hex "${FRAME:10:16}"
+        sleep 0.2
+        send_hex "${FRAME:26}"
+        expect_hex "$(bin_response $READ $OK $VALUE 3)"
+
+        # all in a single write
+        PIPELINE=$(bin_request $CREATE other 00 4)
+        PIPELINE+=$(bin_request $READ other '' 5)
+        PIPELINE+=$(bin_request $UPDATE bin 0000 6)
+        PIPELINE+=$(bin_request $READ bin '' 7)
+        PIPELINE+=$(bin_request $DELETE other '' 8)
+        PIPELINE+=$(bin_request $READ other '' 9)
+        PIPELINE+=$(bin_request $CREATE bin 20 10)
+        send_hex "$PIPELINE"
+        expect_hex "$(bin_response $CREATE $OK '' 4)" \
+            "$(bin_response $READ $OK 00 5)" \
+            "$(bin_response $UPDATE $OK '' 6)" \
+            "$(bin_response $READ $OK 0000 7)" \
+            "$(bin_response $DELETE $OK '' 8)" \
+            "$(bin_response $READ $NOT_FOUND '' 9)" \
+            "$(bin_response $CREATE $COLLISION '' 10)"
+        close_conn
+        stop_server
+        ;;
+    *)
+        echo "Invalid test set number. Use 1, 2, 3, or 4."
+        exit 1
+        ;;
+esac
+
+echo -e "\033[32mTest Passed: All conditions satisfied for Test Set $TEST_SET.\033[0m"
+exit 0
@@ -3,39 +3,422 @@
 /* Author: Junghan Yoon, KyoungSoo Park                                      */
 /* Modified by: Yeonjae Kim                                                  */
 /*---------------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <limits.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "rwlock.h"
 /*---------------------------------------------------------------------------*/
-int rwlock_init(rwlock_t *rw, int delay)
+/* RWLOCK_WRITER_PREF state */
+#define WP_READERS 0x0000ffffu  // readers holding the lock
+#define WP_WAITING 0x00010000u  // one writer waiting
+#define WP_WAITERS 0x7fff0000u  // writers waiting
+#define WP_WRITER  0x80000000u  // a writer holds the lock
+/* RWLOCK_PHASE_FAIR counters, as in Brandenburg and Anderson's PF-T */
+#define PF_RINC  0x100u         // one reader in rin and rout
+#define PF_WBITS 0x3u           // writer bits of rin
+#define PF_PRES  0x2u           // a writer is present
+#define PF_PHID  0x1u           // phase of the present writer
+/*---------------------------------------------------------------------------*/
+/* where the calling thread counts its waits, or NULL */
+static _Thread_local struct rwlock_wait *t_wait;
+#ifdef RWLOCK_PROFILE
+/* the time the calling thread has waited in the acquisition under way */
+static _Thread_local uint64_t t_waited;
+#define RWLOCK_PROFILED 1
+#else
+#define RWLOCK_PROFILED 0
+#endif
+/*---------------------------------------------------------------------------*/
+static inline uint64_t now_ns(void)
 {
-    TRACE_PRINT();
-    int ret, destroy_ret;
-    rw->read_count = 0;
-    rw->write_count = 0;
-    rw->writer_ring_head = 0;
-    rw->writer_ring_tail = 0;
-    rw->delay = delay;
-    if (rw->writer_ring)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+/*---------------------------------------------------------------------------*/
+/* starts timing a wait, once per acquisition, if anyone counts them */
+static inline void wait_begin(uint64_t *start)
+{
+    if (*start == 0 && (t_wait || RWLOCK_PROFILED))
+    {
+        *start = now_ns();
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* counts the wait begun at start, if any */
+static inline void wait_end(uint64_t start)
+{
+    uint64_t waited;
+
+    if (start == 0)
     {
-        free(rw->writer_ring);
+        return;
     }
-    rw->writer_ring = calloc(WRITER_RING_SIZE, sizeof(pthread_t));
-    if (!rw->writer_ring)
+    waited = now_ns() - start;
+#ifdef RWLOCK_PROFILE
+    t_waited += waited;
+    if (t_wait == NULL)
     {
-        return -1;
+        return;
     }
+#endif
+    /* the only writer, so no atomic read-modify-write */
+    __atomic_store_n(&t_wait->count, t_wait->count + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&t_wait->ns, t_wait->ns + waited, __ATOMIC_RELAXED);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * the profile of a lock, see rwlock_profile(), kept by the public lock
+ * and unlock functions around those of the lock in use. they are empty
+ * unless built with RWLOCK_PROFILE.
+ */
+static inline void prof_ask(rwlock_t *rw, int write)
+{
+#ifdef RWLOCK_PROFILE
+    unsigned int q, max;
 
-    ret = pthread_mutex_init(&rw->lock, NULL);
+    t_waited = 0;
+    if (!write)
+    {
+        return;
+    }
+    q = __atomic_add_fetch(&rw->prof.queued, 1, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&rw->prof.max_queue, __ATOMIC_RELAXED);
+    while (q > max &&
+           !__atomic_compare_exchange_n(&rw->prof.max_queue, &max, q, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+#else
+    (void)rw;
+    (void)write;
+#endif
+}
+/*---------------------------------------------------------------------------*/
+static inline void prof_got(rwlock_t *rw, int write)
+{
+#ifdef RWLOCK_PROFILE
+    if (!write)
+    {
+        __atomic_add_fetch(&rw->prof.reads, 1, __ATOMIC_RELAXED);
+        if (t_waited)
+        {
+            __atomic_add_fetch(&rw->prof.read_waits, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&rw->prof.read_wait_ns, t_waited,
+                               __ATOMIC_RELAXED);
+        }
+        return;
+    }
+    __atomic_sub_fetch(&rw->prof.queued, 1, __ATOMIC_RELAXED);
+    /* the writer holds the lock, so no atomic read-modify-write */
+    __atomic_store_n(&rw->prof.writes, rw->prof.writes + 1,
+                     __ATOMIC_RELAXED);
+    if (t_waited)
+    {
+        __atomic_store_n(&rw->prof.write_waits, rw->prof.write_waits + 1,
+                         __ATOMIC_RELAXED);
+        __atomic_store_n(&rw->prof.write_wait_ns,
+                         rw->prof.write_wait_ns + t_waited, __ATOMIC_RELAXED);
+    }
+    rw->prof.held_since = now_ns();
+#else
+    (void)rw;
+    (void)write;
+#endif
+}
+/*---------------------------------------------------------------------------*/
+static inline void prof_release(rwlock_t *rw)
+{
+#ifdef RWLOCK_PROFILE
+    uint64_t held;
+
+    held = now_ns() - rw->prof.held_since;
+    if (held > rw->prof.max_hold_ns)
+    {
+        __atomic_store_n(&rw->prof.max_hold_ns, held, __ATOMIC_RELAXED);
+    }
+#else
+    (void)rw;
+#endif
+}
+/*---------------------------------------------------------------------------*/
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * sleeps while *addr holds val, or until woken.
+ * returns early, to recheck, on a signal or when *addr has changed already.
+ */
+static void futex_wait(atomic_uint *addr, unsigned int val)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+/*---------------------------------------------------------------------------*/
+static void futex_wake(atomic_uint *addr, int n)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+/*---------------------------------------------------------------------------*/
+static void wp_read_lock(rwlock_t *rw)
+{
+    uint64_t start = 0;
+    unsigned int s, seq;
+    int spin = 0;
+
+    s = atomic_load(&rw->wp.state);
+    for (;;)
+    {
+        if ((s & (WP_WRITER | WP_WAITERS)) == 0)
+        {
+            if (atomic_compare_exchange_weak(&rw->wp.state, &s, s + 1))
+            {
+                wait_end(start);
+                return;
+            }
+            continue;
+        }
+        wait_begin(&start);
+        if (spin++ < RWLOCK_SPIN)
+        {
+            cpu_relax();
+            s = atomic_load(&rw->wp.state);
+            continue;
+        }
+
+        /*
+         * the sequence is read before the state, so that a writer leaving
+         * after the state was read has bumped it, and the wait returns
+         */
+        atomic_fetch_add(&rw->wp.read_sleepers, 1);
+        seq = atomic_load(&rw->wp.read_seq);
+        s = atomic_load(&rw->wp.state);
+        if (s & (WP_WRITER | WP_WAITERS))
+        {
+            futex_wait(&rw->wp.read_seq, seq);
+        }
+        atomic_fetch_sub(&rw->wp.read_sleepers, 1);
+        s = atomic_load(&rw->wp.state);
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void wp_wake_writer(rwlock_t *rw)
+{
+    atomic_fetch_add(&rw->wp.write_seq, 1);
+    futex_wake(&rw->wp.write_seq, 1);
+}
+/*---------------------------------------------------------------------------*/
+static void wp_read_unlock(rwlock_t *rw)
+{
+    unsigned int s;
+
+    s = atomic_fetch_sub(&rw->wp.state, 1) - 1;
+    if ((s & WP_READERS) == 0 && (s & WP_WAITERS))
+    {
+        /* the last reader out lets a waiting writer in */
+        wp_wake_writer(rw);
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void wp_write_lock(rwlock_t *rw)
+{
+    uint64_t start = 0;
+    unsigned int s = 0, seq;
+    int spin = 0;
+
+    if (atomic_compare_exchange_strong(&rw->wp.state, &s, WP_WRITER))
+    {
+        return;
+    }
+    wait_begin(&start);
+
+    /* from now on, no new reader gets in */
+    s = atomic_fetch_add(&rw->wp.state, WP_WAITING) + WP_WAITING;
+    for (;;)
+    {
+        if ((s & (WP_WRITER | WP_READERS)) == 0)
+        {
+            if (atomic_compare_exchange_weak(&rw->wp.state, &s,
+                                             (s - WP_WAITING) | WP_WRITER))
+            {
+                wait_end(start);
+                return;
+            }
+            continue;
+        }
+        if (spin++ < RWLOCK_SPIN)
+        {
+            cpu_relax();
+            s = atomic_load(&rw->wp.state);
+            continue;
+        }
+
+        seq = atomic_load(&rw->wp.write_seq);
+        s = atomic_load(&rw->wp.state);
+        if (s & (WP_WRITER | WP_READERS))
+        {
+            futex_wait(&rw->wp.write_seq, seq);
+        }
+        s = atomic_load(&rw->wp.state);
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void wp_write_unlock(rwlock_t *rw)
+{
+    unsigned int s;
+
+    s = atomic_fetch_sub(&rw->wp.state, WP_WRITER) - WP_WRITER;
+    if (s & WP_WAITERS)
+    {
+        /* writers first; the readers are let in by the last of them */
+        wp_wake_writer(rw);
+    }
+    else if (atomic_load(&rw->wp.read_sleepers))
+    {
+        atomic_fetch_add(&rw->wp.read_seq, 1);
+        futex_wake(&rw->wp.read_seq, INT_MAX);
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void pf_read_lock(rwlock_t *rw)
+{
+    uint64_t start = 0;
+    unsigned int w, v;
+    int spin;
+
+    w = atomic_fetch_add(&rw->pf.rin, PF_RINC) & PF_WBITS;
+    if (w == 0)
+    {
+        return;
+    }
+    wait_begin(&start);
+
+    /* wait for the writer present to leave, which changes its bits */
+    for (spin = 0; spin < RWLOCK_SPIN; spin++)
+    {
+        if ((atomic_load(&rw->pf.rin) & PF_WBITS) != w)
+        {
+            wait_end(start);
+            return;
+        }
+        cpu_relax();
+    }
+    for (;;)
+    {
+        atomic_fetch_add(&rw->pf.read_sleepers, 1);
+        v = atomic_load(&rw->pf.rin);
+        if ((v & PF_WBITS) == w)
+        {
+            futex_wait(&rw->pf.rin, v);
+        }
+        atomic_fetch_sub(&rw->pf.read_sleepers, 1);
+        if ((atomic_load(&rw->pf.rin) & PF_WBITS) != w)
+        {
+            wait_end(start);
+            return;
+        }
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void pf_read_unlock(rwlock_t *rw)
+{
+    atomic_fetch_add(&rw->pf.rout, PF_RINC);
+    if (atomic_load(&rw->pf.draining))
+    {
+        futex_wake(&rw->pf.rout, 1);
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void pf_write_lock(rwlock_t *rw)
+{
+    uint64_t start = 0;
+    unsigned int ticket, rticket, v;
+    int spin;
+
+    /* writers go in the order of their tickets */
+    ticket = atomic_fetch_add(&rw->pf.win, 1);
+    for (spin = 0; atomic_load(&rw->pf.wout) != ticket; spin++)
+    {
+        wait_begin(&start);
+        if (spin < RWLOCK_SPIN)
+        {
+            cpu_relax();
+            continue;
+        }
+        atomic_fetch_add(&rw->pf.write_sleepers, 1);
+        v = atomic_load(&rw->pf.wout);
+        if (v != ticket)
+        {
+            futex_wait(&rw->pf.wout, v);
+        }
+        atomic_fetch_sub(&rw->pf.write_sleepers, 1);
+    }
+
+    /* block new readers, then wait for the readers in to leave */
+    rticket = atomic_fetch_add(&rw->pf.rin, PF_PRES | (ticket & PF_PHID));
+    for (spin = 0; atomic_load(&rw->pf.rout) != rticket; spin++)
+    {
+        wait_begin(&start);
+        if (spin < RWLOCK_SPIN)
+        {
+            cpu_relax();
+            continue;
+        }
+        atomic_store(&rw->pf.draining, 1);
+        v = atomic_load(&rw->pf.rout);
+        if (v != rticket)
+        {
+            futex_wait(&rw->pf.rout, v);
+        }
+    }
+    atomic_store(&rw->pf.draining, 0);
+    wait_end(start);
+}
+/*---------------------------------------------------------------------------*/
+static void pf_write_unlock(rwlock_t *rw)
+{
+    /* the readers that came in meanwhile go first */
+    atomic_fetch_and(&rw->pf.rin, ~PF_WBITS);
+    if (atomic_load(&rw->pf.read_sleepers))
+    {
+        futex_wake(&rw->pf.rin, INT_MAX);
+    }
+
+    atomic_fetch_add(&rw->pf.wout, 1);
+    if (atomic_load(&rw->pf.write_sleepers))
+    {
+        /* every waiting writer checks whether its ticket is up */
+        futex_wake(&rw->pf.wout, INT_MAX);
+    }
+}
+/*---------------------------------------------------------------------------*/
+static int mx_init(rwlock_t *rw)
+{
+    int ret, destroy_ret;
+
+    rw->mx.read_count = 0;
+    rw->mx.write_count = 0;
+    rw->mx.next_ticket = 0;
+    rw->mx.serving = 0;
+
+    ret = pthread_mutex_init(&rw->mx.lock, NULL);
     if (ret != 0)
     {
         errno = ret;
         return -1;
     }
 
-    ret = pthread_cond_init(&rw->readers, NULL);
+    ret = pthread_cond_init(&rw->mx.readers, NULL);
     if (ret != 0)
     {
         /* mutex destroy failed */
-        destroy_ret = pthread_mutex_destroy(&rw->lock);
+        destroy_ret = pthread_mutex_destroy(&rw->mx.lock);
         if (destroy_ret != 0)
         {
             errno = destroy_ret;
@@ -48,11 +431,11 @@ int rwlock_init(rwlock_t *rw, int delay)
         return -1;
     }
 
-    ret = pthread_cond_init(&rw->writers, NULL);
+    ret = pthread_cond_init(&rw->mx.writers, NULL);
     if (ret != 0)
     {
         /* condition variable destroy failed */
-        destroy_ret = pthread_cond_destroy(&rw->readers);
+        destroy_ret = pthread_cond_destroy(&rw->mx.readers);
         if (destroy_ret != 0)
         {
             errno = destroy_ret;
@@ -60,7 +443,7 @@ int rwlock_init(rwlock_t *rw, int delay)
         else
         {
             /* mutex destroy failed */
-            destroy_ret = pthread_mutex_destroy(&rw->lock);
+            destroy_ret = pthread_mutex_destroy(&rw->mx.lock);
             if (destroy_ret != 0)
             {
                 errno = destroy_ret;
@@ -77,37 +460,365 @@ int rwlock_init(rwlock_t *rw, int delay)
     return 0;
 }
 /*---------------------------------------------------------------------------*/
-int rwlock_read_lock(rwlock_t *rw)
+static void mx_read_lock(rwlock_t *rw)
 {
-    TRACE_PRINT();
+    uint64_t start = 0;
+
+    pthread_mutex_lock(&rw->mx.lock);
+    rw->mx.read_count++;
+    while (rw->mx.write_count)
+    {
+        wait_begin(&start);
+        pthread_cond_wait(&rw->mx.readers, &rw->mx.lock);
+    }
+    pthread_mutex_unlock(&rw->mx.lock);
+    wait_end(start);
+}
 /*---------------------------------------------------------------------------*/
-    /* edit here */
-    pthread_mutex_lock(&rw->lock);
-    rw->read_count++;
-    while(rw->write_count){
-        pthread_cond_wait(&rw->readers,&rw->lock);
+static void mx_read_unlock(rwlock_t *rw)
+{
+    pthread_mutex_lock(&rw->mx.lock);
+    rw->mx.read_count--;
+    if (rw->mx.read_count == 0 && rw->mx.serving != rw->mx.next_ticket)
+    {
+        pthread_cond_broadcast(&rw->mx.writers);
+    }
+    pthread_mutex_unlock(&rw->mx.lock);
+}
+/*---------------------------------------------------------------------------*/
+static void mx_write_lock(rwlock_t *rw)
+{
+    uint64_t start = 0;
+    unsigned int ticket;
+
+    pthread_mutex_lock(&rw->mx.lock);
+    ticket = rw->mx.next_ticket++;
+    while (rw->mx.serving != ticket || rw->mx.read_count > 0)
+    {
+        wait_begin(&start);
+        pthread_cond_wait(&rw->mx.writers, &rw->mx.lock);
+    }
+    rw->mx.write_count++;
+    pthread_mutex_unlock(&rw->mx.lock);
+    wait_end(start);
+}
+/*---------------------------------------------------------------------------*/
+static void mx_write_unlock(rwlock_t *rw)
+{
+    pthread_mutex_lock(&rw->mx.lock);
+    rw->mx.write_count--;
+    rw->mx.serving++;
+    if (rw->mx.read_count)
+    {
+        pthread_cond_broadcast(&rw->mx.readers);
+    }
+    else if (rw->mx.serving != rw->mx.next_ticket)
+    {
+        pthread_cond_broadcast(&rw->mx.writers);
+    }
+    pthread_mutex_unlock(&rw->mx.lock);
+}
+/*---------------------------------------------------------------------------*/
+struct rwlock_br_slot
+{
+    atomic_uint readers;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+/* big-reader lock */
+struct rwlock_br
+{
+    /* 0 when free, 1 when a writer holds it, 2 when others sleep on it */
+    atomic_uint writer __attribute__((aligned(CACHE_LINE_SIZE)));
+    atomic_uint draining;   // the writer sleeps until a slot drains
+    struct rwlock_br_slot slots[RWLOCK_BR_SLOTS];
+};
+/*---------------------------------------------------------------------------*/
+/* the reader slot of the calling thread */
+static atomic_uint *br_slot(struct rwlock_br *br)
+{
+    static atomic_uint next_slot;
+    static _Thread_local unsigned int self = UINT_MAX;
+
+    if (self == UINT_MAX)
+    {
+        self = atomic_fetch_add(&next_slot, 1) % RWLOCK_BR_SLOTS;
+    }
+
+    return &br->slots[self].readers;
+}
+/*---------------------------------------------------------------------------*/
+static void br_leave(struct rwlock_br *br, atomic_uint *slot)
+{
+    atomic_fetch_sub(slot, 1);
+    if (atomic_load(&br->draining))
+    {
+        futex_wake(slot, 1);
     }
-    pthread_mutex_unlock(&rw->lock);
+}
+/*---------------------------------------------------------------------------*/
+/* sleeps until the writer lets go, marking that someone sleeps on it */
+static void br_wait_writer(struct rwlock_br *br)
+{
+    unsigned int w;
+    int spin;
 
+    for (spin = 0; spin < RWLOCK_SPIN; spin++)
+    {
+        if (atomic_load(&br->writer) == 0)
+        {
+            return;
+        }
+        cpu_relax();
+    }
+    w = atomic_load(&br->writer);
+    while (w != 0)
+    {
+        if (w == 2 || atomic_compare_exchange_weak(&br->writer, &w, 2))
+        {
+            futex_wait(&br->writer, 2);
+        }
+        w = atomic_load(&br->writer);
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void br_read_lock(struct rwlock_br *br)
+{
+    atomic_uint *slot = br_slot(br);
+    uint64_t start = 0;
 
+    for (;;)
+    {
+        /* counted first, so that a writer coming in waits for it */
+        atomic_fetch_add(slot, 1);
+        if (atomic_load(&br->writer) == 0)
+        {
+            wait_end(start);
+            return;
+        }
+        wait_begin(&start);
+        br_leave(br, slot);
+        br_wait_writer(br);
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void br_read_unlock(struct rwlock_br *br)
+{
+    br_leave(br, br_slot(br));
+}
+/*---------------------------------------------------------------------------*/
+static void br_write_lock(struct rwlock_br *br)
+{
+    uint64_t start = 0;
+    unsigned int c = 0, v;
+    int i, spin;
+
+    /* writers exclude each other as on a futex mutex */
+    if (!atomic_compare_exchange_strong(&br->writer, &c, 1))
+    {
+        wait_begin(&start);
+        if (c != 2)
+        {
+            c = atomic_exchange(&br->writer, 2);
+        }
+        while (c != 0)
+        {
+            futex_wait(&br->writer, 2);
+            c = atomic_exchange(&br->writer, 2);
+        }
+    }
 
+    /* no reader gets in from now on; wait for those in to leave */
+    for (i = 0; i < RWLOCK_BR_SLOTS; i++)
+    {
+        for (spin = 0; atomic_load(&br->slots[i].readers) != 0; spin++)
+        {
+            wait_begin(&start);
+            if (spin < RWLOCK_SPIN)
+            {
+                cpu_relax();
+                continue;
+            }
+            atomic_store(&br->draining, 1);
+            v = atomic_load(&br->slots[i].readers);
+            if (v != 0)
+            {
+                futex_wait(&br->slots[i].readers, v);
+            }
+        }
+    }
+    atomic_store(&br->draining, 0);
+    wait_end(start);
+}
+/*---------------------------------------------------------------------------*/
+static void br_write_unlock(struct rwlock_br *br)
+{
+    if (atomic_exchange(&br->writer, 0) == 2)
+    {
+        futex_wake(&br->writer, INT_MAX);
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void policy_read_lock(rwlock_t *rw)
+{
+    switch (rw->policy)
+    {
+    case RWLOCK_WRITER_PREF:
+        wp_read_lock(rw);
+        break;
+    case RWLOCK_PHASE_FAIR:
+        pf_read_lock(rw);
+        break;
+    default:
+        mx_read_lock(rw);
+        break;
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void policy_read_unlock(rwlock_t *rw)
+{
+    switch (rw->policy)
+    {
+    case RWLOCK_WRITER_PREF:
+        wp_read_unlock(rw);
+        break;
+    case RWLOCK_PHASE_FAIR:
+        pf_read_unlock(rw);
+        break;
+    default:
+        mx_read_unlock(rw);
+        break;
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void policy_write_lock(rwlock_t *rw)
+{
+    switch (rw->policy)
+    {
+    case RWLOCK_WRITER_PREF:
+        wp_write_lock(rw);
+        break;
+    case RWLOCK_PHASE_FAIR:
+        pf_write_lock(rw);
+        break;
+    default:
+        mx_write_lock(rw);
+        break;
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void policy_write_unlock(rwlock_t *rw)
+{
+    switch (rw->policy)
+    {
+    case RWLOCK_WRITER_PREF:
+        wp_write_unlock(rw);
+        break;
+    case RWLOCK_PHASE_FAIR:
+        pf_write_unlock(rw);
+        break;
+    default:
+        mx_write_unlock(rw);
+        break;
+    }
+}
+/*---------------------------------------------------------------------------*/
+static inline int is_big_reader(rwlock_t *rw)
+{
+    return atomic_load_explicit(&rw->big_reader, memory_order_acquire);
+}
+/*---------------------------------------------------------------------------*/
+int rwlock_init(rwlock_t *rw, int delay)
+{
+    TRACE_PRINT();
+
+    return rwlock_init_policy(rw, delay, RWLOCK_WRITER_PREF);
+}
+/*---------------------------------------------------------------------------*/
+int rwlock_init_policy(rwlock_t *rw, int delay, int policy)
+{
+    TRACE_PRINT();
+
+    memset(rw, 0, sizeof(*rw));
+    rw->policy = policy;
+    rw->delay = delay;
+    atomic_init(&rw->big_reader, 0);
+    rw->br = NULL;
+
+    switch (policy)
+    {
+    case RWLOCK_WRITER_PREF:
+        atomic_init(&rw->wp.state, 0);
+        atomic_init(&rw->wp.read_seq, 0);
+        atomic_init(&rw->wp.write_seq, 0);
+        atomic_init(&rw->wp.read_sleepers, 0);
+        return 0;
+    case RWLOCK_PHASE_FAIR:
+        atomic_init(&rw->pf.rin, 0);
+        atomic_init(&rw->pf.rout, 0);
+        atomic_init(&rw->pf.win, 0);
+        atomic_init(&rw->pf.wout, 0);
+        atomic_init(&rw->pf.read_sleepers, 0);
+        atomic_init(&rw->pf.write_sleepers, 0);
+        atomic_init(&rw->pf.draining, 0);
+        return 0;
+    case RWLOCK_MUTEX:
+        return mx_init(rw);
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+}
+/*---------------------------------------------------------------------------*/
+int rwlock_read_lock(rwlock_t *rw)
+{
+    TRACE_PRINT();
+/*---------------------------------------------------------------------------*/
+    /* edit here */
+    prof_ask(rw, 0);
+    /* a lock got across a switch is let go, see rwlock_set_big_reader() */
+    for (;;)
+    {
+        if (is_big_reader(rw))
+        {
+            br_read_lock(rw->br);
+            if (is_big_reader(rw))
+            {
+                break;
+            }
+            br_read_unlock(rw->br);
+        }
+        else
+        {
+            policy_read_lock(rw);
+            if (!is_big_reader(rw))
+            {
+                break;
+            }
+            policy_read_unlock(rw);
+        }
+    }
+    prof_got(rw, 0);
 /*---------------------------------------------------------------------------*/
     return 0;
 }
 /*---------------------------------------------------------------------------*/
 int rwlock_read_unlock(rwlock_t *rw)
 {
-    sleep(rw->delay);
+    if (rw->delay > 0)
+    {
+        sleep(rw->delay);
+    }
     TRACE_PRINT();
 /*---------------------------------------------------------------------------*/
     /* edit here */
-    pthread_mutex_lock(&rw->lock);
-    rw->read_count--;
-    if(rw->read_count==0 && rw->writer_ring_tail != rw->writer_ring_head)
-        pthread_cond_signal(&rw->writers);
-    pthread_mutex_unlock(&rw->lock);
-
-
+    /* no switch happens while the lock is held */
+    if (is_big_reader(rw))
+    {
+        br_read_unlock(rw->br);
+    }
+    else
+    {
+        policy_read_unlock(rw);
+    }
 /*---------------------------------------------------------------------------*/
     return 0;
 }
@@ -117,42 +828,188 @@ int rwlock_write_lock(rwlock_t *rw)
     TRACE_PRINT();
 /*---------------------------------------------------------------------------*/
     /* edit here */
-    pthread_mutex_lock(&rw->lock);
-    rw->writer_ring[rw->writer_ring_head] = pthread_self();
-    rw->writer_ring_head = (rw->writer_ring_head + 1) % WRITER_RING_SIZE;
-    
-    while (rw->writer_ring[rw->writer_ring_tail] != pthread_self() ||
-           rw->read_count > 0) {
-        pthread_cond_wait(&rw->writers, &rw->lock);
+    prof_ask(rw, 1);
+    for (;;)
+    {
+        if (is_big_reader(rw))
+        {
+            br_write_lock(rw->br);
+            if (is_big_reader(rw))
+            {
+                break;
+            }
+            br_write_unlock(rw->br);
+        }
+        else
+        {
+            policy_write_lock(rw);
+            if (!is_big_reader(rw))
+            {
+                break;
+            }
+            policy_write_unlock(rw);
+        }
     }
-    rw->write_count++;
-    pthread_mutex_unlock(&rw->lock);
-
+    prof_got(rw, 1);
 /*---------------------------------------------------------------------------*/
     return 0;
 }
 /*---------------------------------------------------------------------------*/
 int rwlock_write_unlock(rwlock_t *rw)
 {
-    sleep(rw->delay);
+    if (rw->delay > 0)
+    {
+        sleep(rw->delay);
+    }
     TRACE_PRINT();
 /*---------------------------------------------------------------------------*/
     /* edit here */
-    pthread_mutex_lock(&rw->lock);
-    rw->write_count--;
-    rw->writer_ring_tail = (rw->writer_ring_tail + 1) % WRITER_RING_SIZE;
+    prof_release(rw);
+    if (is_big_reader(rw))
+    {
+        br_write_unlock(rw->br);
+    }
+    else
+    {
+        policy_write_unlock(rw);
+    }
+/*---------------------------------------------------------------------------*/
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+int rwlock_set_big_reader(rwlock_t *rw, int on)
+{
+    TRACE_PRINT();
+    struct rwlock_br *br;
+    int hot;
+
+    on = !!on;
+    for (;;)
+    {
+        hot = is_big_reader(rw);
+        if (hot == on)
+        {
+            return 0;
+        }
 
-    if(rw->read_count){
-        pthread_cond_broadcast(&rw->readers);
+        /* the lock being left, so that no one holds it once switched */
+        if (hot)
+        {
+            br_write_lock(rw->br);
+        }
+        else
+        {
+            policy_write_lock(rw);
+        }
+        if (is_big_reader(rw) == hot)
+        {
+            break;
+        }
+        /* someone else switched it meanwhile */
+        if (hot)
+        {
+            br_write_unlock(rw->br);
+        }
+        else
+        {
+            policy_write_unlock(rw);
+        }
     }
-    else if(rw->writer_ring_tail != rw->writer_ring_head){
-        pthread_cond_signal(&rw->writers);
+
+    if (on && rw->br == NULL)
+    {
+        br = aligned_alloc(CACHE_LINE_SIZE, sizeof(*br));
+        if (br == NULL)
+        {
+            policy_write_unlock(rw);
+            return -1;
+        }
+        memset(br, 0, sizeof(*br));
+        rw->br = br;
     }
-    pthread_mutex_unlock(&rw->lock);
+    /* published with the lock being left, and by the release store */
+    atomic_store_explicit(&rw->big_reader, on, memory_order_release);
 
+    if (hot)
+    {
+        br_write_unlock(rw->br);
+    }
+    else
+    {
+        policy_write_unlock(rw);
+    }
 
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+void rwlock_set_wait_stats(struct rwlock_wait *wait)
+{
+    t_wait = wait;
+}
 /*---------------------------------------------------------------------------*/
+int rwlock_profile(rwlock_t *rw, struct rwlock_prof *prof)
+{
+#ifdef RWLOCK_PROFILE
+    prof->reads = __atomic_load_n(&rw->prof.reads, __ATOMIC_RELAXED);
+    prof->writes = __atomic_load_n(&rw->prof.writes, __ATOMIC_RELAXED);
+    prof->read_waits = __atomic_load_n(&rw->prof.read_waits,
+                                       __ATOMIC_RELAXED);
+    prof->read_wait_ns = __atomic_load_n(&rw->prof.read_wait_ns,
+                                         __ATOMIC_RELAXED);
+    prof->write_waits = __atomic_load_n(&rw->prof.write_waits,
+                                        __ATOMIC_RELAXED);
+    prof->write_wait_ns = __atomic_load_n(&rw->prof.write_wait_ns,
+                                          __ATOMIC_RELAXED);
+    prof->max_hold_ns = __atomic_load_n(&rw->prof.max_hold_ns,
+                                        __ATOMIC_RELAXED);
+    prof->max_queue = __atomic_load_n(&rw->prof.max_queue, __ATOMIC_RELAXED);
+
     return 0;
+#else
+    (void)rw;
+    memset(prof, 0, sizeof(*prof));
+    errno = ENOTSUP;
+
+    return -1;
+#endif
+}
+/*---------------------------------------------------------------------------*/
+void rwlock_counts(rwlock_t *rw, int *read_count, int *write_count)
+{
+    unsigned int s, rin;
+    int i;
+
+    if (is_big_reader(rw))
+    {
+        *read_count = 0;
+        for (i = 0; i < RWLOCK_BR_SLOTS; i++)
+        {
+            *read_count += atomic_load(&rw->br->slots[i].readers);
+        }
+        *write_count = atomic_load(&rw->br->writer) != 0;
+        return;
+    }
+
+    switch (rw->policy)
+    {
+    case RWLOCK_WRITER_PREF:
+        s = atomic_load(&rw->wp.state);
+        *read_count = s & WP_READERS;
+        *write_count = !!(s & WP_WRITER);
+        break;
+    case RWLOCK_PHASE_FAIR:
+        rin = atomic_load(&rw->pf.rin);
+        *read_count = (int)((rin & ~PF_WBITS) -
+                            atomic_load(&rw->pf.rout)) / PF_RINC;
+        *write_count = !!(rin & PF_PRES);
+        break;
+    default:
+        pthread_mutex_lock(&rw->mx.lock);
+        *read_count = rw->mx.read_count;
+        *write_count = rw->mx.write_count;
+        pthread_mutex_unlock(&rw->mx.lock);
+        break;
+    }
 }
 /*---------------------------------------------------------------------------*/
 int rwlock_destroy(rwlock_t *rw)
@@ -160,8 +1017,17 @@ int rwlock_destroy(rwlock_t *rw)
     TRACE_PRINT();
     int ret;
 
+    free(rw->br);
+    rw->br = NULL;
+
+    if (rw->policy != RWLOCK_MUTEX)
+    {
+        /* nothing but words */
+        return 0;
+    }
+
     /* destroy the mutex */
-    ret = pthread_mutex_destroy(&rw->lock);
+    ret = pthread_mutex_destroy(&rw->mx.lock);
     if (ret != 0)
     {
         errno = ret;
@@ -169,7 +1035,7 @@ int rwlock_destroy(rwlock_t *rw)
     }
 
     /* destroy the readers condition variable */
-    ret = pthread_cond_destroy(&rw->readers);
+    ret = pthread_cond_destroy(&rw->mx.readers);
     if (ret != 0)
     {
         errno = ret;
@@ -177,18 +1043,12 @@ int rwlock_destroy(rwlock_t *rw)
     }
 
     /* destroy the writers condition variable */
-    ret = pthread_cond_destroy(&rw->writers);
+    ret = pthread_cond_destroy(&rw->mx.writers);
     if (ret != 0)
     {
         errno = ret;
         return -1;
     }
 
-    if (rw->writer_ring)
-    {
-        free(rw->writer_ring);
-        rw->writer_ring = NULL;
-    }
-
     return 0;
 }
@@ -10,33 +10,150 @@
 #include <pthread.h>
 #include <string.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include "common.h"
-#define WRITER_RING_SIZE NUM_THREADS
+/* rounds a lock spins before it sleeps on a futex */
+#define RWLOCK_SPIN 128
+/* reader slots of a big-reader lock, shared by threads beyond as many */
+#define RWLOCK_BR_SLOTS 64
+/*---------------------------------------------------------------------------*/
+/*
+ * lock policies, chosen at init.
+ *
+ * RWLOCK_WRITER_PREF keeps the readers, a writer bit, and the writers
+ * waiting in one word. readers get in with one compare-and-swap while no
+ * writer holds or waits for the lock, and new readers wait behind a
+ * waiting writer.
+ *
+ * RWLOCK_PHASE_FAIR alternates read and write phases: writers take
+ * tickets, and readers arriving during a write phase get in right after
+ * it, ahead of the next writer. neither side can starve the other, and a
+ * reader waits for at most one writer.
+ *
+ * both spin a little, then sleep on a futex, and readers touch no mutex.
+ * RWLOCK_MUTEX is the mutex and condition variable lock they replace,
+ * which prefers readers and queues writers in order.
+ *
+ * any of them can be switched to a big-reader lock, for locks most
+ * threads read at once, e.g., of a key that takes much of the traffic.
+ * there, a reader counts itself only in a slot of its own thread, on a
+ * cache line of its own, and a writer waits for every slot to drain.
+ * see rwlock_set_big_reader().
+ */
+enum RWLOCK_POLICY
+{
+    RWLOCK_WRITER_PREF,
+    RWLOCK_PHASE_FAIR,
+    RWLOCK_MUTEX,
+};
+/*---------------------------------------------------------------------------*/
+struct rwlock_br;
+/*
+ * waits of a thread for locks held by others, see rwlock_set_wait_stats().
+ * only the thread writes them, and others may read them at any time.
+ */
+struct rwlock_wait
+{
+    uint64_t count;         // acquisitions that had to wait
+    uint64_t ns;            // time spent waiting
+};
+/*
+ * contention of a lock, as rwlock_profile() reads it. writers queued are
+ * those between asking for the lock and getting it, whatever the policy.
+ */
+struct rwlock_prof
+{
+    uint64_t reads;         // read acquisitions
+    uint64_t writes;        // write acquisitions
+    uint64_t read_waits;    // read acquisitions that had to wait
+    uint64_t read_wait_ns;
+    uint64_t write_waits;   // write acquisitions that had to wait
+    uint64_t write_wait_ns;
+    uint64_t max_hold_ns;   // longest a writer held the lock
+    unsigned int max_queue; // most writers queued at once
+};
 /*---------------------------------------------------------------------------*/
 typedef struct
 {
-    int read_count;         // number of current/pending read threads
-    int write_count;        // number of write threads
-    pthread_mutex_t lock;   // mutex lock for protection
-    pthread_cond_t readers; // condvar for threads waiting read
-    pthread_cond_t writers; // condvar for threads waiting write
-
-    /* pending writer ring */
-    pthread_t *writer_ring; // thread IDs array
-    int writer_ring_head;   // position to insert
-    int writer_ring_tail;   // position to evict
-
+    int policy;
     /* delay for semantic test */
     int delay;
+
+    /* the big-reader lock takes over while set */
+    atomic_int big_reader;
+    struct rwlock_br *br;   // allocated the first time, or NULL
+
+#ifdef RWLOCK_PROFILE
+    /* see struct rwlock_prof */
+    struct
+    {
+        uint64_t reads;
+        uint64_t writes;
+        uint64_t read_waits;
+        uint64_t read_wait_ns;
+        uint64_t write_waits;
+        uint64_t write_wait_ns;
+        uint64_t max_hold_ns;
+        uint64_t held_since;    // when the writer holding it got in
+        unsigned int queued;    // writers asking for it
+        unsigned int max_queue;
+    } prof;
+#endif
+
+    union
+    {
+        /* RWLOCK_WRITER_PREF */
+        struct
+        {
+            atomic_uint state;      // readers | writers waiting | writer
+            atomic_uint read_seq;   // futex readers sleep on
+            atomic_uint write_seq;  // futex writers sleep on
+            atomic_uint read_sleepers;
+        } wp;
+
+        /* RWLOCK_PHASE_FAIR */
+        struct
+        {
+            atomic_uint rin;        // readers in | writer present and phase
+            atomic_uint rout;       // readers out
+            atomic_uint win;        // writer tickets taken
+            atomic_uint wout;       // writer tickets served
+            atomic_uint read_sleepers;
+            atomic_uint write_sleepers;
+            atomic_uint draining;   // a writer sleeps until readers leave
+        } pf;
+
+        /* RWLOCK_MUTEX */
+        struct
+        {
+            int read_count;         // number of current/pending read threads
+            int write_count;        // number of write threads
+            pthread_mutex_t lock;   // mutex lock for protection
+            pthread_cond_t readers; // condvar for threads waiting read
+            pthread_cond_t writers; // condvar for threads waiting write
+
+            /* pending writers, served in the order of their tickets */
+            unsigned int next_ticket;
+            unsigned int serving;
+        } mx;
+    };
 } rwlock_t;
 /*---------------------------------------------------------------------------*/
 /**
- * initializes rwlock.
+ * initializes rwlock with the default policy, RWLOCK_WRITER_PREF.
  * returns -1 when any internal errors occur.
  * returns 0 on success.
  */
 int rwlock_init(rwlock_t *rw, int delay);
 /*---------------------------------------------------------------------------*/
+/**
+ * initializes rwlock with a policy of enum RWLOCK_POLICY.
+ * returns -1 when any internal errors occur, or the policy is unknown.
+ * returns 0 on success.
+ */
+int rwlock_init_policy(rwlock_t *rw, int delay, int policy);
+/*---------------------------------------------------------------------------*/
 /**
  * acquires read lock.
  * returns -1 when any internal errors occur.
@@ -65,6 +182,41 @@ int rwlock_write_lock(rwlock_t *rw);
  */
 int rwlock_write_unlock(rwlock_t *rw);
 /*---------------------------------------------------------------------------*/
+/**
+ * switches rwlock to the big-reader lock, or back to its policy, which is
+ * safe while other threads take and release it: the lock being left is
+ * taken for write, and a thread that got either one across the switch
+ * lets it go and takes the other.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success.
+ */
+int rwlock_set_big_reader(rwlock_t *rw, int on);
+/*---------------------------------------------------------------------------*/
+/**
+ * makes the calling thread count its waits for any lock in wait, or stop
+ * with NULL. an acquisition that gets in at once costs nothing more; one
+ * that has to spin or sleep reads the clock when it starts to wait and
+ * when it gets in.
+ */
+void rwlock_set_wait_stats(struct rwlock_wait *wait);
+/*---------------------------------------------------------------------------*/
+/**
+ * reads the contention of rwlock since init. it is only kept when built
+ * with -DRWLOCK_PROFILE, which makes every acquisition count itself in
+ * the lock and every write one read the clock twice; without it, the
+ * profile and its cost are compiled out.
+ * returns -1 when the profile is compiled out.
+ * returns 0 on success.
+ */
+int rwlock_profile(rwlock_t *rw, struct rwlock_prof *prof);
+/*---------------------------------------------------------------------------*/
+/**
+ * reads the number of readers in the lock, or waiting for it with
+ * RWLOCK_MUTEX, and whether a writer holds it, e.g., for dumps.
+ * the counts may be stale by the time the caller looks at them.
+ */
+void rwlock_counts(rwlock_t *rw, int *read_count, int *write_count);
+/*---------------------------------------------------------------------------*/
 /**
  * destroys rwlock.
  * returns -1 when any internal errors occur.
@@ -72,4 +224,4 @@ int rwlock_write_unlock(rwlock_t *rw);
  */
 int rwlock_destroy(rwlock_t *rw);
 /*---------------------------------------------------------------------------*/
-#endif // _RWLOCK_H
\ No newline at end of file
+#endif // _RWLOCK_H
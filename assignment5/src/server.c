@@ -16,6 +16,10 @@
 #include <sys/time.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <sched.h>
 #include "common.h"
 #include "skvslib.h"
 /*---------------------------------------------------------------------------*/
@@ -27,11 +31,366 @@ struct thread_args
 
 /*---------------------------------------------------------------------------*/
     /* free to use */
+    int affinity;     // owns listenfd and runs pinned to one CPU
 
 /*---------------------------------------------------------------------------*/
 };
 /*---------------------------------------------------------------------------*/
-volatile static sig_atomic_t g_shutdown = 0;
+/* per-connection state owned by a single worker's event loop */
+struct conn
+{
+    int fd;
+    char rbuf[BUFFER_SIZE]; // bytes received but not yet served
+    size_t rlen;
+    int rblocked;           // stopped reading until responses drain
+    struct skvs_session sess;
+    struct conn *prev;      // worker's connection list
+    struct conn *next;
+    int waiting;            // on the worker's list of those held back
+    struct conn *wprev;
+    struct conn *wnext;
+};
+/*---------------------------------------------------------------------------*/
+static volatile sig_atomic_t g_shutdown = 0;
+static volatile sig_atomic_t g_dump_locks = 0;
+/* connections of the calling worker whose responses wait for the log */
+static __thread struct conn *t_waiting;
+/*---------------------------------------------------------------------------*/
+static int set_nonblocking(int fd)
+{
+    int flags;
+
+    flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+    {
+        perror("fcntl(F_GETFL)");
+        return -1;
+    }
+    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        perror("fcntl(F_SETFL)");
+        return -1;
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * keeps the connection on the worker's list of those waiting for the log
+ * while some of its responses are held back, see skvs_session_release().
+ */
+static void conn_update_wait(struct conn *c)
+{
+    int held = c->sess.hold_head < c->sess.hold_count;
+
+    if (held == c->waiting)
+    {
+        return;
+    }
+    if (held)
+    {
+        c->wprev = NULL;
+        c->wnext = t_waiting;
+        if (t_waiting)
+        {
+            t_waiting->wprev = c;
+        }
+        t_waiting = c;
+    }
+    else
+    {
+        if (c->wprev)
+        {
+            c->wprev->wnext = c->wnext;
+        }
+        else
+        {
+            t_waiting = c->wnext;
+        }
+        if (c->wnext)
+        {
+            c->wnext->wprev = c->wprev;
+        }
+    }
+    c->waiting = held;
+}
+/*---------------------------------------------------------------------------*/
+static void conn_close(struct conn **head, struct conn *c)
+{
+    if (c->prev)
+    {
+        c->prev->next = c->next;
+    }
+    else
+    {
+        *head = c->next;
+    }
+    if (c->next)
+    {
+        c->next->prev = c->prev;
+    }
+
+    /* closing the descriptor also removes it from the epoll set */
+    close(c->fd);
+    skvs_session_free(&c->sess);
+    conn_update_wait(c);
+    free(c);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * writes as many queued responses as the socket accepts, up to those held
+ * back, gathering them into as few writev() calls as possible.
+ * returns -1 when the connection is broken.
+ * returns 0 otherwise, leaving the rest for the next EPOLLOUT.
+ */
+static int conn_flush(struct conn *c)
+{
+    struct skvs_session *sess = &c->sess;
+    ssize_t bytes_sent;
+    int iovcnt;
+
+    while (sess->iov_head < sess->iov_ready)
+    {
+        iovcnt = sess->iov_ready - sess->iov_head;
+        if (iovcnt > IOV_MAX)
+        {
+            iovcnt = IOV_MAX;
+        }
+        bytes_sent = writev(c->fd, &sess->iov[sess->iov_head], iovcnt);
+        if (bytes_sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return 0;
+            }
+            perror("writev");
+            return -1;
+        }
+        skvs_session_advance(sess, bytes_sent);
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * drains the socket (edge-triggered) and serves every complete request,
+ * then sends all the responses at once.
+ * reading pauses while too many responses are pending, so that a client
+ * that pipelines without reading cannot grow the queue without bound.
+ * returns -1 when the connection should be closed.
+ * returns 0 when the socket has no more data for now.
+ */
+static int conn_read(struct skvs_ctx *ctx, struct conn *c)
+{
+    ssize_t bytes_received, consumed;
+    char *buf;
+    size_t len;
+
+    c->rblocked = 0;
+    while (!c->sess.close)
+    {
+        if (c->sess.pending >= MAX_PENDING)
+        {
+            if (conn_flush(c) < 0)
+            {
+                return -1;
+            }
+            if (c->sess.pending >= MAX_PENDING)
+            {
+                /* resumed on EPOLLOUT */
+                c->rblocked = 1;
+                return 0;
+            }
+        }
+
+        /* the rest of a large value goes straight where it belongs */
+        buf = skvs_stream_buf(&c->sess, &len);
+        if (buf == NULL)
+        {
+            buf = c->rbuf + c->rlen;
+            len = sizeof(c->rbuf) - c->rlen;
+        }
+        bytes_received = read(c->fd, buf, len);
+        if (bytes_received < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            perror("read");
+            return -1;
+        }
+        if (bytes_received == 0)
+        {
+            printf("Connection closed by client\n");
+            return -1;
+        }
+        if (buf != c->rbuf + c->rlen)
+        {
+            if (skvs_stream_done(ctx, &c->sess, bytes_received) < 0)
+            {
+                return -1;
+            }
+            continue;
+        }
+        c->rlen += bytes_received;
+
+        consumed = skvs_serve(ctx, &c->sess, c->rbuf, c->rlen);
+        if (consumed < 0)
+        {
+            return -1;
+        }
+
+        /* keep the partial request line at the front */
+        c->rlen -= consumed;
+        memmove(c->rbuf, c->rbuf + consumed, c->rlen);
+    }
+
+    if (conn_flush(c) < 0)
+    {
+        return -1;
+    }
+    if (c->sess.close && c->sess.pending == 0)
+    {
+        printf("Connection closed by client\n");
+        return -1;
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * sends the responses of the waiting connections whose changes became
+ * durable, for the worker to call when the eventfd of skvs_worker_fd()
+ * is readable, and resumes reading those that stopped for them.
+ */
+static void conn_release(struct skvs_ctx *ctx, int wakefd, struct conn **head)
+{
+    struct conn *c, *next;
+    uint64_t count;
+
+    if (read(wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    {
+        perror("read");
+    }
+    for (c = t_waiting; c; c = next)
+    {
+        next = c->wnext;
+        if (skvs_session_release(ctx, &c->sess) < 0 || conn_flush(c) < 0 ||
+            (c->rblocked && conn_read(ctx, c) < 0) ||
+            (c->sess.close && c->sess.pending == 0))
+        {
+            conn_close(head, c);
+            continue;
+        }
+        conn_update_wait(c);
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* accepts every pending connection and registers it to the worker's epoll */
+static void accept_clients(int epfd, int listenfd, struct conn **head)
+{
+    struct epoll_event ev;
+    struct conn *c;
+    int clientfd;
+
+    while (1)
+    {
+        clientfd = accept(listenfd, NULL, NULL);
+        if (clientfd < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                perror("accept");
+            }
+            return;
+        }
+
+        if (set_nonblocking(clientfd) < 0)
+        {
+            close(clientfd);
+            continue;
+        }
+
+        c = calloc(1, sizeof(struct conn));
+        if (c == NULL)
+        {
+            close(clientfd);
+            continue;
+        }
+        c->fd = clientfd;
+        skvs_session_init(&c->sess);
+        c->next = *head;
+        if (*head)
+        {
+            (*head)->prev = c;
+        }
+        *head = c;
+
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, clientfd, &ev) < 0)
+        {
+            perror("epoll_ctl");
+            conn_close(head, c);
+        }
+    }
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * pins the calling worker to the idx-th CPU it is allowed to run on.
+ * returns -1 when any errors occur.
+ * returns 0 on success.
+ */
+static int pin_worker(int idx)
+{
+    cpu_set_t allowed, mask;
+    int cpu, n, ret;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+    {
+        perror("sched_getaffinity");
+        return -1;
+    }
+    n = CPU_COUNT(&allowed);
+    if (n == 0)
+    {
+        return -1;
+    }
+
+    idx %= n;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &allowed) && idx-- == 0)
+        {
+            break;
+        }
+    }
+
+    CPU_ZERO(&mask);
+    CPU_SET(cpu, &mask);
+    ret = pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+    if (ret != 0)
+    {
+        errno = ret;
+        perror("pthread_setaffinity_np");
+        return -1;
+    }
+
+    return 0;
+}
 /*---------------------------------------------------------------------------*/
 void *handle_client(void *arg)
 {
@@ -42,109 +401,127 @@ void *handle_client(void *arg)
     int listenfd = args->listenfd;
 /*---------------------------------------------------------------------------*/
     /* free to declare any variables */
-    int clientfd;
-    struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
-    char buffer[BUFFER_SIZE];
-    const char *response;
-    ssize_t bytes_received;
-    size_t total_sent;
-    size_t response_len;
-    ssize_t bytes_sent;
-    int isFree;
-    int flags;
-    
+    int affinity = args->affinity;
+    struct epoll_event ev, events[MAX_EVENTS];
+    struct conn *c, *conns = NULL;
+    int epfd, nevents, i, timeout = TIMEOUT * 1000;
+    int wakefd, woken;
 
 /*---------------------------------------------------------------------------*/
 
     free(args);
-    printf("%dth worker ready\n", idx);
 
 /*---------------------------------------------------------------------------*/
     /* edit here */
+    skvs_worker_init(ctx, idx);
+    epfd = epoll_create1(0);
+    if (epfd < 0)
+    {
+        perror("epoll_create1");
+        return NULL;
+    }
+
+    if (affinity)
+    {
+        pin_worker(idx);
+    }
+
+    /*
+     * every worker watches the shared listener, but only one is woken.
+     * a per-core listener is not shared, so it needs no exclusivity.
+     */
+    ev.events = EPOLLIN | EPOLLET | (affinity ? 0 : EPOLLEXCLUSIVE);
+    ev.data.ptr = NULL;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev) < 0)
+    {
+        perror("epoll_ctl");
+        close(epfd);
+        return NULL;
+    }
+
+    /* wakes the worker to send the responses that waited for the log */
+    wakefd = skvs_worker_fd();
+    if (wakefd >= 0)
+    {
+        ev.events = EPOLLIN;
+        ev.data.ptr = &wakefd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev) < 0)
+        {
+            perror("epoll_ctl");
+            close(epfd);
+            return NULL;
+        }
+    }
+
+    printf("%dth worker ready\n", idx);
+
     while (!g_shutdown)
     {
-        clientfd = accept(listenfd, (struct sockaddr *)&client_addr, &client_len);
-        if (clientfd < 0)
+        nevents = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+        if (nevents < 0)
         {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                usleep(100);
-                continue;
-            }
-            if (errno == EINTR && g_shutdown)
+            if (errno == EINTR)
             {
-                printf("shutdown\n");
-                break;
+                continue;
             }
-            perror("accept");
-            continue;
-        }
-
-        flags = fcntl(clientfd, F_GETFL, 0);
-        if (flags < 0) {
-            perror("fcntl(F_GETFL)");
-        } else if (fcntl(clientfd, F_SETFL, flags | O_NONBLOCK) < 0) {
-            perror("fcntl(F_SETFL)");
+            perror("epoll_wait");
+            break;
         }
 
-        while (!g_shutdown) {
-            isFree = 0;
-            bytes_received = read(clientfd, buffer, sizeof(buffer) - 1);
-            if (bytes_received < 0) {
-                if (errno == EINTR) {
-                    if (g_shutdown) {
-                        close(clientfd);
-                        break;
-                    }
-                    continue;
-                }
-                if(errno == EAGAIN || errno == EWOULDBLOCK){
-                    usleep(100);
-                    continue;
-                }
-                perror("read");
-                break;
+        woken = 0;
+        for (i = 0; i < nevents; i++)
+        {
+            c = events[i].data.ptr;
+            if (c == NULL)
+            {
+                accept_clients(epfd, listenfd, &conns);
+                continue;
             }
-            if (bytes_received == 0) {
-                printf("Connection closed by client\n");
-                break;
+            if (c == (void *)&wakefd)
+            {
+                /* after the other events, as it may close connections */
+                woken = 1;
+                continue;
             }
 
-            if (bytes_received == 1 && buffer[0] == '\n') {
-                printf("Connection closed by client\n");
-                break;
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+            {
+                conn_close(&conns, c);
+                continue;
             }
-
-            buffer[bytes_received] = '\0';
-
-            response = skvs_serve(ctx, buffer, bytes_received, &isFree);
-            
-            if (response != NULL) {
-                total_sent = 0;
-                response_len = strlen(response);
-
-                while (total_sent < response_len && !g_shutdown) {
-                    bytes_sent = write(clientfd, response + total_sent, 
-                                     response_len - total_sent);
-                    if (bytes_sent < 0) {
-                        if (errno == EINTR) {
-                            if (g_shutdown) break;
-                            continue;
-                        }
-                        perror("write");
-                        break;
-                    }
-                    total_sent += bytes_sent;
-                }
-
-                if(isFree == 1){
-                    free((void*)response);
+            if (events[i].events & EPOLLOUT)
+            {
+                if (conn_flush(c) < 0 ||
+                    (c->sess.close && c->sess.pending == 0))
+                {
+                    conn_close(&conns, c);
+                    continue;
                 }
             }
+            if ((c->rblocked ||
+                 (events[i].events & (EPOLLIN | EPOLLRDHUP))) &&
+                conn_read(ctx, c) < 0)
+            {
+                conn_close(&conns, c);
+                continue;
+            }
+            conn_update_wait(c);
+        }
+        if (woken)
+        {
+            conn_release(ctx, wakefd, &conns);
         }
-        close(clientfd);
+
+        /* expired keys a batch at a time, without waiting while more are */
+        timeout = skvs_expire(ctx) > 0 ? 0 : TIMEOUT * 1000;
     }
-    
+
+    while (conns)
+    {
+        conn_close(&conns, conns);
+    }
+    close(epfd);
+
 /*---------------------------------------------------------------------------*/
 
     return NULL;
@@ -154,30 +531,131 @@ void *handle_client(void *arg)
 void handle_sigint(int sig)
 {
     TRACE_PRINT();
+    (void)sig;
     printf("\nReceived SIGINT, initiating shutdown...\n");
     g_shutdown = 1;
 }
 /*---------------------------------------------------------------------------*/
+/* Signal handler for SIGUSR1, which the main loop answers with a dump */
+void handle_sigusr1(int sig)
+{
+    (void)sig;
+    g_dump_locks = 1;
+}
+/*---------------------------------------------------------------------------*/
+/* prints the lock stripes waited for the longest, see skvs_lock_report() */
+static void dump_locks(struct skvs_ctx *ctx)
+{
+    char buf[BUFFER_SIZE];
+    size_t len = 0;
+
+    if (skvs_lock_report(ctx, SKVS_LOCKS_MAX, buf, sizeof(buf), &len) < 0)
+    {
+        printf("Lock profile not built in, see RWLOCK_PROFILE\n");
+        return;
+    }
+    printf("[Lock Profile]\n%.*sEnd of Lock Profile\n", (int)len, buf);
+    fflush(stdout);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * creates a non-blocking listening socket bound to ip:port.
+ * with reuseport, several sockets may bind the same address and the
+ * kernel load-balances incoming connections among them.
+ * returns -1 when any errors occur.
+ * returns the listening socket on success.
+ */
+static int open_listenfd(const char *ip, int port, int reuseport)
+{
+    struct addrinfo hints, *ai, *ai_it;
+    char port_str[6];
+    int s, res, opt_val;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = 0;
+
+    snprintf(port_str, sizeof(port_str), "%d", port);
+
+    res = getaddrinfo(ip, port_str, &hints, &ai);
+    if (res != 0)
+    {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(res));
+        return -1;
+    }
+
+    s = -1;
+    for (ai_it = ai; ai_it; ai_it = ai_it->ai_next)
+    {
+        s = socket(ai_it->ai_family, ai_it->ai_socktype, ai_it->ai_protocol);
+        if (s < 0)
+        {
+            continue;
+        }
+
+        opt_val = 1;
+        if (set_nonblocking(s) < 0 ||
+            setsockopt(s, SOL_SOCKET, SO_REUSEADDR,
+                       &opt_val, sizeof(opt_val)) < 0 ||
+            (reuseport && setsockopt(s, SOL_SOCKET, SO_REUSEPORT,
+                                     &opt_val, sizeof(opt_val)) < 0) ||
+            bind(s, ai_it->ai_addr, ai_it->ai_addrlen) < 0)
+        {
+            close(s);
+            s = -1;
+            continue;
+        }
+        break;
+    }
+    freeaddrinfo(ai);
+
+    if (s < 0)
+    {
+        fprintf(stderr, "Could not bind to any address\n");
+        return -1;
+    }
+
+    if (listen(s, NUM_BACKLOG) < 0)
+    {
+        perror("listen");
+        close(s);
+        return -1;
+    }
+
+    return s;
+}
+/*---------------------------------------------------------------------------*/
 int main(int argc, char *argv[])
 {
     size_t hash_size = DEFAULT_HASH_SIZE;
+    long buckets_per_lock = DEFAULT_BUCKETS_PER_LOCK;
     char *ip = DEFAULT_ANY_IP;
     int port = DEFAULT_PORT, opt;
     int num_threads = NUM_THREADS;
     int delay = RWLOCK_DELAY;
 /*---------------------------------------------------------------------------*/
     /* free to declare any variables */
-    int s, res;
-    struct addrinfo hints, *ai, *ai_it;
+    int s = -1, i;
+    int affinity = 0, lockfree_read = 0, open_addressing = 0;
+    int ordered_index = 0;
+    int wal_interval = WAL_DEFAULT_INTERVAL;
+    char *wal_path = NULL;
+    char *snapshot_path = NULL;
+    int snapshot_interval = 0;
+    long max_value = MAX_VALUE_SIZE;
+    long long mem_limit = 0;
+    int lock_policy = RWLOCK_WRITER_PREF;
+    int *listenfds;
+    struct skvs_conf conf;
     struct thread_args* args;
-    pthread_t tid[num_threads];
+    pthread_t *tid;
     struct skvs_ctx *global_ctx;
-    char port_str[6];
-    int flags, opt_val;
 /*---------------------------------------------------------------------------*/
 
     /* parse command line options */
-    while ((opt = getopt(argc, argv, "p:t:s:d:h")) != -1)
+    while ((opt = getopt(argc, argv, "p:t:s:b:d:L:alow:i:f:S:v:m:xh")) != -1)
     {
         switch (opt)
         {
@@ -186,6 +664,11 @@ int main(int argc, char *argv[])
             break;
         case 't':
             num_threads = atoi(optarg);
+            if (num_threads <= 0)
+            {
+                fprintf(stderr, "Invalid number of threads\n");
+                exit(EXIT_FAILURE);
+            }
             break;
         case 's':
             hash_size = atoi(optarg);
@@ -195,111 +678,215 @@ int main(int argc, char *argv[])
                 exit(EXIT_FAILURE);
             }
             break;
+        case 'b':
+            buckets_per_lock = atol(optarg);
+            if (buckets_per_lock <= 0)
+            {
+                fprintf(stderr, "Invalid buckets per lock stripe\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'd':
             delay = atoi(optarg);
             break;
+        case 'L':
+            if (strcmp(optarg, "writer") == 0)
+            {
+                lock_policy = RWLOCK_WRITER_PREF;
+            }
+            else if (strcmp(optarg, "fair") == 0)
+            {
+                lock_policy = RWLOCK_PHASE_FAIR;
+            }
+            else if (strcmp(optarg, "mutex") == 0)
+            {
+                lock_policy = RWLOCK_MUTEX;
+            }
+            else
+            {
+                fprintf(stderr, "Invalid lock policy\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'a':
+            affinity = 1;
+            break;
+        case 'l':
+            lockfree_read = 1;
+            break;
+        case 'o':
+            open_addressing = 1;
+            break;
+        case 'x':
+            ordered_index = 1;
+            break;
+        case 'w':
+            wal_path = optarg;
+            break;
+        case 'i':
+            wal_interval = atoi(optarg);
+            if (wal_interval < 0)
+            {
+                fprintf(stderr, "Invalid log sync interval\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'f':
+            snapshot_path = optarg;
+            break;
+        case 'S':
+            snapshot_interval = atoi(optarg);
+            if (snapshot_interval < 0)
+            {
+                fprintf(stderr, "Invalid snapshot interval\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'v':
+            max_value = atol(optarg);
+            if (max_value <= 0 || max_value > WAL_MAX_VALUE_LEN)
+            {
+                fprintf(stderr, "Invalid max value size\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'm':
+            mem_limit = atoll(optarg);
+            if (mem_limit <= 0)
+            {
+                fprintf(stderr, "Invalid memory budget\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'h':
         default:
             printf("Usage: %s [-p port (%d)] "
                    "[-t num_threads (%d)] "
+                   "[-a (per-core listeners)] "
                    "[-d rwlock_delay (%d)] "
-                   "[-s hash_size (%d)]\n",
+                   "[-L writer|fair|mutex (stripe lock policy, writer)] "
+                   "[-s hash_size (%d)] "
+                   "[-b buckets_per_lock_stripe (%d)] "
+                   "[-l (lock-free reads)] "
+                   "[-o (open-addressing table)] "
+                   "[-x (ordered index for SCAN and PREFIX)] "
+                   "[-w wal_path] "
+                   "[-i wal_sync_interval_ms (%d)] "
+                   "[-f snapshot_path] "
+                   "[-S snapshot_interval_s (0: on SNAPSHOT only)] "
+                   "[-v max_value_size (%d)] "
+                   "[-m memory_budget_bytes (0: none)]\n",
                    argv[0],
                    DEFAULT_PORT,
                    NUM_THREADS,
                    RWLOCK_DELAY,
-                   DEFAULT_HASH_SIZE);
+                   DEFAULT_HASH_SIZE,
+                   DEFAULT_BUCKETS_PER_LOCK,
+                   WAL_DEFAULT_INTERVAL,
+                   MAX_VALUE_SIZE);
             exit(EXIT_FAILURE);
         }
     }
 
 /*---------------------------------------------------------------------------*/
     /* edit here */
-    global_ctx = skvs_init(hash_size, delay);
-    if(signal(SIGINT,handle_sigint) == SIG_ERR){
-        fprintf(stderr,"sig error\n");
+    if (lockfree_read && open_addressing)
+    {
+        fprintf(stderr, "Lock-free reads are not supported with -o\n");
         exit(EXIT_FAILURE);
     }
-    memset(&hints,0,sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = 0;
-
-    snprintf(port_str, sizeof(port_str), "%d", port);
-
-    res = getaddrinfo(ip, port_str, &hints, &ai);
-    if (res != 0) {
-        perror("getaddrinfo");
+    if (snapshot_interval && snapshot_path == NULL)
+    {
+        fprintf(stderr, "Periodic snapshots need a snapshot path (-f)\n");
         exit(EXIT_FAILURE);
     }
-    
-    s = -1;
-    ai_it = ai;
-    while(ai_it){
-        s = socket(ai_it->ai_family, ai_it->ai_socktype, ai_it->ai_protocol);
-        if (s < 0) {
-            ai_it = ai_it->ai_next;
-            continue;
-        }
-
-        flags = fcntl(s, F_GETFL, 0);
-        if (flags < 0) {
-            close(s);
-            ai_it = ai_it->ai_next;
-            continue;
-        }
-
-        if (fcntl(s, F_SETFL, flags | O_NONBLOCK) < 0) {
-            perror("fcntl(F_SETFL)");
-            exit(EXIT_FAILURE);
-        }
-
-        opt_val = 1;
-        if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &opt_val, sizeof(opt_val)) < 0) {
-            close(s);
-            ai_it = ai_it->ai_next;
-            continue;
-        }
-
-        if (bind(s, ai_it->ai_addr, ai_it->ai_addrlen) < 0) {
-            close(s);
-            ai_it = ai_it->ai_next;
-            continue;
-        }
-        break;
+    memset(&conf, 0, sizeof(conf));
+    conf.hash_size = hash_size;
+    conf.buckets_per_lock = buckets_per_lock;
+    conf.delay = delay;
+    conf.lock_policy = lock_policy;
+    conf.lockfree_read = lockfree_read;
+    conf.open_addressing = open_addressing;
+    conf.ordered_index = ordered_index;
+    conf.wal_path = wal_path;
+    conf.wal_interval = wal_interval;
+    conf.snapshot_path = snapshot_path;
+    conf.snapshot_interval = snapshot_interval;
+    conf.max_value = max_value;
+    conf.mem_limit = mem_limit;
+    conf.num_workers = num_threads;
+    global_ctx = skvs_init(&conf);
+    if (global_ctx == NULL)
+    {
+        fprintf(stderr, "Failed to initialize SKVS\n");
+        exit(EXIT_FAILURE);
     }
-
-    if (ai_it == NULL) {
-        fprintf(stderr, "Could not bind to any address\n");
-        freeaddrinfo(ai);
+    if(signal(SIGINT,handle_sigint) == SIG_ERR ||
+       signal(SIGUSR1,handle_sigusr1) == SIG_ERR){
+        fprintf(stderr,"sig error\n");
         exit(EXIT_FAILURE);
     }
 
-    if (listen(s, NUM_BACKLOG) < 0) {
-        perror("listen");
-        close(s);
-        freeaddrinfo(ai);
+    tid = calloc(num_threads, sizeof(pthread_t));
+    listenfds = calloc(num_threads, sizeof(int));
+    if (tid == NULL || listenfds == NULL)
+    {
+        perror("calloc");
         exit(EXIT_FAILURE);
     }
-    freeaddrinfo(ai);
-    
-    for(int i = 0; i < num_threads; i++){
+
+    /*
+     * by default all workers share one listener. with -a, each worker
+     * gets its own SO_REUSEPORT listener so that the kernel spreads
+     * accepts and no two workers ever wake up for the same connection.
+     */
+    for (i = 0; i < num_threads; i++)
+    {
+        if (i == 0 || affinity)
+        {
+            s = open_listenfd(ip, port, affinity);
+            if (s < 0)
+            {
+                exit(EXIT_FAILURE);
+            }
+        }
+        listenfds[i] = s;
+    }
+
+    for(i = 0; i < num_threads; i++){
         args = (struct thread_args *)malloc(sizeof(struct thread_args));
-        args->listenfd = s;
+        args->listenfd = listenfds[i];
         args->idx = i;
         args->ctx = global_ctx;
+        args->affinity = affinity;
         if (pthread_create(&tid[i], NULL, handle_client, args) != 0) {
             perror("pthread_create");
             exit(EXIT_FAILURE);
         }
     }
-    while(g_shutdown==0) sleep(1);
+    while (g_shutdown == 0)
+    {
+        sleep(1);
+        skvs_tick(global_ctx);
+        if (g_dump_locks)
+        {
+            g_dump_locks = 0;
+            dump_locks(global_ctx);
+        }
+    }
     printf("Shutting down server...\n");
-    for(int i = 0 ;i<num_threads; i++){
+    for(i = 0 ;i<num_threads; i++){
         pthread_join(tid[i],NULL);
     }
-    close(s);
+    for (i = 0; i < num_threads; i++)
+    {
+        if (i == 0 || affinity)
+        {
+            close(listenfds[i]);
+        }
+    }
+    free(listenfds);
+    free(tid);
     skvs_destroy(global_ctx,1);
 
     
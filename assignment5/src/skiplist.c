@@ -0,0 +1,268 @@
+/*---------------------------------------------------------------------------*/
+/* skiplist.c                                                                */
+/* Author: Yeonjae Kim                                                       */
+/*---------------------------------------------------------------------------*/
+#include <time.h>
+#include "skiplist.h"
+#include "slab.h"
+/*---------------------------------------------------------------------------*/
+/* state of the level generator of the calling thread, 0 until seeded */
+static _Thread_local uint64_t t_rand;
+/*---------------------------------------------------------------------------*/
+/* picks the height of a new node, 1 and each more with 1/SKIP_FANOUT */
+static int random_height(void)
+{
+    struct timespec ts;
+    int height = 1;
+
+    if (t_rand == 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        t_rand = ((uint64_t)ts.tv_nsec << 32) ^ (uintptr_t)&t_rand ^ 1;
+    }
+    /* xorshift64 */
+    t_rand ^= t_rand << 13;
+    t_rand ^= t_rand >> 7;
+    t_rand ^= t_rand << 17;
+    while (height < SKIP_MAX_LEVEL &&
+           (t_rand >> (2 * height)) % SKIP_FANOUT == 0)
+    {
+        height++;
+    }
+
+    return height;
+}
+/*---------------------------------------------------------------------------*/
+static inline size_t node_size(int height)
+{
+    return sizeof(struct skip_node) + height * sizeof(struct skip_node *);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * returns the shard of key, by fnv-1a, which is cheap for keys this short
+ * and does not depend on the seed of the table, which may change.
+ */
+static struct skip_shard *skip_shard(struct skiplist *sl, const char *key)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+
+    while (*key)
+    {
+        h = (h ^ (unsigned char)*key++) * 0x100000001b3ull;
+    }
+
+    return &sl->shards[(h ^ (h >> 32)) & (SKIP_SHARDS - 1)];
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * finds, at every level, the link to the first node not below key, and
+ * returns that node at level 0, or NULL when there is none.
+ * the caller holds the lock.
+ */
+static struct skip_node *
+skip_find(struct skip_shard *shard, const char *key,
+          struct skip_node ***links)
+{
+    struct skip_node *prev = NULL, **link = NULL;
+    int level;
+
+    for (level = shard->height - 1; level >= 0; level--)
+    {
+        /* down from the node the level above stopped at */
+        link = prev ? &prev->next[level] : &shard->head[level];
+        while (*link && strcmp((*link)->key, key) < 0)
+        {
+            prev = *link;
+            link = &prev->next[level];
+        }
+        if (links)
+        {
+            links[level] = link;
+        }
+    }
+
+    return *link;
+}
+/*---------------------------------------------------------------------------*/
+struct skiplist *skip_init(int policy)
+{
+    TRACE_PRINT();
+    struct skiplist *sl;
+    int i;
+
+    if (posix_memalign((void **)&sl, CACHE_LINE_SIZE, sizeof(*sl)) != 0)
+    {
+        DEBUG_PRINT("Failed to allocate memory for the skip list");
+        return NULL;
+    }
+    memset(sl, 0, sizeof(*sl));
+    for (i = 0; i < SKIP_SHARDS; i++)
+    {
+        if (rwlock_init_policy(&sl->shards[i].lock, 0, policy) != 0)
+        {
+            DEBUG_PRINT("Failed to initialize read-write lock");
+            while (i-- > 0)
+            {
+                rwlock_destroy(&sl->shards[i].lock);
+            }
+            free(sl);
+            return NULL;
+        }
+        sl->shards[i].height = 1;
+    }
+
+    return sl;
+}
+/*---------------------------------------------------------------------------*/
+void skip_destroy(struct skiplist *sl)
+{
+    TRACE_PRINT();
+    struct skip_node *node, *next;
+    int i;
+
+    if (sl == NULL)
+    {
+        return;
+    }
+    for (i = 0; i < SKIP_SHARDS; i++)
+    {
+        for (node = sl->shards[i].head[0]; node; node = next)
+        {
+            next = node->next[0];
+            slab_free(node, node_size(node->height));
+        }
+        rwlock_destroy(&sl->shards[i].lock);
+    }
+    free(sl);
+}
+/*---------------------------------------------------------------------------*/
+int skip_insert(struct skiplist *sl, const char *key)
+{
+    TRACE_PRINT();
+    struct skip_shard *shard = skip_shard(sl, key);
+    struct skip_node **links[SKIP_MAX_LEVEL];
+    struct skip_node *node;
+    int height, level;
+
+    /* allocated before locking, to keep it out of the critical section */
+    height = random_height();
+    node = slab_alloc(node_size(height));
+    if (node == NULL)
+    {
+        return -1;
+    }
+    strncpy(node->key, key, MAX_KEY_LEN);
+    node->key[MAX_KEY_LEN] = '\0';
+    node->height = height;
+
+    rwlock_write_lock(&shard->lock);
+    node->next[0] = skip_find(shard, node->key, links);
+    if (node->next[0] && strcmp(node->next[0]->key, node->key) == 0)
+    {
+        rwlock_write_unlock(&shard->lock);
+        slab_free(node, node_size(height));
+        return 0;
+    }
+    for (level = shard->height; level < height; level++)
+    {
+        links[level] = &shard->head[level];
+    }
+    if (height > shard->height)
+    {
+        shard->height = height;
+    }
+    for (level = 0; level < height; level++)
+    {
+        node->next[level] = *links[level];
+        *links[level] = node;
+    }
+    shard->count++;
+    rwlock_write_unlock(&shard->lock);
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+int skip_delete(struct skiplist *sl, const char *key)
+{
+    TRACE_PRINT();
+    struct skip_shard *shard = skip_shard(sl, key);
+    struct skip_node **links[SKIP_MAX_LEVEL];
+    struct skip_node *node;
+    int level;
+
+    rwlock_write_lock(&shard->lock);
+    node = skip_find(shard, key, links);
+    if (node == NULL || strcmp(node->key, key) != 0)
+    {
+        rwlock_write_unlock(&shard->lock);
+        return 0;
+    }
+    for (level = 0; level < node->height; level++)
+    {
+        *links[level] = node->next[level];
+    }
+    while (shard->height > 1 && shard->head[shard->height - 1] == NULL)
+    {
+        shard->height--;
+    }
+    shard->count--;
+    rwlock_write_unlock(&shard->lock);
+
+    slab_free(node, node_size(node->height));
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+int skip_scan(struct skiplist *sl, const char *from, const char *to,
+              const char *prefix, char (*keys)[MAX_KEY_LEN + 1], int n)
+{
+    TRACE_PRINT();
+    struct skip_node *cur[SKIP_SHARDS], *node;
+    size_t prefix_len = prefix ? strlen(prefix) : 0;
+    int found = 0, i, min;
+
+    /* a key with the prefix is not below the prefix itself */
+    if (prefix && strcmp(prefix, from) > 0)
+    {
+        from = prefix;
+    }
+
+    /* in order, and no lock of the index is taken otherwise with another */
+    for (i = 0; i < SKIP_SHARDS; i++)
+    {
+        rwlock_read_lock(&sl->shards[i].lock);
+        cur[i] = skip_find(&sl->shards[i], from, NULL);
+    }
+    while (found < n)
+    {
+        /* the lowest key the shards are at comes next */
+        min = -1;
+        for (i = 0; i < SKIP_SHARDS; i++)
+        {
+            if (cur[i] &&
+                (min < 0 || strcmp(cur[i]->key, cur[min]->key) < 0))
+            {
+                min = i;
+            }
+        }
+        if (min < 0)
+        {
+            break;
+        }
+        node = cur[min];
+        if ((to && strcmp(node->key, to) >= 0) ||
+            (prefix && strncmp(node->key, prefix, prefix_len) != 0))
+        {
+            /* every key from here on is past the range */
+            break;
+        }
+        memcpy(keys[found++], node->key, MAX_KEY_LEN + 1);
+        cur[min] = node->next[0];
+    }
+    for (i = SKIP_SHARDS - 1; i >= 0; i--)
+    {
+        rwlock_read_unlock(&sl->shards[i].lock);
+    }
+
+    return found;
+}
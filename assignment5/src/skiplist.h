@@ -0,0 +1,89 @@
+/*---------------------------------------------------------------------------*/
+/* skiplist.h                                                                */
+/* Author: Yeonjae Kim                                                       */
+/*---------------------------------------------------------------------------*/
+#ifndef _SKIPLIST_H
+#define _SKIPLIST_H
+/*---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "rwlock.h"
+#include "common.h"
+/*---------------------------------------------------------------------------*/
+/*
+ * ordered index of the keys of a table, as a skip list.
+ *
+ * keys are ordered by their bytes, as strcmp() does. a key is linked at
+ * level 0 and, with probability 1/SKIP_FANOUT, at every level above, so
+ * that finding a key or the first one of a range takes O(log n) steps
+ * down the levels, and walking on from there takes one per key.
+ *
+ * the list holds keys only, copied into its nodes. it is sharded, so
+ * that the inserts and deletes the table makes under the stripe write
+ * locks of different keys do not all queue for one lock: a key goes to
+ * one of SKIP_SHARDS lists by a hash of its own, each with a read-write
+ * lock that inserts and deletes take alone. a scan takes every shard's
+ * lock shared, in order, and merges the shards as it walks them.
+ */
+/*---------------------------------------------------------------------------*/
+#define SKIP_MAX_LEVEL 16         // enough for 4^16 keys
+#define SKIP_FANOUT 4
+#define SKIP_SHARDS 16            // a power of 2
+/*---------------------------------------------------------------------------*/
+struct skip_node
+{
+    char key[MAX_KEY_LEN + 1];
+    int height;                   // levels it is linked at
+    struct skip_node *next[];
+};
+/*---------------------------------------------------------------------------*/
+struct skip_shard
+{
+    rwlock_t lock;
+    int height;                   // levels in use
+    size_t count;                 // keys linked
+    struct skip_node *head[SKIP_MAX_LEVEL];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+/*---------------------------------------------------------------------------*/
+struct skiplist
+{
+    struct skip_shard shards[SKIP_SHARDS];
+};
+/*---------------------------------------------------------------------------*/
+/**
+ * creates an empty list, whose locks have the policy of enum RWLOCK_POLICY.
+ * returns NULL when any internal errors occur.
+ */
+struct skiplist *skip_init(int policy);
+/*---------------------------------------------------------------------------*/
+/**
+ * frees the list and every node of it.
+ */
+void skip_destroy(struct skiplist *sl);
+/*---------------------------------------------------------------------------*/
+/**
+ * links key into the list.
+ * returns -1 when any internal errors occur.
+ * returns 1 when successfully linked.
+ * returns 0 when the key is linked already.
+ */
+int skip_insert(struct skiplist *sl, const char *key);
+/*---------------------------------------------------------------------------*/
+/**
+ * unlinks key from the list.
+ * returns 1 when successfully unlinked.
+ * returns 0 when there is no such key.
+ */
+int skip_delete(struct skiplist *sl, const char *key);
+/*---------------------------------------------------------------------------*/
+/**
+ * copies to keys, in order, at most n keys that are not below from, are
+ * below to unless it is NULL, and start with prefix unless it is NULL.
+ * returns the number of keys copied.
+ */
+int skip_scan(struct skiplist *sl, const char *from, const char *to,
+              const char *prefix, char (*keys)[MAX_KEY_LEN + 1], int n);
+/*---------------------------------------------------------------------------*/
+#endif // _SKIPLIST_H
@@ -0,0 +1,1142 @@
+/*---------------------------------------------------------------------------*/
+/* skvsbench.c                                                               */
+/* Author: Yeonjae Kim                                                       */
+/*---------------------------------------------------------------------------*/
+/*
+ * load generator for SKVS.
+ *
+ * worker threads drive their share of the connections from an epoll
+ * loop, each keeping up to a pipeline depth of text requests in flight.
+ * in closed loop, a connection sends its next request as soon as one
+ * comes back, and latency is taken from the send. in open loop, requests
+ * are due at a fixed rate whether or not the server keeps up, and latency
+ * is taken from when a request was due, so that a stalled server is
+ * charged for the requests it held back (no coordinated omission).
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include "common.h"
+/*---------------------------------------------------------------------------*/
+#define BENCH_DEFAULT_THREADS 4
+#define BENCH_DEFAULT_CONNS 16
+#define BENCH_DEFAULT_DEPTH 1
+#define BENCH_DEFAULT_KEYS 100000
+#define BENCH_DEFAULT_READS 90          // percent
+#define BENCH_DEFAULT_VALUE 100         // bytes
+#define BENCH_DEFAULT_DURATION 10       // s
+#define BENCH_DEFAULT_THETA 0.99
+#define BENCH_DEFAULT_HOT_OPS 0.9
+#define BENCH_DEFAULT_HOT_KEYS 0.01
+#define BENCH_PRELOAD_BATCH 256         // requests in flight while preloading
+#define BENCH_RBUF_SIZE (64 * 1024)
+/*
+ * latency histogram, in ns. the values below HIST_SUB are counted
+ * exactly, and every power of two above is split into HIST_SUB / 2
+ * buckets, so a recorded value is off by less than 1 / (HIST_SUB / 2).
+ */
+#define HIST_SUB_BITS 8
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_HALF (HIST_SUB / 2)
+#define HIST_MAX_BITS 40                // about 18 minutes
+#define HIST_LEN ((HIST_MAX_BITS - HIST_SUB_BITS + 3) * HIST_HALF)
+/*---------------------------------------------------------------------------*/
+enum DIST
+{
+    DIST_UNIFORM,
+    DIST_ZIPF,      // scrambled, so the hot keys spread over the table
+    DIST_HOTSPOT,   // hot_ops of the requests go to hot_keys of the keys
+};
+/*---------------------------------------------------------------------------*/
+struct hist
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HIST_LEN];
+};
+/*---------------------------------------------------------------------------*/
+struct bench_conf
+{
+    const char *host;
+    const char *port;
+    int threads;
+    int conns;
+    int depth;          // requests in flight per connection
+    long keys;
+    int reads;          // percent of READs, the rest are UPDATEs
+    size_t value_min;
+    size_t value_max;
+    double duration;    // s measured
+    double warmup;      // s run before measuring
+    double rate;        // requests per second in all, 0 for closed loop
+    int preload;        // CREATE every key first
+    enum DIST dist;
+    double theta;       // zipf skew
+    double hot_ops;
+    double hot_keys;
+};
+/*---------------------------------------------------------------------------*/
+/* precomputed for drawing zipf ranks, as Gray et al. do */
+struct zipf
+{
+    long n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+};
+/*---------------------------------------------------------------------------*/
+struct conn
+{
+    int fd;
+    uint64_t *sent_at;  // ring of depth timestamps of requests in flight
+    int head;           // oldest request in flight
+    int inflight;
+    uint64_t issued;    // requests sent, for the open-loop schedule
+    char *wbuf;         // request bytes not written yet
+    size_t wlen;
+    size_t wcap;
+    char *rbuf;         // response bytes not parsed yet
+    size_t rlen;
+    size_t rcap;
+    int want_out;       // registered for EPOLLOUT
+};
+/*---------------------------------------------------------------------------*/
+struct worker
+{
+    pthread_t tid;
+    int id;
+    struct conn *conns;
+    int nconns;
+    int epfd;
+    int timerfd;        // fires when the next open-loop request is due
+    uint64_t rng;
+    struct hist hist;
+    uint64_t done;      // responses while measuring
+    uint64_t misses;    // READs answered NOT FOUND
+    uint64_t errors;    // responses of any error
+    int failed;
+};
+/*---------------------------------------------------------------------------*/
+static struct bench_conf g_conf;
+static struct zipf g_zipf;
+static char *g_value;               // value_max letters, sliced by requests
+static uint64_t g_start;            // ns, when the schedule starts
+static uint64_t g_measure;          // ns, when measuring starts
+static uint64_t g_end;              // ns, when it all stops
+static uint64_t g_interval;         // ns between requests of a connection
+static atomic_long g_preload_next;  // next key to preload
+/*---------------------------------------------------------------------------*/
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+/*---------------------------------------------------------------------------*/
+/* xorshift64*, one state per thread */
+static inline uint64_t rng_next(uint64_t *s)
+{
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+
+    return *s * 0x2545f4914f6cdd1dull;
+}
+/*---------------------------------------------------------------------------*/
+/* uniform in [0, 1) */
+static inline double rng_double(uint64_t *s)
+{
+    return (rng_next(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+/*---------------------------------------------------------------------------*/
+static int hist_index(uint64_t v)
+{
+    int g;
+
+    if (v < HIST_SUB)
+    {
+        return v;
+    }
+    g = 63 - __builtin_clzll(v) - HIST_SUB_BITS + 1;
+    if (g > HIST_MAX_BITS - HIST_SUB_BITS + 1)
+    {
+        return HIST_LEN - 1;
+    }
+
+    return g * HIST_HALF + (v >> g);
+}
+/*---------------------------------------------------------------------------*/
+/* the middle of the values a bucket counts */
+static uint64_t hist_value(int i)
+{
+    int g;
+
+    if (i < HIST_SUB)
+    {
+        return i;
+    }
+    g = i / HIST_HALF - 1;
+
+    return ((uint64_t)(i - g * HIST_HALF) << g) + (1ull << (g - 1));
+}
+/*---------------------------------------------------------------------------*/
+static inline void hist_record(struct hist *h, uint64_t v)
+{
+    h->buckets[hist_index(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v > h->max)
+    {
+        h->max = v;
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void hist_merge(struct hist *to, const struct hist *from)
+{
+    int i;
+
+    for (i = 0; i < HIST_LEN; i++)
+    {
+        to->buckets[i] += from->buckets[i];
+    }
+    to->count += from->count;
+    to->sum += from->sum;
+    if (from->max > to->max)
+    {
+        to->max = from->max;
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* the value at or below which a fraction q of the recorded ones are */
+static uint64_t hist_quantile(const struct hist *h, double q)
+{
+    uint64_t rank, seen = 0;
+    int i;
+
+    if (h->count == 0)
+    {
+        return 0;
+    }
+    rank = (uint64_t)ceil(q * h->count);
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+    for (i = 0; i < HIST_LEN; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= rank)
+        {
+            return hist_value(i) < h->max ? hist_value(i) : h->max;
+        }
+    }
+
+    return h->max;
+}
+/*---------------------------------------------------------------------------*/
+static double zeta(long n, double theta)
+{
+    double sum = 0;
+    long i;
+
+    for (i = 1; i <= n; i++)
+    {
+        sum += 1 / pow((double)i, theta);
+    }
+
+    return sum;
+}
+/*---------------------------------------------------------------------------*/
+static void zipf_init(struct zipf *z, long n, double theta)
+{
+    double zeta2 = zeta(2, theta);
+
+    z->n = n;
+    z->theta = theta;
+    z->zetan = zeta(n, theta);
+    z->alpha = 1 / (1 - theta);
+    z->eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / z->zetan);
+}
+/*---------------------------------------------------------------------------*/
+/* a rank in [0, n), 0 the most popular */
+static long zipf_next(const struct zipf *z, uint64_t *rng)
+{
+    double u = rng_double(rng), uz = u * z->zetan;
+
+    if (uz < 1)
+    {
+        return 0;
+    }
+    if (uz < 1 + pow(0.5, z->theta))
+    {
+        return 1;
+    }
+
+    return (long)(z->n * pow(z->eta * u - z->eta + 1, z->alpha)) % z->n;
+}
+/*---------------------------------------------------------------------------*/
+static long next_key(struct worker *w)
+{
+    const struct bench_conf *c = &g_conf;
+    long hot;
+
+    switch (c->dist)
+    {
+    case DIST_ZIPF:
+        /* FNV-1a of the rank, so that popular keys are not neighbours */
+        return (long)((((uint64_t)zipf_next(&g_zipf, &w->rng) ^
+                        0xcbf29ce484222325ull) * 0x100000001b3ull) %
+                      (uint64_t)c->keys);
+    case DIST_HOTSPOT:
+        hot = (long)(c->keys * c->hot_keys);
+        if (hot < 1)
+        {
+            hot = 1;
+        }
+        if (rng_double(&w->rng) < c->hot_ops)
+        {
+            return rng_next(&w->rng) % hot;
+        }
+        if (hot >= c->keys)
+        {
+            return rng_next(&w->rng) % c->keys;
+        }
+        return hot + rng_next(&w->rng) % (c->keys - hot);
+    default:
+        return rng_next(&w->rng) % c->keys;
+    }
+}
+/*---------------------------------------------------------------------------*/
+static size_t next_value_len(struct worker *w)
+{
+    const struct bench_conf *c = &g_conf;
+
+    if (c->value_max == c->value_min)
+    {
+        return c->value_min;
+    }
+
+    return c->value_min + rng_next(&w->rng) % (c->value_max - c->value_min + 1);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * connects to the server with a blocking socket.
+ * returns -1 when any errors occur.
+ * returns the socket on success.
+ */
+static int bench_connect(void)
+{
+    struct addrinfo hints, *ai, *it;
+    int fd = -1, one = 1, ret;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    ret = getaddrinfo(g_conf.host, g_conf.port, &hints, &ai);
+    if (ret != 0)
+    {
+        fprintf(stderr, "%s\n", gai_strerror(ret));
+        return -1;
+    }
+    for (it = ai; it; it = it->ai_next)
+    {
+        fd = socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+        if (fd < 0)
+        {
+            continue;
+        }
+        if (connect(fd, it->ai_addr, it->ai_addrlen) == 0)
+        {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(ai);
+    if (fd < 0)
+    {
+        perror("connect");
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    return fd;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * makes room for len more bytes in a buffer.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success.
+ */
+static int buf_reserve(char **buf, size_t *cap, size_t used, size_t len)
+{
+    size_t n = *cap ? *cap : 4096;
+    char *p;
+
+    if (used + len <= *cap)
+    {
+        return 0;
+    }
+    while (n < used + len)
+    {
+        n *= 2;
+    }
+    p = realloc(*buf, n);
+    if (p == NULL)
+    {
+        return -1;
+    }
+    *buf = p;
+    *cap = n;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * appends the next request to the write buffer of a connection.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success.
+ */
+static int conn_add_request(struct worker *w, struct conn *c)
+{
+    char head[64];
+    long key = next_key(w);
+    size_t len, vlen;
+    int n;
+
+    if ((int)(rng_next(&w->rng) % 100) < g_conf.reads)
+    {
+        n = snprintf(head, sizeof(head), "READ k%ld\n", key);
+        vlen = 0;
+    }
+    else
+    {
+        n = snprintf(head, sizeof(head), "UPDATE k%ld ", key);
+        vlen = next_value_len(w);
+    }
+    len = n + vlen + (vlen ? 1 : 0);
+    if (buf_reserve(&c->wbuf, &c->wcap, c->wlen, len) < 0)
+    {
+        return -1;
+    }
+    memcpy(c->wbuf + c->wlen, head, n);
+    if (vlen)
+    {
+        memcpy(c->wbuf + c->wlen + n, g_value, vlen);
+        c->wbuf[c->wlen + n + vlen] = '\n';
+    }
+    c->wlen += len;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * writes out what the write buffer of a connection holds, as far as the
+ * socket takes it, and watches for room when it does not take it all.
+ * returns -1 when any errors occur.
+ * returns 0 on success.
+ */
+static int conn_flush(struct worker *w, struct conn *c)
+{
+    struct epoll_event ev;
+    ssize_t n;
+    size_t off = 0;
+    int want;
+
+    while (off < c->wlen)
+    {
+        n = write(c->fd, c->wbuf + off, c->wlen - off);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            perror("write");
+            return -1;
+        }
+        off += n;
+    }
+    memmove(c->wbuf, c->wbuf + off, c->wlen - off);
+    c->wlen -= off;
+
+    want = c->wlen > 0;
+    if (want != c->want_out)
+    {
+        ev.events = EPOLLIN | (want ? EPOLLOUT : 0);
+        ev.data.ptr = c;
+        if (epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0)
+        {
+            perror("epoll_ctl");
+            return -1;
+        }
+        c->want_out = want;
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * issues the requests a connection has room and is due for.
+ * in open loop, request k of a connection is due at start + k * interval,
+ * and that is the time it is charged from.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success.
+ */
+static int conn_issue(struct worker *w, struct conn *c, uint64_t now)
+{
+    uint64_t due;
+    int added = 0;
+
+    while (c->inflight < g_conf.depth)
+    {
+        if (g_interval)
+        {
+            due = g_start + c->issued * g_interval;
+            if (due > now || due >= g_end)
+            {
+                break;
+            }
+        }
+        else
+        {
+            if (now >= g_end)
+            {
+                break;
+            }
+            due = now;
+        }
+        if (conn_add_request(w, c) < 0)
+        {
+            return -1;
+        }
+        c->sent_at[(c->head + c->inflight) % g_conf.depth] = due;
+        c->inflight++;
+        c->issued++;
+        added = 1;
+    }
+
+    return added ? conn_flush(w, c) : 0;
+}
+/*---------------------------------------------------------------------------*/
+/* accounts for one response line of a connection */
+static void conn_complete(struct worker *w, struct conn *c, const char *line,
+                          size_t len, uint64_t now)
+{
+    uint64_t sent = c->sent_at[c->head];
+
+    c->head = (c->head + 1) % g_conf.depth;
+    c->inflight--;
+    if (sent < g_measure)
+    {
+        /* warming up */
+        return;
+    }
+    hist_record(&w->hist, now - sent);
+    w->done++;
+    if (len == 9 && memcmp(line, "NOT FOUND", 9) == 0)
+    {
+        w->misses++;
+    }
+    else if ((len == 11 && memcmp(line, "INVALID CMD", 11) == 0) ||
+             (len == 12 && memcmp(line, "INTERNAL ERR", 12) == 0))
+    {
+        w->errors++;
+    }
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * reads what a connection has received, and completes a request for
+ * every whole response line.
+ * returns -1 when any errors occur, or the server closed it.
+ * returns 0 on success.
+ */
+static int conn_read(struct worker *w, struct conn *c)
+{
+    char *p, *nl, *end;
+    uint64_t now;
+    ssize_t n;
+
+    for (;;)
+    {
+        if (buf_reserve(&c->rbuf, &c->rcap, c->rlen, BENCH_RBUF_SIZE) < 0)
+        {
+            return -1;
+        }
+        n = read(c->fd, c->rbuf + c->rlen, c->rcap - c->rlen);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return 0;
+            }
+            perror("read");
+            return -1;
+        }
+        if (n == 0)
+        {
+            fprintf(stderr, "Connection closed by server\n");
+            return -1;
+        }
+
+        /* responses come back in the order of their requests */
+        now = now_ns();
+        p = c->rbuf;
+        end = c->rbuf + c->rlen + n;
+        while (p < end && (nl = memchr(p, '\n', end - p)) != NULL)
+        {
+            if (c->inflight == 0)
+            {
+                fprintf(stderr, "Response to no request\n");
+                return -1;
+            }
+            conn_complete(w, c, p, nl - p, now);
+            p = nl + 1;
+        }
+        c->rlen = end - p;
+        memmove(c->rbuf, p, c->rlen);
+    }
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * creates every key given out from g_preload_next, a batch at a time.
+ * returns -1 when any errors occur.
+ * returns 0 on success.
+ */
+static int preload(struct worker *w, int fd)
+{
+    char *buf = NULL, line[64];
+    size_t cap = 0, len, vlen, got;
+    long key, first;
+    int i, n, count, lines;
+    ssize_t r;
+
+    for (;;)
+    {
+        first = atomic_fetch_add(&g_preload_next, BENCH_PRELOAD_BATCH);
+        if (first >= g_conf.keys)
+        {
+            break;
+        }
+        len = 0;
+        count = 0;
+        for (key = first; key < g_conf.keys &&
+                          key < first + BENCH_PRELOAD_BATCH; key++)
+        {
+            vlen = next_value_len(w);
+            n = snprintf(line, sizeof(line), "CREATE k%ld ", key);
+            if (buf_reserve(&buf, &cap, len, n + vlen + 1) < 0)
+            {
+                free(buf);
+                return -1;
+            }
+            memcpy(buf + len, line, n);
+            memcpy(buf + len + n, g_value, vlen);
+            buf[len + n + vlen] = '\n';
+            len += n + vlen + 1;
+            count++;
+        }
+        for (got = 0; got < len; got += r)
+        {
+            r = write(fd, buf + got, len - got);
+            if (r <= 0)
+            {
+                perror("write");
+                free(buf);
+                return -1;
+            }
+        }
+        /* CREATE OK or COLLISION for each */
+        for (lines = 0; lines < count;)
+        {
+            r = read(fd, line, sizeof(line));
+            if (r <= 0)
+            {
+                fprintf(stderr, "Connection closed by server\n");
+                free(buf);
+                return -1;
+            }
+            for (i = 0; i < r; i++)
+            {
+                lines += line[i] == '\n';
+            }
+        }
+    }
+    free(buf);
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    struct epoll_event events[MAX_EVENTS], ev;
+    struct itimerspec its;
+    struct conn *c;
+    uint64_t now, next_due, armed = 0;
+    int i, n;
+
+    memset(&its, 0, sizeof(its));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->timerfd, &ev) < 0)
+    {
+        perror("epoll_ctl");
+        w->failed = 1;
+        return NULL;
+    }
+    for (i = 0; i < w->nconns; i++)
+    {
+        c = &w->conns[i];
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0)
+        {
+            perror("epoll_ctl");
+            w->failed = 1;
+            return NULL;
+        }
+    }
+
+    for (;;)
+    {
+        now = now_ns();
+        n = 0;
+        next_due = UINT64_MAX;
+        for (i = 0; i < w->nconns; i++)
+        {
+            c = &w->conns[i];
+            if (conn_issue(w, c, now) < 0)
+            {
+                w->failed = 1;
+                return NULL;
+            }
+            n += c->inflight;
+            if (g_interval && c->inflight < g_conf.depth &&
+                g_start + c->issued * g_interval < next_due)
+            {
+                next_due = g_start + c->issued * g_interval;
+            }
+        }
+        if (now >= g_end && n == 0)
+        {
+            break;
+        }
+
+        /*
+         * sleep no later than the next request is due. epoll_wait() only
+         * takes whole milliseconds, which would either spin or send late.
+         */
+        if (next_due != UINT64_MAX && next_due < g_end && next_due != armed)
+        {
+            its.it_value.tv_sec = next_due / 1000000000ull;
+            its.it_value.tv_nsec = next_due % 1000000000ull;
+            if (timerfd_settime(w->timerfd, TFD_TIMER_ABSTIME, &its,
+                                NULL) < 0)
+            {
+                perror("timerfd_settime");
+                w->failed = 1;
+                return NULL;
+            }
+            armed = next_due;
+        }
+        n = epoll_wait(w->epfd, events, MAX_EVENTS, 100);
+        if (n < 0 && errno != EINTR)
+        {
+            perror("epoll_wait");
+            w->failed = 1;
+            return NULL;
+        }
+        for (i = 0; i < n; i++)
+        {
+            c = events[i].data.ptr;
+            if (c == NULL)
+            {
+                /* the timer fired, the loop sends what is due */
+                if (read(w->timerfd, &now, sizeof(now)) < 0 &&
+                    errno != EAGAIN)
+                {
+                    perror("read");
+                    w->failed = 1;
+                    return NULL;
+                }
+                continue;
+            }
+            if ((events[i].events & EPOLLOUT) && conn_flush(w, c) < 0)
+            {
+                w->failed = 1;
+                return NULL;
+            }
+            if ((events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) &&
+                conn_read(w, c) < 0)
+            {
+                w->failed = 1;
+                return NULL;
+            }
+        }
+        if (now_ns() >= g_end + 5000000000ull)
+        {
+            /* give up on responses that never come */
+            fprintf(stderr, "Responses still pending at the end\n");
+            break;
+        }
+    }
+
+    return NULL;
+}
+/*---------------------------------------------------------------------------*/
+static void *preload_main(void *arg)
+{
+    struct worker *w = arg;
+
+    if (preload(w, w->conns[0].fd) < 0)
+    {
+        w->failed = 1;
+    }
+
+    return NULL;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * parses a key distribution, "uniform", "zipf[:theta]" or
+ * "hotspot[:ops_fraction[:keys_fraction]]".
+ * returns -1 when it is malformed.
+ * returns 0 on success.
+ */
+static int parse_dist(const char *s, struct bench_conf *c)
+{
+    const char *p = strchr(s, ':');
+    size_t n = p ? (size_t)(p - s) : strlen(s);
+
+    if (n == 7 && strncmp(s, "uniform", n) == 0 && p == NULL)
+    {
+        c->dist = DIST_UNIFORM;
+        return 0;
+    }
+    if (n == 4 && strncmp(s, "zipf", n) == 0)
+    {
+        c->dist = DIST_ZIPF;
+        if (p)
+        {
+            c->theta = atof(p + 1);
+        }
+        return c->theta > 0 && c->theta < 1 ? 0 : -1;
+    }
+    if (n == 7 && strncmp(s, "hotspot", n) == 0)
+    {
+        c->dist = DIST_HOTSPOT;
+        if (p)
+        {
+            c->hot_ops = atof(p + 1);
+            p = strchr(p + 1, ':');
+            if (p)
+            {
+                c->hot_keys = atof(p + 1);
+            }
+        }
+        return c->hot_ops >= 0 && c->hot_ops <= 1 &&
+               c->hot_keys > 0 && c->hot_keys <= 1 ? 0 : -1;
+    }
+
+    return -1;
+}
+/*---------------------------------------------------------------------------*/
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-i server_ip_or_domain (%s)] [-p port (%d)] "
+           "[-t threads (%d)] [-c connections (%d)] "
+           "[-d pipeline_depth (%d)] [-k keys (%d)] "
+           "[-D uniform|zipf[:theta (%.2f)]|"
+           "hotspot[:ops_fraction (%.2f)[:keys_fraction (%.2f)]] "
+           "(uniform)] "
+           "[-r read_percent (%d)] [-v value_bytes[:max_bytes] (%d)] "
+           "[-T duration_s (%d)] [-w warmup_s (0)] "
+           "[-R requests_per_s (0: closed loop)] [-P (preload keys)]\n",
+           prog, DEFAULT_LOOPBACK_IP, DEFAULT_PORT, BENCH_DEFAULT_THREADS,
+           BENCH_DEFAULT_CONNS, BENCH_DEFAULT_DEPTH, BENCH_DEFAULT_KEYS,
+           BENCH_DEFAULT_THETA, BENCH_DEFAULT_HOT_OPS, BENCH_DEFAULT_HOT_KEYS,
+           BENCH_DEFAULT_READS, BENCH_DEFAULT_VALUE, BENCH_DEFAULT_DURATION);
+    exit(EXIT_FAILURE);
+}
+/*---------------------------------------------------------------------------*/
+static void report(struct worker *workers, uint64_t elapsed)
+{
+    const struct bench_conf *c = &g_conf;
+    static struct hist all;
+    uint64_t done = 0, misses = 0, errors = 0;
+    double secs = elapsed / 1e9;
+    int i;
+
+    for (i = 0; i < c->threads; i++)
+    {
+        hist_merge(&all, &workers[i].hist);
+        done += workers[i].done;
+        misses += workers[i].misses;
+        errors += workers[i].errors;
+    }
+
+    printf("%s loop", c->rate > 0 ? "open" : "closed");
+    if (c->rate > 0)
+    {
+        printf(" at %.0f req/s", c->rate);
+    }
+    printf(", %d threads, %d connections, depth %d\n",
+           c->threads, c->conns, c->depth);
+    printf("%ld keys, %s", c->keys,
+           c->dist == DIST_ZIPF ? "zipf" :
+           c->dist == DIST_HOTSPOT ? "hotspot" : "uniform");
+    if (c->dist == DIST_ZIPF)
+    {
+        printf(" %.2f", c->theta);
+    }
+    else if (c->dist == DIST_HOTSPOT)
+    {
+        printf(" %.2f of requests to %.2f of keys", c->hot_ops, c->hot_keys);
+    }
+    printf(", %d%% reads, values %zu-%zu bytes\n",
+           c->reads, c->value_min, c->value_max);
+    printf("%.2f s, %lu requests, %.1f req/s, %lu misses, %lu errors\n",
+           secs, done, secs > 0 ? done / secs : 0.0, misses, errors);
+    printf("latency (us): mean %.1f, p50 %.1f, p90 %.1f, p99 %.1f, "
+           "p99.9 %.1f, p99.99 %.1f, max %.1f\n",
+           all.count ? all.sum / 1e3 / all.count : 0.0,
+           hist_quantile(&all, 0.5) / 1e3, hist_quantile(&all, 0.9) / 1e3,
+           hist_quantile(&all, 0.99) / 1e3, hist_quantile(&all, 0.999) / 1e3,
+           hist_quantile(&all, 0.9999) / 1e3, all.max / 1e3);
+}
+/*---------------------------------------------------------------------------*/
+int main(int argc, char *argv[])
+{
+    struct bench_conf *c = &g_conf;
+    struct worker *workers;
+    struct conn *conns;
+    char port_str[6], *p;
+    uint64_t measured;
+    int opt, i, j, fd, ret = EXIT_SUCCESS;
+    size_t k;
+
+    c->host = DEFAULT_LOOPBACK_IP;
+    snprintf(port_str, sizeof(port_str), "%d", DEFAULT_PORT);
+    c->port = port_str;
+    c->threads = BENCH_DEFAULT_THREADS;
+    c->conns = BENCH_DEFAULT_CONNS;
+    c->depth = BENCH_DEFAULT_DEPTH;
+    c->keys = BENCH_DEFAULT_KEYS;
+    c->reads = BENCH_DEFAULT_READS;
+    c->value_min = c->value_max = BENCH_DEFAULT_VALUE;
+    c->duration = BENCH_DEFAULT_DURATION;
+    c->dist = DIST_UNIFORM;
+    c->theta = BENCH_DEFAULT_THETA;
+    c->hot_ops = BENCH_DEFAULT_HOT_OPS;
+    c->hot_keys = BENCH_DEFAULT_HOT_KEYS;
+
+    while ((opt = getopt(argc, argv, "i:p:t:c:d:k:D:r:v:T:w:R:Ph")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i':
+            c->host = optarg;
+            break;
+        case 'p':
+            c->port = optarg;
+            break;
+        case 't':
+            c->threads = atoi(optarg);
+            break;
+        case 'c':
+            c->conns = atoi(optarg);
+            break;
+        case 'd':
+            c->depth = atoi(optarg);
+            break;
+        case 'k':
+            c->keys = atol(optarg);
+            break;
+        case 'D':
+            if (parse_dist(optarg, c) < 0)
+            {
+                fprintf(stderr, "Invalid key distribution\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'r':
+            c->reads = atoi(optarg);
+            break;
+        case 'v':
+            c->value_min = c->value_max = strtoul(optarg, &p, 10);
+            if (*p == ':')
+            {
+                c->value_max = strtoul(p + 1, NULL, 10);
+            }
+            break;
+        case 'T':
+            c->duration = atof(optarg);
+            break;
+        case 'w':
+            c->warmup = atof(optarg);
+            break;
+        case 'R':
+            c->rate = atof(optarg);
+            break;
+        case 'P':
+            c->preload = 1;
+            break;
+        case 'h':
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (c->threads <= 0 || c->conns < c->threads || c->depth <= 0 ||
+        c->keys <= 0 || c->reads < 0 || c->reads > 100 ||
+        c->value_min == 0 || c->value_max < c->value_min ||
+        c->value_max > MAX_VALUE_SIZE || c->duration <= 0 ||
+        c->warmup < 0 || c->rate < 0)
+    {
+        fprintf(stderr, "Invalid options, or fewer connections "
+                        "than threads\n");
+        usage(argv[0]);
+    }
+
+    g_value = malloc(c->value_max);
+    workers = calloc(c->threads, sizeof(*workers));
+    conns = calloc(c->conns, sizeof(*conns));
+    if (g_value == NULL || workers == NULL || conns == NULL)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+    for (k = 0; k < c->value_max; k++)
+    {
+        g_value[k] = 'a' + k % 26;
+    }
+    if (c->dist == DIST_ZIPF)
+    {
+        zipf_init(&g_zipf, c->keys, c->theta);
+    }
+
+    /* connections are dealt out to the threads in turn */
+    for (i = 0; i < c->conns; i++)
+    {
+        conns[i].fd = bench_connect();
+        conns[i].sent_at = calloc(c->depth, sizeof(uint64_t));
+        if (conns[i].fd < 0 || conns[i].sent_at == NULL)
+        {
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (i = 0, j = 0; i < c->threads; i++)
+    {
+        workers[i].id = i;
+        workers[i].rng = 0x9e3779b97f4a7c15ull * (i + 1) ^ now_ns();
+        workers[i].conns = conns + j;
+        workers[i].nconns = c->conns / c->threads +
+                            (i < c->conns % c->threads);
+        j += workers[i].nconns;
+    }
+
+    if (c->preload)
+    {
+        atomic_init(&g_preload_next, 0);
+        for (i = 0; i < c->threads; i++)
+        {
+            pthread_create(&workers[i].tid, NULL, preload_main, &workers[i]);
+        }
+        for (i = 0; i < c->threads; i++)
+        {
+            pthread_join(workers[i].tid, NULL);
+            if (workers[i].failed)
+            {
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    for (i = 0; i < c->conns; i++)
+    {
+        fd = conns[i].fd;
+        if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0)
+        {
+            perror("fcntl");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (c->rate > 0)
+    {
+        /* every connection takes an even share of the rate */
+        g_interval = (uint64_t)(1e9 * c->conns / c->rate);
+        if (g_interval == 0)
+        {
+            g_interval = 1;
+        }
+    }
+    g_start = now_ns();
+    g_measure = g_start + (uint64_t)(c->warmup * 1e9);
+    g_end = g_measure + (uint64_t)(c->duration * 1e9);
+
+    for (i = 0; i < c->threads; i++)
+    {
+        workers[i].epfd = epoll_create1(0);
+        workers[i].timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (workers[i].epfd < 0 || workers[i].timerfd < 0)
+        {
+            perror("epoll_create1");
+            exit(EXIT_FAILURE);
+        }
+        pthread_create(&workers[i].tid, NULL, worker_main, &workers[i]);
+    }
+    for (i = 0; i < c->threads; i++)
+    {
+        pthread_join(workers[i].tid, NULL);
+        if (workers[i].failed)
+        {
+            ret = EXIT_FAILURE;
+        }
+        close(workers[i].epfd);
+        close(workers[i].timerfd);
+    }
+    measured = now_ns();
+    measured = (measured < g_end ? measured : g_end) - g_measure;
+
+    report(workers, measured);
+
+    for (i = 0; i < c->conns; i++)
+    {
+        close(conns[i].fd);
+        free(conns[i].sent_at);
+        free(conns[i].wbuf);
+        free(conns[i].rbuf);
+    }
+    free(conns);
+    free(workers);
+    free(g_value);
+
+    return ret;
+}
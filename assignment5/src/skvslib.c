@@ -2,6 +2,12 @@
 /* skvslib.c                                                                 */
 /* Author: Junghan Yoon, KyoungSoo Park                                      */
 /*---------------------------------------------------------------------------*/
+#include <unistd.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <sys/wait.h>
+#include <sys/eventfd.h>
+#include <arpa/inet.h>
 #include "skvslib.h"
 /*---------------------------------------------------------------------------*/
 /* response messages and commands */
@@ -12,133 +18,1844 @@ const char *g_msgs[MSG_COUNT] = {
     "NOT FOUND",
     "UPDATE OK",
     "DELETE OK",
-    "INTERNAL ERR"};
+    "INTERNAL ERR",
+    "SNAPSHOT STARTED",
+    "SNAPSHOT IN PROGRESS",
+    "EXPIRE OK",
+    "HOT OK",
+    "CAS OK",
+    "VERSION MISMATCH",
+    "NOT A NUMBER",
+    "OUT OF RANGE"};
 const char *g_cmds[CMD_COUNT] = {
     "CREATE",
     "READ",
     "UPDATE",
-    "DELETE"};
+    "DELETE",
+    "MCREATE",
+    "MREAD",
+    "MDELETE",
+    "SNAPSHOT",
+    "EXPIRE",
+    "HOT",
+    "STATS",
+    "LOCKS",
+    "SCAN",
+    "PREFIX",
+    "GETS",
+    "CAS",
+    "INCR",
+    "DECR"};
+/* the binary status of each response message */
+const uint8_t g_bin_status[MSG_COUNT] = {
+    BIN_INVALID,
+    BIN_OK,
+    BIN_COLLISION,
+    BIN_NOT_FOUND,
+    BIN_OK,
+    BIN_OK,
+    BIN_INTERNAL_ERR,
+    BIN_OK,
+    BIN_BUSY,
+    BIN_OK,
+    BIN_OK,
+    BIN_OK,
+    BIN_COLLISION,
+    BIN_INVALID,
+    BIN_INVALID};
 // const char *g_crlf = "\r\n";
 const char *g_crlf = "\n";
+/* counters of the threads that are not workers */
+static struct skvs_stats g_stats_shared;
+/* counters of the calling thread, see skvs_worker_init() */
+static _Thread_local struct skvs_stats *t_stats = &g_stats_shared;
+/* waiter of the calling worker, NULL for a thread that waits in place */
+static _Thread_local struct skvs_waiter *t_waiter;
 /*---------------------------------------------------------------------------*/
+/* adds n to a counter of the calling thread, which no other one writes */
+static inline void skvs_count(uint64_t *counter, uint64_t n)
+{
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * parses a request line into a command and its arguments.
+ * for single-key commands, args holds the key and then the value, and
+ * for CREATE and UPDATE, the ttl if any. for EXPIRE, it holds the key
+ * and the ttl, and for HOT, the key and the flag if any.
+ * for MCREATE, args holds key-value pairs, and for MREAD and MDELETE, keys.
+ */
 static inline enum CMD
-skvs_parse(char *buffer, size_t len, const char **key, const char **value)
+skvs_parse(char *line, const char **args, int *nargs)
+{
+    TRACE_PRINT();
+    char *cmd, *saveptr, *tok;
+    int i, n;
+
+    cmd = strtok_r(line, " ", &saveptr);
+    if (cmd == NULL)
+    {
+        /* no command found */
+        return CMD_INVALID;
+    }
+
+    /* convert command to uppercase for case-insensitive comparison */
+    for (i = 0; cmd[i]; i++)
+    {
+        cmd[i] = toupper(cmd[i]);
+    }
+
+    for (i = 0; i < CMD_COUNT; i++)
+    {
+        if (strcmp(cmd, g_cmds[i]) == 0)
+        {
+            break;
+        }
+    }
+    if (i == CMD_COUNT)
+    {
+        /* command not recognized */
+        return CMD_INVALID;
+    }
+
+    n = 0;
+    while ((tok = strtok_r(NULL, " ", &saveptr)) != NULL)
+    {
+        if (n == MAX_MULTI_KEYS * 2)
+        {
+            /* too many tokens */
+            return CMD_INVALID;
+        }
+        args[n++] = tok;
+    }
+    *nargs = n;
+
+    switch (i)
+    {
+    case CMD_READ:
+    case CMD_DELETE:
+        /* READ or DELETE should have a key and no value */
+        if (n != 1)
+        {
+            return CMD_INVALID;
+        }
+        break;
+    case CMD_CREATE:
+    case CMD_UPDATE:
+        /* CREATE or UPDATE must have a key and a value, and may have a ttl */
+        if (n != 2 && n != 3)
+        {
+            return CMD_INVALID;
+        }
+        break;
+    case CMD_EXPIRE:
+        if (n != 2)
+        {
+            return CMD_INVALID;
+        }
+        break;
+    case CMD_HOT:
+        if (n != 1 && n != 2)
+        {
+            return CMD_INVALID;
+        }
+        break;
+    case CMD_MREAD:
+    case CMD_MDELETE:
+        if (n == 0 || n > MAX_MULTI_KEYS)
+        {
+            return CMD_INVALID;
+        }
+        break;
+    case CMD_MCREATE:
+        /* key-value pairs */
+        if (n == 0 || n % 2)
+        {
+            return CMD_INVALID;
+        }
+        break;
+    case CMD_SNAPSHOT:
+    case CMD_STATS:
+        if (n != 0)
+        {
+            return CMD_INVALID;
+        }
+        break;
+    case CMD_LOCKS:
+        if (n > 1)
+        {
+            return CMD_INVALID;
+        }
+        break;
+    case CMD_SCAN:
+        if (n != 2 && n != 3)
+        {
+            return CMD_INVALID;
+        }
+        break;
+    case CMD_PREFIX:
+        if (n == 0 || n > 3)
+        {
+            return CMD_INVALID;
+        }
+        break;
+    case CMD_GETS:
+        if (n != 1)
+        {
+            return CMD_INVALID;
+        }
+        break;
+    case CMD_CAS:
+        /* a key, the version it should have, and the new value */
+        if (n != 3)
+        {
+            return CMD_INVALID;
+        }
+        break;
+    case CMD_INCR:
+    case CMD_DECR:
+        if (n != 1 && n != 2)
+        {
+            return CMD_INVALID;
+        }
+        break;
+    }
+
+    /* check key lengths */
+    for (n = 0; n < *nargs; n++)
+    {
+        if (strlen(args[n]) > MAX_KEY_LEN)
+        {
+            /* too large key */
+            return CMD_INVALID;
+        }
+        if (i == CMD_CREATE || i == CMD_UPDATE || i == CMD_MCREATE)
+        {
+            /* skip value */
+            n++;
+        }
+        if (i == CMD_CAS)
+        {
+            /* the version and the value */
+            break;
+        }
+    }
+
+    /* return the corresponding command enum */
+    return i;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * parses len bytes at s as a decimal number up to max, as digits only.
+ * returns -1 when it is not one.
+ * returns 0 on success.
+ */
+static int skvs_parse_uint(const char *s, size_t len, uint64_t max,
+                           uint64_t *num)
+{
+    uint64_t v = 0;
+    size_t i;
+
+    if (len == 0)
+    {
+        return -1;
+    }
+    for (i = 0; i < len; i++)
+    {
+        if (!isdigit((unsigned char)s[i]) ||
+            v > (max - (s[i] - '0')) / 10)
+        {
+            return -1;
+        }
+        v = v * 10 + (s[i] - '0');
+    }
+    *num = v;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * parses a ttl of len bytes at s, in seconds, as digits only.
+ * returns -1 when it is not one.
+ * returns 0 on success.
+ */
+static int skvs_parse_ttl(const char *s, size_t len, uint32_t *ttl)
+{
+    uint64_t v;
+
+    if (skvs_parse_uint(s, len, UINT32_MAX, &v) < 0)
+    {
+        return -1;
+    }
+    *ttl = v;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* when a ttl given now runs out, or 0 for none */
+static inline uint64_t skvs_expire_at(uint32_t ttl)
+{
+    return ttl ? ttl_now() + (uint64_t)ttl * 1000 : 0;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * moves the fragments not sent yet to the front of the queue, with their
+ * binary headers, so that a session that never drains completely reuses
+ * the slots of what it sent instead of growing.
+ */
+static void skvs_compact(struct skvs_session *sess)
+{
+    uintptr_t old, end, base;
+    size_t shift;
+    int i, live = sess->iov_count - sess->iov_head;
+
+    if (sess->hdr)
+    {
+        old = (uintptr_t)&sess->hdr[sess->iov_head];
+        end = (uintptr_t)&sess->hdr[sess->iov_count];
+        shift = sess->iov_head * sizeof(*sess->hdr);
+        /* the queued headers move, maybe partly sent already */
+        for (i = sess->iov_head; i < sess->iov_count; i++)
+        {
+            base = (uintptr_t)sess->iov[i].iov_base;
+            if (base >= old && base < end)
+            {
+                sess->iov[i].iov_base = (char *)base - shift;
+            }
+        }
+        memmove(sess->hdr, &sess->hdr[sess->iov_head],
+                live * sizeof(*sess->hdr));
+    }
+    memmove(sess->iov, &sess->iov[sess->iov_head],
+            live * sizeof(*sess->iov));
+    memmove(sess->ref, &sess->ref[sess->iov_head],
+            live * sizeof(*sess->ref));
+    for (i = sess->hold_head; i < sess->hold_count; i++)
+    {
+        sess->hold[i].end -= sess->iov_head;
+    }
+    sess->iov_ready -= sess->iov_head;
+    sess->iov_head = 0;
+    sess->iov_count = live;
+}
+/*---------------------------------------------------------------------------*/
+/* makes room for one more response fragment */
+static int skvs_reserve(struct skvs_session *sess)
+{
+    struct iovec *iov;
+    value_t **refs;
+    struct skvs_bin_hdr *hdr;
+    uintptr_t old, end, base;
+    int cap, i;
+
+    if (sess->iov_count < sess->iov_cap)
+    {
+        return 0;
+    }
+    if (sess->iov_cap && sess->iov_head >= sess->iov_cap / 2)
+    {
+        /* at least half of it is sent, so moving the rest is amortized */
+        skvs_compact(sess);
+        return 0;
+    }
+
+    cap = sess->iov_cap ? sess->iov_cap * 2 : 16;
+    iov = realloc(sess->iov, cap * sizeof(*iov));
+    if (iov == NULL)
+    {
+        return -1;
+    }
+    sess->iov = iov;
+    refs = realloc(sess->ref, cap * sizeof(*refs));
+    if (refs == NULL)
+    {
+        return -1;
+    }
+    sess->ref = refs;
+
+    if (sess->proto == PROTO_BINARY)
+    {
+        old = (uintptr_t)sess->hdr;
+        end = old + sess->iov_cap * sizeof(*hdr);
+        hdr = realloc(sess->hdr, cap * sizeof(*hdr));
+        if (hdr == NULL)
+        {
+            return -1;
+        }
+        /* the queued headers moved, maybe partly sent already */
+        for (i = sess->iov_head; i < sess->iov_count; i++)
+        {
+            base = (uintptr_t)sess->iov[i].iov_base;
+            if (base >= old && base < end)
+            {
+                sess->iov[i].iov_base = (char *)hdr + (base - old);
+            }
+        }
+        sess->hdr = hdr;
+    }
+    sess->iov_cap = cap;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* appends a response fragment, ref is released once the fragment is sent */
+static int
+skvs_queue(struct skvs_session *sess, const void *buf, size_t len,
+           value_t *ref)
+{
+    if (skvs_reserve(sess) < 0)
+    {
+        return -1;
+    }
+
+    sess->iov[sess->iov_count].iov_base = (void *)buf;
+    sess->iov[sess->iov_count].iov_len = len;
+    sess->ref[sess->iov_count] = ref;
+    sess->iov_count++;
+    sess->pending += len;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * queues the header of a binary response to the request being served,
+ * followed by value_len bytes the caller queues next.
+ */
+static int
+skvs_queue_hdr(struct skvs_session *sess, uint8_t status, size_t value_len)
+{
+    struct skvs_bin_hdr *hdr;
+
+    if (skvs_reserve(sess) < 0)
+    {
+        return -1;
+    }
+    hdr = &sess->hdr[sess->iov_count];
+    hdr->magic = SKVS_BIN_RES;
+    hdr->opcode = sess->req.opcode;
+    hdr->key_len = 0;
+    hdr->status = status;
+    hdr->value_len = htonl(value_len);
+    hdr->req_id = sess->req.req_id; // still in network byte order
+
+    return skvs_queue(sess, hdr, sizeof(*hdr), NULL);
+}
+/*---------------------------------------------------------------------------*/
+/* queues a fixed response, followed by a line feed in text */
+static int
+skvs_respond(struct skvs_session *sess, enum MSG msg)
+{
+    if (sess->proto == PROTO_BINARY)
+    {
+        return skvs_queue_hdr(sess, g_bin_status[msg], 0);
+    }
+    if (skvs_queue(sess, g_msgs[msg], strlen(g_msgs[msg]), NULL) < 0)
+    {
+        return -1;
+    }
+
+    return skvs_queue(sess, g_crlf, strlen(g_crlf), NULL);
+}
+/*---------------------------------------------------------------------------*/
+/* queues the response of a single-key command from its return value */
+static int
+skvs_respond_ret(struct skvs_session *sess, int ret, enum MSG ok, enum MSG no)
+{
+    if (ret > 0)
+    {
+        return skvs_respond(sess, ok);
+    }
+    else if (ret == 0)
+    {
+        return skvs_respond(sess, no);
+    }
+
+    return skvs_respond(sess, MSG_INTERNAL_ERR);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * queues the response of a read from its return value.
+ * the found value is sent straight from the table without a copy,
+ * and the session keeps the reference until it is written out.
+ */
+static int
+skvs_respond_value(struct skvs_session *sess, int ret, value_t *value)
+{
+    if (ret > 0)
+    {
+        if ((sess->proto == PROTO_BINARY &&
+             skvs_queue_hdr(sess, BIN_OK, value->len) < 0) ||
+            skvs_queue(sess, value->data, value->len, value) < 0)
+        {
+            value_put(value);
+            return -1;
+        }
+        if (sess->proto == PROTO_BINARY)
+        {
+            return 0;
+        }
+        return skvs_queue(sess, g_crlf, strlen(g_crlf), NULL);
+    }
+
+    return skvs_respond_ret(sess, ret, MSG_INTERNAL_ERR, MSG_NOT_FOUND);
+}
+/*---------------------------------------------------------------------------*/
+/* counts a READ of a key, or of one of MREAD, by what it found */
+static inline void skvs_count_read(int ret)
+{
+    if (ret > 0)
+    {
+        skvs_count(&t_stats->read_hits, 1);
+    }
+    else if (ret == 0)
+    {
+        skvs_count(&t_stats->read_misses, 1);
+    }
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * inserts or updates key with a value built by the caller, and queues
+ * the response. the caller's reference to value is consumed either way.
+ * returns -1 when the response cannot be queued.
+ */
+static int
+skvs_store(struct skvs_ctx *ctx, struct skvs_session *sess, enum CMD cmd,
+           const char *key, value_t *value)
+{
+    int ret;
+
+    if (cmd == CMD_CREATE)
+    {
+        ret = hash_insert_value(ctx->table, key, value);
+    }
+    else
+    {
+        ret = hash_update_value(ctx->table, key, value);
+    }
+    if (ret <= 0)
+    {
+        value_put(value);
+    }
+
+    return cmd == CMD_CREATE ?
+           skvs_respond_ret(sess, ret, MSG_CREATE_OK, MSG_COLLISION) :
+           skvs_respond_ret(sess, ret, MSG_UPDATE_OK, MSG_NOT_FOUND);
+}
+/*---------------------------------------------------------------------------*/
+/* appends a "STAT name value" line to buf, as far as it has room */
+static void
+skvs_stat(char *buf, size_t size, size_t *len, const char *name,
+          const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    if (*len >= size)
+    {
+        return;
+    }
+    n = snprintf(buf + *len, size - *len, "STAT %s ", name);
+    if (n > 0)
+    {
+        *len += n;
+    }
+    if (*len >= size)
+    {
+        return;
+    }
+    va_start(ap, fmt);
+    n = vsnprintf(buf + *len, size - *len, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+    {
+        *len += n;
+    }
+    if (*len < size)
+    {
+        buf[(*len)++] = '\n';
+    }
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * queues the response of STATS: the counters of every thread summed as
+ * they are read, and the figures of the table.
+ * returns -1 when the response cannot be queued.
+ */
+static int skvs_respond_stats(struct skvs_ctx *ctx, struct skvs_session *sess)
+{
+    struct skvs_stats sum, *st;
+    char buf[BUFFER_SIZE], name[MAX_KEY_LEN + 1];
+    hash_stats_t table;
+    value_t *value;
+    size_t len = 0, n, j;
+    int i;
+
+    memset(&sum, 0, sizeof(sum));
+    for (i = 0; i <= ctx->num_workers; i++)
+    {
+        st = i < ctx->num_workers ? &ctx->stats[i] : &g_stats_shared;
+        for (j = 0; j < CMD_COUNT; j++)
+        {
+            sum.cmds[j] += __atomic_load_n(&st->cmds[j], __ATOMIC_RELAXED);
+        }
+        sum.read_hits += __atomic_load_n(&st->read_hits, __ATOMIC_RELAXED);
+        sum.read_misses += __atomic_load_n(&st->read_misses,
+                                           __ATOMIC_RELAXED);
+        sum.bytes_in += __atomic_load_n(&st->bytes_in, __ATOMIC_RELAXED);
+        sum.bytes_out += __atomic_load_n(&st->bytes_out, __ATOMIC_RELAXED);
+        sum.conns += __atomic_load_n(&st->conns, __ATOMIC_RELAXED);
+        sum.total_conns += __atomic_load_n(&st->total_conns,
+                                           __ATOMIC_RELAXED);
+        sum.lock_wait.count += __atomic_load_n(&st->lock_wait.count,
+                                               __ATOMIC_RELAXED);
+        sum.lock_wait.ns += __atomic_load_n(&st->lock_wait.ns,
+                                            __ATOMIC_RELAXED);
+    }
+    hash_chain_stats(ctx->table, &table);
+
+    skvs_stat(buf, sizeof(buf), &len, "uptime", "%ld",
+              (long)(time(NULL) - ctx->start_time));
+    skvs_stat(buf, sizeof(buf), &len, "threads", "%d", ctx->num_workers);
+    skvs_stat(buf, sizeof(buf), &len, "curr_connections", "%ld",
+              (long)sum.conns);
+    skvs_stat(buf, sizeof(buf), &len, "total_connections", "%lu",
+              sum.total_conns);
+    for (j = 0; j < CMD_COUNT; j++)
+    {
+        n = snprintf(name, sizeof(name), "cmd_%s", g_cmds[j]);
+        while (n-- > 4)
+        {
+            name[n] = tolower((unsigned char)name[n]);
+        }
+        skvs_stat(buf, sizeof(buf), &len, name, "%lu", sum.cmds[j]);
+    }
+    skvs_stat(buf, sizeof(buf), &len, "read_hits", "%lu", sum.read_hits);
+    skvs_stat(buf, sizeof(buf), &len, "read_misses", "%lu", sum.read_misses);
+    skvs_stat(buf, sizeof(buf), &len, "read_hit_ratio", "%.4f",
+              sum.read_hits + sum.read_misses ?
+              (double)sum.read_hits / (sum.read_hits + sum.read_misses) : 0);
+    skvs_stat(buf, sizeof(buf), &len, "bytes_read", "%lu", sum.bytes_in);
+    skvs_stat(buf, sizeof(buf), &len, "bytes_written", "%lu", sum.bytes_out);
+    skvs_stat(buf, sizeof(buf), &len, "curr_items", "%zu", table.entries);
+    skvs_stat(buf, sizeof(buf), &len, "bytes", "%zu", table.bytes);
+    skvs_stat(buf, sizeof(buf), &len, "limit_maxbytes", "%zu",
+              ctx->table->mem_limit);
+    skvs_stat(buf, sizeof(buf), &len, "evictions", "%zu", table.evictions);
+    skvs_stat(buf, sizeof(buf), &len, "buckets", "%zu", table.buckets);
+    skvs_stat(buf, sizeof(buf), &len, "used_buckets", "%zu",
+              table.used_buckets);
+    skvs_stat(buf, sizeof(buf), &len, "max_chain", "%zu", table.max_chain);
+    skvs_stat(buf, sizeof(buf), &len, "mean_chain", "%.2f",
+              table.mean_chain);
+    for (j = 0; j < HASH_CHAIN_HIST; j++)
+    {
+        snprintf(name, sizeof(name), "chain_%zu%s", j,
+                 j == HASH_CHAIN_HIST - 1 ? "_up" : "");
+        skvs_stat(buf, sizeof(buf), &len, name, "%zu", table.chains[j]);
+    }
+    skvs_stat(buf, sizeof(buf), &len, "lock_waits", "%lu",
+              sum.lock_wait.count);
+    skvs_stat(buf, sizeof(buf), &len, "lock_wait_us", "%lu",
+              sum.lock_wait.ns / 1000);
+    if (len + sizeof("END") > sizeof(buf))
+    {
+        return skvs_respond(sess, MSG_INTERNAL_ERR);
+    }
+    memcpy(buf + len, "END", 3);
+    len += 3;
+
+    /* the text ends with the line feed any response line does */
+    value = value_new(buf, len);
+    if (value == NULL)
+    {
+        return skvs_respond(sess, MSG_INTERNAL_ERR);
+    }
+
+    return skvs_respond_value(sess, 1, value);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * queues the response of LOCKS for the n stripes waited for the longest,
+ * given in decimal in the len bytes at arg, or SKVS_LOCKS_TOP with none.
+ * returns -1 when the response cannot be queued.
+ */
+static int
+skvs_respond_locks(struct skvs_ctx *ctx, struct skvs_session *sess,
+                   const char *arg, size_t arg_len)
+{
+    char buf[BUFFER_SIZE];
+    value_t *value;
+    uint64_t n = SKVS_LOCKS_TOP;
+    size_t len = 0;
+
+    if (arg_len && skvs_parse_uint(arg, arg_len, SKVS_LOCKS_MAX, &n) < 0)
+    {
+        return skvs_respond(sess, MSG_INVALID);
+    }
+    if (skvs_lock_report(ctx, n, buf, sizeof(buf) - sizeof("END"),
+                         &len) < 0)
+    {
+        return skvs_respond(sess, MSG_INVALID);
+    }
+    memcpy(buf + len, "END", 3);
+    len += 3;
+
+    value = value_new(buf, len);
+    if (value == NULL)
+    {
+        return skvs_respond(sess, MSG_INTERNAL_ERR);
+    }
+
+    return skvs_respond_value(sess, 1, value);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * queues a line of text, copied into a value the session keeps until the
+ * line is sent.
+ * returns -1 when the response cannot be queued.
+ */
+static int skvs_respond_text(struct skvs_session *sess, const char *text)
+{
+    value_t *value;
+
+    value = value_new(text, strlen(text));
+    if (value == NULL)
+    {
+        return skvs_respond(sess, MSG_INTERNAL_ERR);
+    }
+
+    return skvs_respond_value(sess, 1, value);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * queues a line of head, a space and then value as a READ sends it. the
+ * reference to value is consumed either way.
+ * returns -1 when the response cannot be queued.
+ */
+static int
+skvs_respond_pair(struct skvs_session *sess, const char *head,
+                  value_t *value)
+{
+    value_t *text;
+
+    text = value_alloc(strlen(head) + 1);
+    if (text == NULL)
+    {
+        value_put(value);
+        return -1;
+    }
+    memcpy(text->data, head, text->len - 1);
+    text->data[text->len - 1] = ' ';
+    if (skvs_queue(sess, text->data, text->len, text) < 0)
+    {
+        value_put(text);
+        value_put(value);
+        return -1;
+    }
+
+    return skvs_respond_value(sess, 1, value);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * queues the response of SCAN or PREFIX, for the keys from from on,
+ * below to unless it is NULL, and starting with prefix unless it is NULL.
+ * count is the decimal count of the request, or NULL for the default.
+ * returns -1 when the response cannot be queued.
+ */
+static int
+skvs_respond_scan(struct skvs_ctx *ctx, struct skvs_session *sess,
+                  const char *from, const char *to, const char *prefix,
+                  const char *count)
+{
+    char keys[MAX_MULTI_KEYS][MAX_KEY_LEN + 1], next[MAX_KEY_LEN + 1];
+    char line[MAX_KEY_LEN + sizeof("NEXT ")];
+    value_t *values[MAX_MULTI_KEYS];
+    uint64_t n = SKVS_SCAN_COUNT;
+    int found, i;
+
+    if (count && (skvs_parse_uint(count, strlen(count), MAX_MULTI_KEYS,
+                                  &n) < 0 || n == 0))
+    {
+        return skvs_respond(sess, MSG_INVALID);
+    }
+    found = hash_scan(ctx->table, from, to, prefix, n, keys, values, next);
+    if (found < 0)
+    {
+        return skvs_respond(sess, MSG_INVALID);
+    }
+
+    for (i = 0; i < found; i++)
+    {
+        skvs_count_read(1);
+        if (skvs_respond_pair(sess, keys[i], values[i]) < 0)
+        {
+            /* release the values not queued yet */
+            while (++i < found)
+            {
+                value_put(values[i]);
+            }
+            return -1;
+        }
+    }
+
+    if (next[0])
+    {
+        snprintf(line, sizeof(line), "NEXT %s", next);
+        return skvs_respond_text(sess, line);
+    }
+
+    return skvs_respond_text(sess, "END");
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * serves GETS, CAS, INCR or DECR of key, whose other arguments are args.
+ * returns -1 when the response cannot be queued.
+ */
+static int
+skvs_serve_versioned(struct skvs_ctx *ctx, struct skvs_session *sess,
+                     enum CMD cmd, const char *key, const char **args,
+                     int nargs)
+{
+    char num[sizeof("-9223372036854775808")];
+    uint64_t version, delta = 1;
+    value_t *value;
+    int64_t result;
+    int ret;
+
+    switch (cmd)
+    {
+    case CMD_GETS:
+        ret = hash_search(ctx->table, key, &value);
+        skvs_count_read(ret);
+        if (ret <= 0)
+        {
+            return skvs_respond_value(sess, ret, value);
+        }
+        snprintf(num, sizeof(num), "%llu", (unsigned long long)value->version);
+        return skvs_respond_pair(sess, num, value);
+    case CMD_CAS:
+        if (skvs_parse_uint(args[0], strlen(args[0]), UINT64_MAX,
+                            &version) < 0 ||
+            strlen(args[1]) > ctx->max_value)
+        {
+            return skvs_respond(sess, MSG_INVALID);
+        }
+        value = value_new(args[1], strlen(args[1]));
+        if (value == NULL)
+        {
+            return skvs_respond(sess, MSG_INTERNAL_ERR);
+        }
+        ret = hash_cas(ctx->table, key, version, value);
+        if (ret <= 0)
+        {
+            value_put(value);
+        }
+        if (ret == HASH_ERR_VERSION)
+        {
+            return skvs_respond(sess, MSG_CAS_MISMATCH);
+        }
+        return skvs_respond_ret(sess, ret, MSG_CAS_OK, MSG_NOT_FOUND);
+    default:
+        if (nargs == 1 &&
+            skvs_parse_uint(args[0], strlen(args[0]), INT64_MAX, &delta) < 0)
+        {
+            return skvs_respond(sess, MSG_INVALID);
+        }
+        ret = hash_incr(ctx->table, key,
+                        cmd == CMD_INCR ? (int64_t)delta : -(int64_t)delta,
+                        &result);
+        if (ret == HASH_ERR_NAN)
+        {
+            return skvs_respond(sess, MSG_NOT_NUMBER);
+        }
+        if (ret == HASH_ERR_RANGE)
+        {
+            return skvs_respond(sess, MSG_OUT_OF_RANGE);
+        }
+        if (ret <= 0)
+        {
+            return skvs_respond_ret(sess, ret, MSG_INTERNAL_ERR,
+                                    MSG_NOT_FOUND);
+        }
+        snprintf(num, sizeof(num), "%lld", (long long)result);
+        return skvs_respond_text(sess, num);
+    }
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * handles a single-key command, or SNAPSHOT, STATS or LOCKS, in either
+ * protocol.
+ * key is null-terminated, and the value is value_len bytes, if any, or
+ * the flag of a HOT, or the n of a LOCKS.
+ * ttl is that of a CREATE, UPDATE or EXPIRE, in seconds, or 0 for none.
+ * returns -1 when the response cannot be queued.
+ */
+static int
+skvs_exec(struct skvs_ctx *ctx, struct skvs_session *sess, enum CMD cmd,
+          const char *key, const char *value, size_t value_len, uint32_t ttl)
+{
+    TRACE_PRINT();
+    value_t *found, *v;
+    int ret;
+
+    if (cmd >= 0)
+    {
+        skvs_count(&t_stats->cmds[cmd], 1);
+    }
+    switch (cmd)
+    {
+    case CMD_CREATE:
+    case CMD_UPDATE:
+        if (value_len > ctx->max_value)
+        {
+            return skvs_respond(sess, MSG_INVALID);
+        }
+        /* copied before locking, to keep the copy out of the lock */
+        v = value_new(value, value_len);
+        if (v == NULL)
+        {
+            return skvs_respond(sess, MSG_INTERNAL_ERR);
+        }
+        v->expire_at = skvs_expire_at(ttl);
+        return skvs_store(ctx, sess, cmd, key, v);
+    case CMD_READ:
+        ret = hash_search(ctx->table, key, &found);
+        skvs_count_read(ret);
+        return skvs_respond_value(sess, ret, found);
+    case CMD_DELETE:
+        ret = hash_delete(ctx->table, key);
+        return skvs_respond_ret(sess, ret, MSG_DELETE_OK, MSG_NOT_FOUND);
+    case CMD_EXPIRE:
+        ret = hash_set_expiry(ctx->table, key, skvs_expire_at(ttl));
+        return skvs_respond_ret(sess, ret, MSG_EXPIRE_OK, MSG_NOT_FOUND);
+    case CMD_HOT:
+        if (value_len > 1 ||
+            (value_len == 1 && value[0] != '0' && value[0] != '1'))
+        {
+            return skvs_respond(sess, MSG_INVALID);
+        }
+        ret = hash_set_hot(ctx->table, key, value_len == 0 || value[0] == '1');
+        return skvs_respond_ret(sess, ret < 0 ? ret : 1, MSG_HOT_OK,
+                                MSG_INVALID);
+    case CMD_SNAPSHOT:
+        if (ctx->snap_path == NULL)
+        {
+            return skvs_respond(sess, MSG_INVALID);
+        }
+        ret = skvs_snapshot(ctx);
+        return skvs_respond_ret(sess, ret, MSG_SNAPSHOT_STARTED,
+                                MSG_SNAPSHOT_BUSY);
+    case CMD_STATS:
+        return skvs_respond_stats(ctx, sess);
+    case CMD_LOCKS:
+        return skvs_respond_locks(ctx, sess, value, value_len);
+    default:
+        return skvs_respond(sess, MSG_INVALID);
+    }
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * handles a single null-terminated request line without the line feed.
+ * returns -1 when the response cannot be queued.
+ */
+static int
+skvs_serve_line(struct skvs_ctx *ctx, struct skvs_session *sess, char *line)
+{
+    TRACE_PRINT();
+    const char *args[MAX_MULTI_KEYS * 2];
+    const char *keys[MAX_MULTI_KEYS];
+    const char *values[MAX_MULTI_KEYS];
+    value_t *found[MAX_MULTI_KEYS];
+    int results[MAX_MULTI_KEYS];
+    enum CMD cmd;
+    uint32_t ttl = 0;
+    int nargs = 0, n, i;
+
+    /* parse the command */
+    cmd = skvs_parse(line, args, &nargs);
+
+    /* handle request */
+    switch (cmd)
+    {
+    case CMD_CREATE:
+    case CMD_UPDATE:
+        if (nargs == 3 &&
+            (skvs_parse_ttl(args[2], strlen(args[2]), &ttl) < 0 || !ttl))
+        {
+            return skvs_respond(sess, MSG_INVALID);
+        }
+        return skvs_exec(ctx, sess, cmd, args[0], args[1], strlen(args[1]),
+                         ttl);
+    case CMD_READ:
+    case CMD_DELETE:
+        return skvs_exec(ctx, sess, cmd, args[0], NULL, 0, 0);
+    case CMD_EXPIRE:
+        if (skvs_parse_ttl(args[1], strlen(args[1]), &ttl) < 0)
+        {
+            return skvs_respond(sess, MSG_INVALID);
+        }
+        return skvs_exec(ctx, sess, cmd, args[0], NULL, 0, ttl);
+    case CMD_HOT:
+        return skvs_exec(ctx, sess, cmd, args[0], nargs == 2 ? args[1] : NULL,
+                         nargs == 2 ? strlen(args[1]) : 0, 0);
+    case CMD_LOCKS:
+        return skvs_exec(ctx, sess, cmd, NULL, nargs ? args[0] : NULL,
+                         nargs ? strlen(args[0]) : 0, 0);
+    case CMD_SCAN:
+        skvs_count(&t_stats->cmds[cmd], 1);
+        return skvs_respond_scan(ctx, sess, args[0], args[1], NULL,
+                                 nargs == 3 ? args[2] : NULL);
+    case CMD_PREFIX:
+        skvs_count(&t_stats->cmds[cmd], 1);
+        return skvs_respond_scan(ctx, sess, nargs == 3 ? args[2] : args[0],
+                                 NULL, args[0], nargs >= 2 ? args[1] : NULL);
+    case CMD_GETS:
+    case CMD_CAS:
+    case CMD_INCR:
+    case CMD_DECR:
+        skvs_count(&t_stats->cmds[cmd], 1);
+        return skvs_serve_versioned(ctx, sess, cmd, args[0], args + 1,
+                                    nargs - 1);
+    case CMD_MCREATE:
+        skvs_count(&t_stats->cmds[cmd], 1);
+        n = nargs / 2;
+        for (i = 0; i < n; i++)
+        {
+            keys[i] = args[2 * i];
+            values[i] = args[2 * i + 1];
+        }
+        hash_minsert(ctx->table, n, keys, values, results);
+        for (i = 0; i < n; i++)
+        {
+            if (skvs_respond_ret(sess, results[i], MSG_CREATE_OK,
+                                 MSG_COLLISION) < 0)
+            {
+                return -1;
+            }
+        }
+        return 0;
+    case CMD_MREAD:
+        skvs_count(&t_stats->cmds[cmd], 1);
+        hash_msearch(ctx->table, nargs, args, found, results);
+        for (i = 0; i < nargs; i++)
+        {
+            skvs_count_read(results[i]);
+            if (skvs_respond_value(sess, results[i], found[i]) < 0)
+            {
+                /* release the values not queued yet */
+                for (i++; i < nargs; i++)
+                {
+                    if (results[i] > 0)
+                    {
+                        value_put(found[i]);
+                    }
+                }
+                return -1;
+            }
+        }
+        return 0;
+    case CMD_MDELETE:
+        skvs_count(&t_stats->cmds[cmd], 1);
+        hash_mdelete(ctx->table, nargs, args, results);
+        for (i = 0; i < nargs; i++)
+        {
+            if (skvs_respond_ret(sess, results[i], MSG_DELETE_OK,
+                                 MSG_NOT_FOUND) < 0)
+            {
+                return -1;
+            }
+        }
+        return 0;
+    default:
+        return skvs_exec(ctx, sess, cmd, NULL, NULL, 0, 0);
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* bytes of ttl the value of a binary request starts with */
+static inline size_t skvs_bin_ttl_len(const struct skvs_bin_hdr *req)
+{
+    if (req->opcode == CMD_EXPIRE ||
+        ((req->opcode == CMD_CREATE || req->opcode == CMD_UPDATE) &&
+         (req->status & BIN_FLAG_TTL)))
+    {
+        return sizeof(uint32_t);
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * checks a binary request against its command, and copies its key out
+ * null-terminated, and its ttl, if any. payload holds at least the key
+ * and the ttl. the rest of the value is left where it is, after them.
+ * returns the command, or CMD_INVALID when the request is malformed.
+ */
+static enum CMD
+skvs_bin_parse(const struct skvs_bin_hdr *req, const char *payload,
+               char *key, uint32_t *ttl)
+{
+    size_t value_len = ntohl(req->value_len);
+    size_t ttl_len = skvs_bin_ttl_len(req);
+    uint32_t n;
+
+    if (req->key_len > MAX_KEY_LEN ||
+        memchr(payload, '\0', req->key_len) != NULL || value_len < ttl_len)
+    {
+        return CMD_INVALID;
+    }
+    memcpy(key, payload, req->key_len);
+    key[req->key_len] = '\0';
+    *ttl = 0;
+    if (ttl_len)
+    {
+        memcpy(&n, payload + req->key_len, sizeof(n));
+        *ttl = ntohl(n);
+    }
+    value_len -= ttl_len;
+
+    switch (req->opcode)
+    {
+    case CMD_CREATE:
+    case CMD_UPDATE:
+        return req->key_len && (!ttl_len || *ttl) ? req->opcode : CMD_INVALID;
+    case CMD_EXPIRE:
+        return req->key_len && !value_len ? req->opcode : CMD_INVALID;
+    case CMD_HOT:
+        return req->key_len && value_len <= 1 ? req->opcode : CMD_INVALID;
+    case CMD_READ:
+    case CMD_DELETE:
+        return req->key_len && !value_len ? req->opcode : CMD_INVALID;
+    case CMD_SNAPSHOT:
+    case CMD_STATS:
+        return !req->key_len && !value_len ? req->opcode : CMD_INVALID;
+    case CMD_LOCKS:
+        return !req->key_len ? req->opcode : CMD_INVALID;
+    default:
+        /* multi-key commands are pipelined single-key requests instead */
+        return CMD_INVALID;
+    }
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * serves a gathered text value, which may be followed by spaces and a
+ * ttl, as skvs_serve_line() would.
+ * returns -1 when the response cannot be queued.
+ */
+static int
+skvs_stream_text_finish(struct skvs_ctx *ctx, struct skvs_session *sess)
+{
+    struct skvs_stream *st = &sess->stream;
+    const char *end = st->buf + st->len, *p, *tok;
+    uint32_t ttl = 0;
+    size_t len;
+
+    p = memchr(st->buf, ' ', st->len);
+    len = p ? (size_t)(p - st->buf) : st->len;
+    if (p)
+    {
+        while (p < end && *p == ' ')
+        {
+            p++;
+        }
+        tok = p;
+        while (p < end && *p != ' ')
+        {
+            p++;
+        }
+        if (p > tok &&
+            (skvs_parse_ttl(tok, p - tok, &ttl) < 0 || !ttl))
+        {
+            return skvs_respond(sess, MSG_INVALID);
+        }
+        while (p < end && *p == ' ')
+        {
+            p++;
+        }
+        if (p < end)
+        {
+            /* more than a ttl */
+            return skvs_respond(sess, MSG_INVALID);
+        }
+    }
+
+    return skvs_exec(ctx, sess, st->cmd, st->key, st->buf, len, ttl);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * serves the request of the stream once its value is complete.
+ * returns -1 when the response cannot be queued.
+ */
+static int
+skvs_stream_finish(struct skvs_ctx *ctx, struct skvs_session *sess)
+{
+    struct skvs_stream *st = &sess->stream;
+    value_t *value = st->value;
+    int ret;
+
+    if (value == NULL)
+    {
+        /* text */
+        ret = skvs_stream_text_finish(ctx, sess);
+        free(st->buf);
+        st->buf = NULL;
+        return ret;
+    }
+    st->value = NULL;
+
+    return skvs_store(ctx, sess, st->cmd, st->key, value);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * starts gathering the value of a text request line too long for rbuf,
+ * given the len bytes of it in rbuf, if it is a CREATE or UPDATE.
+ * returns the length of the line before the value, which the caller
+ * consumes, or 0 when the line cannot be a valid request.
+ * returns -1 when any internal errors occur.
+ */
+static ssize_t
+skvs_stream_text(struct skvs_ctx *ctx, struct skvs_session *sess,
+                 const char *line, size_t len)
+{
+    struct skvs_stream *st = &sess->stream;
+    const char *p = line, *end = line + len, *key;
+    size_t n;
+    enum CMD cmd;
+
+    /* the command and the key, separated by spaces as strtok() would */
+    while (p < end && *p != ' ')
+    {
+        p++;
+    }
+    n = p - line;
+    if (n == strlen(g_cmds[CMD_CREATE]) &&
+        strncasecmp(line, g_cmds[CMD_CREATE], n) == 0)
+    {
+        cmd = CMD_CREATE;
+    }
+    else if (n == strlen(g_cmds[CMD_UPDATE]) &&
+             strncasecmp(line, g_cmds[CMD_UPDATE], n) == 0)
+    {
+        cmd = CMD_UPDATE;
+    }
+    else
+    {
+        return 0;
+    }
+    while (p < end && *p == ' ')
+    {
+        p++;
+    }
+    key = p;
+    while (p < end && *p != ' ')
+    {
+        p++;
+    }
+    n = p - key;
+    while (p < end && *p == ' ')
+    {
+        p++;
+    }
+    if (n == 0 || n > MAX_KEY_LEN || memchr(key, '\0', n) || p == end)
+    {
+        return 0;
+    }
+    /* past the bound of skvs_stream_text_more() already, ttl included */
+    if ((size_t)(end - p) > ctx->max_value + 1 + MAX_KEY_LEN)
+    {
+        return 0;
+    }
+
+    st->buf = malloc(BUFFER_SIZE);
+    if (st->buf == NULL)
+    {
+        return -1;
+    }
+    st->cap = BUFFER_SIZE;
+    st->len = 0;
+    st->cmd = cmd;
+    memcpy(st->key, key, n);
+    st->key[n] = '\0';
+
+    return p - line;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * appends the next of len bytes in rbuf to a text value being gathered,
+ * and serves the request at the line feed.
+ * returns -1 when any internal errors occur.
+ * returns the number of bytes consumed on success.
+ */
+static ssize_t
+skvs_stream_text_more(struct skvs_ctx *ctx, struct skvs_session *sess,
+                      const char *data, size_t len)
+{
+    struct skvs_stream *st = &sess->stream;
+    const char *eol;
+    size_t n, cap, limit;
+    char *buf;
+
+    /* with room for a ttl after the value */
+    limit = ctx->max_value + 1 + MAX_KEY_LEN;
+    eol = memchr(data, g_crlf[0], len);
+    n = eol ? (size_t)(eol - data) : len;
+    if (st->len + n > limit)
+    {
+        /* not a valid request after all, drop up to the line feed */
+        free(st->buf);
+        st->buf = NULL;
+        sess->skip = 1;
+        return skvs_respond(sess, MSG_INVALID) < 0 ? -1 : 0;
+    }
+
+    if (st->len + n > st->cap)
+    {
+        cap = st->cap * 2;
+        if (cap < st->len + n)
+        {
+            cap = st->len + n;
+        }
+        if (cap > limit)
+        {
+            cap = limit;
+        }
+        buf = realloc(st->buf, cap);
+        if (buf == NULL)
+        {
+            return -1;
+        }
+        st->buf = buf;
+        st->cap = cap;
+    }
+    memcpy(st->buf + st->len, data, n);
+    st->len += n;
+    if (eol == NULL)
+    {
+        return n;
+    }
+
+    return skvs_stream_finish(ctx, sess) < 0 ? -1 : (ssize_t)n + 1;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * starts receiving the value of a binary request too large for rbuf,
+ * given its header, and its key and ttl, if any, at payload.
+ * returns -1 when the response cannot be queued.
+ */
+static int
+skvs_stream_binary(struct skvs_ctx *ctx, struct skvs_session *sess,
+                   const char *payload)
+{
+    struct skvs_stream *st = &sess->stream;
+    size_t value_len = ntohl(sess->req.value_len);
+    uint32_t ttl;
+    enum CMD cmd;
+
+    /* the ttl was received with the key */
+    value_len -= skvs_bin_ttl_len(&sess->req);
+    cmd = skvs_bin_parse(&sess->req, payload, st->key, &ttl);
+    if ((cmd != CMD_CREATE && cmd != CMD_UPDATE) ||
+        value_len > ctx->max_value)
+    {
+        sess->discard = value_len;
+        return skvs_respond(sess, MSG_INVALID);
+    }
+
+    /* served apart from skvs_exec(), so counted here */
+    skvs_count(&t_stats->cmds[cmd], 1);
+    /* validated first, so that only a request to serve takes memory */
+    st->value = value_alloc(value_len);
+    if (st->value == NULL)
+    {
+        sess->discard = value_len;
+        return skvs_respond(sess, MSG_INTERNAL_ERR);
+    }
+    st->value->expire_at = skvs_expire_at(ttl);
+    st->cmd = cmd;
+    st->len = 0;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* skvs_serve() for a text session */
+static ssize_t
+skvs_serve_text(struct skvs_ctx *ctx, struct skvs_session *sess,
+                char *rbuf, size_t rlen)
+{
+    char *line, *eol;
+    size_t consumed = 0, linelen;
+    ssize_t n;
+
+    while (consumed < rlen && !sess->close)
+    {
+        if (sess->stream.buf)
+        {
+            /* more of a large value */
+            n = skvs_stream_text_more(ctx, sess, rbuf + consumed,
+                                      rlen - consumed);
+            if (n < 0)
+            {
+                return -1;
+            }
+            consumed += n;
+            continue;
+        }
+
+        line = rbuf + consumed;
+        eol = memchr(line, g_crlf[0], rlen - consumed);
+        if (eol == NULL)
+        {
+            if (rlen - consumed < BUFFER_SIZE)
+            {
+                /* incomplete request, wait for the rest of the line */
+                break;
+            }
+
+            if (!sess->skip)
+            {
+                /* the value of a large CREATE or UPDATE is gathered */
+                n = skvs_stream_text(ctx, sess, line, rlen - consumed);
+                if (n < 0)
+                {
+                    return -1;
+                }
+                if (n > 0)
+                {
+                    consumed += n;
+                    continue;
+                }
+            }
+
+            /* too large message, drop it up to the next line feed */
+            if (!sess->skip && skvs_respond(sess, MSG_INVALID) < 0)
+            {
+                return -1;
+            }
+            sess->skip = 1;
+            consumed = rlen;
+            break;
+        }
+        linelen = eol - line;
+        consumed += linelen + 1;
+
+        if (sess->skip)
+        {
+            /* tail of a too large message */
+            sess->skip = 0;
+            continue;
+        }
+        if (linelen == 0)
+        {
+            /* an empty line closes the connection */
+            sess->close = 1;
+            break;
+        }
+
+        *eol = '\0';
+        if (skvs_serve_line(ctx, sess, line) < 0)
+        {
+            return -1;
+        }
+    }
+
+    return consumed;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * skvs_serve() for a binary session. requests are served straight out of
+ * rbuf: only the header and the short key are copied, and the value goes
+ * from rbuf to the table in one copy.
+ */
+static ssize_t
+skvs_serve_binary(struct skvs_ctx *ctx, struct skvs_session *sess,
+                  char *rbuf, size_t rlen)
+{
+    struct skvs_bin_hdr *req = &sess->req;
+    char key[MAX_KEY_LEN + 1];
+    const char *payload;
+    size_t consumed = 0, len, frame, head;
+    uint32_t ttl;
+    enum CMD cmd;
+
+    while (consumed < rlen && !sess->close)
+    {
+        if (sess->stream.value)
+        {
+            /* more of a large value */
+            len = rlen - consumed;
+            if (len > sess->stream.value->len - sess->stream.len)
+            {
+                len = sess->stream.value->len - sess->stream.len;
+            }
+            memcpy(sess->stream.value->data + sess->stream.len,
+                   rbuf + consumed, len);
+            sess->stream.len += len;
+            consumed += len;
+            if (sess->stream.len == sess->stream.value->len &&
+                skvs_stream_finish(ctx, sess) < 0)
+            {
+                return -1;
+            }
+            continue;
+        }
+        if (sess->discard)
+        {
+            /* rest of a too large request */
+            len = rlen - consumed;
+            if (len > sess->discard)
+            {
+                len = sess->discard;
+            }
+            sess->discard -= len;
+            consumed += len;
+            continue;
+        }
+        if (rlen - consumed < sizeof(*req))
+        {
+            break;
+        }
+
+        /* copied, since rbuf may leave the integers unaligned */
+        memcpy(req, rbuf + consumed, sizeof(*req));
+        if (req->magic != SKVS_BIN_REQ)
+        {
+            /* lost track of where requests start, so give up */
+            if (skvs_respond(sess, MSG_INVALID) < 0)
+            {
+                return -1;
+            }
+            sess->close = 1;
+            break;
+        }
+        frame = sizeof(*req) + req->key_len + (size_t)ntohl(req->value_len);
+        if (frame > BUFFER_SIZE)
+        {
+            /* it would never fit in rbuf, so its value is received apart */
+            head = sizeof(*req) + req->key_len + skvs_bin_ttl_len(req);
+            if (rlen - consumed < head)
+            {
+                break;
+            }
+            payload = rbuf + consumed + sizeof(*req);
+            consumed += head;
+            if (skvs_stream_binary(ctx, sess, payload) < 0)
+            {
+                return -1;
+            }
+            continue;
+        }
+        if (rlen - consumed < frame)
+        {
+            /* incomplete request, wait for the rest */
+            break;
+        }
+        payload = rbuf + consumed + sizeof(*req);
+        consumed += frame;
+
+        cmd = skvs_bin_parse(req, payload, key, &ttl);
+        len = skvs_bin_ttl_len(req);
+        if (skvs_exec(ctx, sess, cmd, key, payload + req->key_len + len,
+                      ntohl(req->value_len) - len, ttl) < 0)
+        {
+            return -1;
+        }
+    }
+
+    return consumed;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * appends a change of the table to the log, under its stripe lock.
+ * the value of an expiry record is the expiry itself.
+ */
+static void
+skvs_log(void *arg, int op, const char *key, const value_t *value)
+{
+    uint64_t expire_at;
+
+    if (op == HASH_OP_EXPIRE)
+    {
+        expire_at = __atomic_load_n(&value->expire_at, __ATOMIC_RELAXED);
+        wal_append(arg, op, key, strlen(key), (const char *)&expire_at,
+                   sizeof(expire_at));
+        return;
+    }
+    wal_append(arg, op, key, strlen(key), value ? value->data : NULL,
+               value ? value->len : 0);
+}
+/*---------------------------------------------------------------------------*/
+/* wakes the workers waiting for the log up to lsn, from the flusher */
+static void skvs_wake(void *arg, uint64_t lsn)
+{
+    struct skvs_ctx *ctx = arg;
+    struct skvs_waiter *w;
+    uint64_t want, one = 1;
+    int i;
+
+    for (i = 0; i < ctx->num_workers; i++)
+    {
+        w = &ctx->waiters[i];
+        want = atomic_load(&w->want);
+        while (want && want <= lsn)
+        {
+            /* cleared first, so that the worker sets it again if need be */
+            if (atomic_compare_exchange_weak(&w->want, &want, 0))
+            {
+                if (write(w->fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+                {
+                    perror("write");
+                }
+                break;
+            }
+        }
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* applies a logged change at startup */
+static void
+skvs_replay(void *arg, int op, const char *key, const char *value,
+            size_t value_len)
+{
+    hashtable_t *table = arg;
+    uint64_t expire_at;
+
+    switch (op)
+    {
+    case HASH_OP_INSERT:
+        hash_insert_len(table, key, value, value_len);
+        break;
+    case HASH_OP_UPDATE:
+        hash_update_len(table, key, value, value_len);
+        break;
+    case HASH_OP_DELETE:
+        hash_delete(table, key);
+        break;
+    case HASH_OP_EXPIRE:
+        if (value_len != sizeof(expire_at))
+        {
+            DEBUG_PRINT("Malformed expiry record");
+            break;
+        }
+        /* may have passed already, which leaves the key expired */
+        memcpy(&expire_at, value, sizeof(expire_at));
+        hash_set_expiry(table, key, expire_at);
+        break;
+    default:
+        DEBUG_PRINT("Unknown log record %d", op);
+        break;
+    }
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * collects the snapshot child if it has exited, waiting for it when set
+ * wait. once the snapshot is complete, the log it holds is dropped.
+ * the caller holds snap_lock.
+ */
+static void skvs_reap(struct skvs_ctx *ctx, int wait)
 {
-    TRACE_PRINT();
-    char *cmd;
-    int i;
+    pid_t pid;
+    int status;
 
-    if (len > BUFFER_SIZE)
+    if (ctx->snap_pid <= 0)
     {
-        /* too large message */
-        return CMD_INVALID;
+        return;
     }
-    if (len == BUFFER_SIZE)
+    do
     {
-        if (memcmp(&buffer[BUFFER_SIZE - 1], g_crlf, strlen(g_crlf)))
-        {
-            /* too large message */
-            return CMD_INVALID;
-        }
+        pid = waitpid(ctx->snap_pid, &status, wait ? 0 : WNOHANG);
+    } while (pid < 0 && errno == EINTR);
+    if (pid == 0)
+    {
+        /* still writing */
+        return;
+    }
+    ctx->snap_pid = 0;
 
-        /* remove line feed */
-        buffer[BUFFER_SIZE - 1] = '\0';
+    if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        /* the log is kept whole, and the previous snapshot too */
+        fprintf(stderr, "Snapshot failed\n");
+        return;
     }
-    else
+    printf("Snapshot written to %s\n", ctx->snap_path);
+    if (ctx->wal)
     {
-        /* make it null-terminated */
-        buffer[len] = '\0';
-
-        char *crlf_ptr = strstr(buffer, g_crlf);
-        if (crlf_ptr == NULL)
-        {
-            return CMD_INCOMPLETE;
-        }
-
-        /* remove line feed */
-        *crlf_ptr = '\0';
+        wal_drop_old(ctx->wal, ctx->snap_lsn);
     }
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * gives every worker an eventfd to be woken through once the responses it
+ * holds back may be sent, see skvs_hold().
+ * returns -1 when any errors occur.
+ * returns 0 on success.
+ */
+static int skvs_init_waiters(struct skvs_ctx *ctx)
+{
+    int i;
 
-    cmd = strtok(buffer, " ");
-    if (cmd == NULL)
+    if (ctx->num_workers == 0)
     {
-        /* no command found */
-        return CMD_INVALID;
+        return 0;
     }
-
-    /* convert command to uppercase for case-insensitive comparison */
-    for (i = 0; cmd[i]; i++)
+    if (posix_memalign((void **)&ctx->waiters, CACHE_LINE_SIZE,
+                       ctx->num_workers * sizeof(*ctx->waiters)) != 0)
     {
-        cmd[i] = toupper(cmd[i]);
+        DEBUG_PRINT("Failed to allocate the waiters");
+        ctx->waiters = NULL;
+        return -1;
     }
-
-    for (i = 0; i < CMD_COUNT; i++)
+    for (i = 0; i < ctx->num_workers; i++)
     {
-        if (strcmp(cmd, g_cmds[i]) == 0)
+        atomic_init(&ctx->waiters[i].want, 0);
+        ctx->waiters[i].fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (ctx->waiters[i].fd < 0)
         {
-            *key = strtok(NULL, " ");
-            if (*key == NULL)
-            {
-                /* no key found */
-                return CMD_INVALID;
-            }
-            if (strlen(*key) > MAX_KEY_LEN)
-            {
-                /* too large key */
-                return CMD_INVALID;
-            }
-
-            *value = strtok(NULL, " ");
-
-            /* handle specific cases for READ and DELETE */
-            if ((i == CMD_READ || i == CMD_DELETE) && *value != NULL)
-            {
-                /* READ or DELETE should not have a value */
-                return CMD_INVALID;
-            }
-
-            /* handle specific cases for CREATE and UPDATE */
-            if ((i == CMD_CREATE || i == CMD_UPDATE) && *value == NULL)
-            {
-                /* CREATE or UPDATE must have a value */
-                return CMD_INVALID;
-            }
-
-            /* check for extra tokens after value */
-            if (strtok(NULL, " ") != NULL)
+            perror("eventfd");
+            while (i-- > 0)
             {
-                /* extra tokens found */
-                return CMD_INVALID;
+                close(ctx->waiters[i].fd);
             }
-
-            /* return the corresponding command enum */
-            return i;
+            free(ctx->waiters);
+            ctx->waiters = NULL;
+            return -1;
         }
     }
 
-    /* command not recognized */
-    return CMD_INVALID;
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void skvs_free_waiters(struct skvs_ctx *ctx)
+{
+    int i;
+
+    if (ctx->waiters == NULL)
+    {
+        return;
+    }
+    for (i = 0; i < ctx->num_workers; i++)
+    {
+        close(ctx->waiters[i].fd);
+    }
+    free(ctx->waiters);
+    ctx->waiters = NULL;
 }
 /*---------------------------------------------------------------------------*/
 struct skvs_ctx *
-skvs_init(size_t hash_size, int delay)
+skvs_init(const struct skvs_conf *conf)
 {
     TRACE_PRINT();
     struct skvs_ctx *ctx = calloc(1, sizeof(struct skvs_ctx));
+    uint64_t lsn = 0;
+
+    if (ctx == NULL)
+    {
+        return NULL;
+    }
     /* initialize the global hash table */
-    ctx->table = hash_init(hash_size, delay);
+    ctx->table = hash_init(conf->hash_size, conf->buckets_per_lock,
+                           conf->delay,
+                           (conf->lockfree_read ? HASH_LOCKFREE_READ : 0) |
+                           (conf->open_addressing ?
+                            HASH_OPEN_ADDRESSING : 0) |
+                           (conf->lock_policy == RWLOCK_PHASE_FAIR ?
+                            HASH_LOCK_FAIR : 0) |
+                           (conf->lock_policy == RWLOCK_MUTEX ?
+                            HASH_LOCK_MUTEX : 0) |
+                           (conf->ordered_index ? HASH_ORDERED_INDEX : 0));
     if (ctx->table == NULL)
     {
         DEBUG_PRINT("Failed to initialize global hash table");
+        free(ctx);
         return NULL;
     }
+    if (conf->hash_fn)
+    {
+        hash_set_function(ctx->table, conf->hash_fn);
+    }
+    ctx->max_value = conf->max_value ? conf->max_value : MAX_VALUE_SIZE;
+    pthread_mutex_init(&ctx->snap_lock, NULL);
+    ctx->start_time = time(NULL);
+    if (conf->num_workers > 0)
+    {
+        if (posix_memalign((void **)&ctx->stats, CACHE_LINE_SIZE,
+                           conf->num_workers * sizeof(*ctx->stats)) != 0)
+        {
+            DEBUG_PRINT("Failed to allocate the counters");
+            ctx->stats = NULL;
+            goto fail;
+        }
+        memset(ctx->stats, 0, conf->num_workers * sizeof(*ctx->stats));
+        ctx->num_workers = conf->num_workers;
+    }
+
+    if (conf->snapshot_path)
+    {
+        ctx->snap_path = strdup(conf->snapshot_path);
+        if (ctx->snap_path == NULL ||
+            snapshot_load(ctx->table, ctx->snap_path, &lsn,
+                          &ctx->snap_map) < 0)
+        {
+            DEBUG_PRINT("Failed to load the snapshot");
+            goto fail;
+        }
+        ctx->snap_interval = conf->snapshot_interval;
+        ctx->snap_time = time(NULL);
+    }
+
+    if (conf->wal_path && skvs_init_waiters(ctx) < 0)
+    {
+        goto fail;
+    }
+    if (conf->wal_path)
+    {
+        /* replay before logging, so that the replay is not logged again */
+        ctx->wal = wal_open(conf->wal_path, conf->wal_interval, lsn,
+                            skvs_replay, ctx->table);
+        if (ctx->wal == NULL)
+        {
+            DEBUG_PRINT("Failed to open the write-ahead log");
+            goto fail;
+        }
+        hash_set_log(ctx->table, skvs_log, ctx->wal);
+        if (ctx->waiters)
+        {
+            wal_set_notify(ctx->wal, skvs_wake, ctx);
+        }
+    }
+    /*
+     * set once the table is restored: the snapshot was within the budget,
+     * and the log holds the evictions made since, which the table would
+     * make otherwise on its own.
+     */
+    hash_set_limit(ctx->table, conf->mem_limit);
 
     return ctx;
+
+fail:
+    pthread_mutex_destroy(&ctx->snap_lock);
+    skvs_free_waiters(ctx);
+    free(ctx->stats);
+    free(ctx->snap_path);
+    hash_destroy(ctx->table);
+    snapshot_unmap(&ctx->snap_map);
+    free(ctx);
+    return NULL;
 }
 /*---------------------------------------------------------------------------*/
 int skvs_destroy(struct skvs_ctx *ctx, int dump)
 {
     TRACE_PRINT();
+    pthread_mutex_lock(&ctx->snap_lock);
+    skvs_reap(ctx, 1);
+    pthread_mutex_unlock(&ctx->snap_lock);
+    pthread_mutex_destroy(&ctx->snap_lock);
+    free(ctx->snap_path);
+
+    if (ctx->wal)
+    {
+        hash_set_log(ctx->table, NULL, NULL);
+        wal_close(ctx->wal);
+    }
     if (dump)
     {
         hash_dump(ctx->table);
@@ -147,94 +1864,397 @@ int skvs_destroy(struct skvs_ctx *ctx, int dump)
     {
         return -1;
     }
+    /* no entry refers to it anymore */
+    snapshot_unmap(&ctx->snap_map);
+    skvs_free_waiters(ctx);
+    free(ctx->stats);
+    free(ctx);
 
     return 0;
 }
 /*---------------------------------------------------------------------------*/
-const char *
-skvs_serve(struct skvs_ctx *ctx, char *rbuf, size_t rlen, int* isFree)
+/**
+ * has the flusher wake the calling worker once the log is durable up to
+ * lsn, unless it is to be woken earlier already.
+ * returns what wal_synced() does after, so that a wake-up is not missed
+ * when the log got there meanwhile.
+ */
+static int skvs_wait_for(struct skvs_ctx *ctx, uint64_t lsn)
 {
-    TRACE_PRINT();
-    const char *resp, *key = NULL, *value = NULL;
-    enum CMD cmd;
-    int ret;
+    uint64_t want = atomic_load(&t_waiter->want);
 
-    /* parse the command */
-    cmd = skvs_parse(rbuf, rlen, &key, &value);
-    *isFree = 0;
+    while ((want == 0 || want > lsn) &&
+           !atomic_compare_exchange_weak(&t_waiter->want, &want, lsn))
+    {
+    }
 
-    /* handle request */
-    switch (cmd)
+    return wal_synced(ctx->wal, lsn);
+}
+/*---------------------------------------------------------------------------*/
+int skvs_session_release(struct skvs_ctx *ctx, struct skvs_session *sess)
+{
+    struct skvs_hold *hold;
+    int ret;
+
+    while (sess->hold_head < sess->hold_count)
     {
-    case CMD_INCOMPLETE:
-        resp = NULL;
-        break;
-    case CMD_CREATE:
-        ret = hash_insert(ctx->table, key, value);
-        if (ret > 0)
-        {
-            resp = g_msgs[MSG_CREATE_OK];
-        }
-        else if (ret == 0)
+        hold = &sess->hold[sess->hold_head];
+        ret = wal_synced(ctx->wal, hold->lsn);
+        if (ret == 0)
         {
-            resp = g_msgs[MSG_COLLISION];
+            ret = skvs_wait_for(ctx, hold->lsn);
         }
-        else
-        {
-            resp = g_msgs[MSG_INTERNAL_ERR];
-        }
-        break;
-    case CMD_READ:
-        ret = hash_search(ctx->table, key, &value);
-        if (ret > 0)
+        if (ret < 0)
         {
-            resp = (const char *)value;
-            *isFree = 1;
+            return -1;
         }
-        else if (ret == 0)
+        if (ret == 0)
         {
-            resp = g_msgs[MSG_NOT_FOUND];
+            return 1;
         }
-        else
+        sess->iov_ready = hold->end;
+        sess->hold_head++;
+    }
+
+    /* nothing holds back what was queued after the last hold */
+    sess->hold_head = sess->hold_count = 0;
+    sess->iov_ready = sess->iov_count;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * holds back the responses queued so far until the log is durable up to
+ * the last record the calling thread appended, if it appended any since
+ * before. the responses are ready to be sent right away otherwise, unless
+ * earlier ones are held back.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success.
+ */
+static int
+skvs_hold(struct skvs_ctx *ctx, struct skvs_session *sess, uint64_t before)
+{
+    struct skvs_hold *hold;
+    uint64_t lsn = ctx->wal ? wal_thread_lsn() : 0;
+    int cap;
+
+    if (lsn == before)
+    {
+        /* nothing to wait for, but nothing passes what is held back */
+        if (sess->hold_head == sess->hold_count)
         {
-            resp = g_msgs[MSG_INTERNAL_ERR];
+            sess->iov_ready = sess->iov_count;
         }
-        break;
-    case CMD_UPDATE:
-        ret = hash_update(ctx->table, key, value);
-        if (ret > 0)
+        return 0;
+    }
+    if (t_waiter == NULL)
+    {
+        /* no event loop to be woken in */
+        if (wal_wait(ctx->wal, lsn) < 0)
         {
-            resp = g_msgs[MSG_UPDATE_OK];
+            return -1;
         }
-        else if (ret == 0)
+        sess->iov_ready = sess->iov_count;
+        return 0;
+    }
+
+    if (sess->hold_count == sess->hold_cap)
+    {
+        if (sess->hold_head > 0)
         {
-            resp = g_msgs[MSG_NOT_FOUND];
+            memmove(sess->hold, &sess->hold[sess->hold_head],
+                    (sess->hold_count - sess->hold_head) * sizeof(*hold));
+            sess->hold_count -= sess->hold_head;
+            sess->hold_head = 0;
         }
         else
         {
-            resp = g_msgs[MSG_INTERNAL_ERR];
+            cap = sess->hold_cap ? sess->hold_cap * 2 : 16;
+            hold = realloc(sess->hold, cap * sizeof(*hold));
+            if (hold == NULL)
+            {
+                return -1;
+            }
+            sess->hold = hold;
+            sess->hold_cap = cap;
         }
-        break;
-    case CMD_DELETE:
-        ret = hash_delete(ctx->table, key);
-        if (ret > 0)
+    }
+    hold = &sess->hold[sess->hold_count++];
+    hold->end = sess->iov_count;
+    hold->lsn = lsn;
+
+    return skvs_session_release(ctx, sess) < 0 ? -1 : 0;
+}
+/*---------------------------------------------------------------------------*/
+ssize_t
+skvs_serve(struct skvs_ctx *ctx, struct skvs_session *sess,
+           char *rbuf, size_t rlen)
+{
+    TRACE_PRINT();
+    uint64_t lsn = ctx->wal ? wal_thread_lsn() : 0;
+    ssize_t consumed;
+
+    if (sess->proto == PROTO_UNKNOWN && rlen > 0)
+    {
+        sess->proto = (unsigned char)rbuf[0] == SKVS_BIN_REQ ?
+                      PROTO_BINARY : PROTO_TEXT;
+    }
+    consumed = sess->proto == PROTO_BINARY ?
+               skvs_serve_binary(ctx, sess, rbuf, rlen) :
+               skvs_serve_text(ctx, sess, rbuf, rlen);
+    if (consumed < 0)
+    {
+        return -1;
+    }
+    skvs_count(&t_stats->bytes_in, consumed);
+
+    /* acknowledge no change before it is durable */
+    if (skvs_hold(ctx, sess, lsn) < 0)
+    {
+        return -1;
+    }
+
+    return consumed;
+}
+/*---------------------------------------------------------------------------*/
+char *skvs_stream_buf(struct skvs_session *sess, size_t *len)
+{
+    struct skvs_stream *st = &sess->stream;
+
+    if (st->value == NULL)
+    {
+        return NULL;
+    }
+    *len = st->value->len - st->len;
+
+    return st->value->data + st->len;
+}
+/*---------------------------------------------------------------------------*/
+int skvs_stream_done(struct skvs_ctx *ctx, struct skvs_session *sess,
+                     size_t len)
+{
+    struct skvs_stream *st = &sess->stream;
+    uint64_t lsn = ctx->wal ? wal_thread_lsn() : 0;
+
+    skvs_count(&t_stats->bytes_in, len);
+    st->len += len;
+    if (st->len < st->value->len)
+    {
+        return 0;
+    }
+    if (skvs_stream_finish(ctx, sess) < 0)
+    {
+        return -1;
+    }
+
+    /* acknowledge no change before it is durable */
+    if (skvs_hold(ctx, sess, lsn) < 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+int skvs_snapshot(struct skvs_ctx *ctx)
+{
+    TRACE_PRINT();
+    uint64_t lsn = 0;
+    pid_t pid;
+
+    if (ctx->snap_path == NULL)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&ctx->snap_lock);
+    skvs_reap(ctx, 0);
+    if (ctx->snap_pid > 0)
+    {
+        pthread_mutex_unlock(&ctx->snap_lock);
+        return 0;
+    }
+
+    /*
+     * with every stripe locked, no change is half done, and the log ends
+     * exactly at what the child sees. the stall lasts as long as fork()
+     * copying the page tables, not as long as writing the snapshot.
+     */
+    hash_freeze(ctx->table);
+    if (ctx->wal)
+    {
+        lsn = wal_lsn(ctx->wal);
+    }
+    pid = fork();
+    if (pid == 0)
+    {
+        /* only this thread lives on, with its own image of the table */
+        _exit(snapshot_save(ctx->table, ctx->snap_path, lsn) < 0 ?
+              EXIT_FAILURE : EXIT_SUCCESS);
+    }
+    if (pid > 0 && ctx->wal)
+    {
+        /*
+         * fails while the log of a failed snapshot is kept; the log then
+         * grows on, and replay skips what this snapshot holds.
+         */
+        wal_rotate(ctx->wal);
+    }
+    hash_thaw(ctx->table);
+
+    if (pid < 0)
+    {
+        perror("fork");
+        pthread_mutex_unlock(&ctx->snap_lock);
+        return -1;
+    }
+    ctx->snap_pid = pid;
+    ctx->snap_lsn = lsn;
+    ctx->snap_time = time(NULL);
+    pthread_mutex_unlock(&ctx->snap_lock);
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+void skvs_tick(struct skvs_ctx *ctx)
+{
+    int due;
+
+    if (ctx->snap_path == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&ctx->snap_lock);
+    skvs_reap(ctx, 0);
+    due = ctx->snap_interval > 0 && ctx->snap_pid == 0 &&
+          time(NULL) - ctx->snap_time >= ctx->snap_interval;
+    pthread_mutex_unlock(&ctx->snap_lock);
+
+    if (due)
+    {
+        skvs_snapshot(ctx);
+    }
+}
+/*---------------------------------------------------------------------------*/
+int skvs_expire(struct skvs_ctx *ctx)
+{
+    return hash_expire(ctx->table);
+}
+/*---------------------------------------------------------------------------*/
+int skvs_worker_init(struct skvs_ctx *ctx, int idx)
+{
+    if (idx < 0 || idx >= ctx->num_workers)
+    {
+        return -1;
+    }
+    t_stats = &ctx->stats[idx];
+    rwlock_set_wait_stats(&t_stats->lock_wait);
+    if (ctx->waiters)
+    {
+        t_waiter = &ctx->waiters[idx];
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+int skvs_worker_fd(void)
+{
+    return t_waiter ? t_waiter->fd : -1;
+}
+/*---------------------------------------------------------------------------*/
+void skvs_session_init(struct skvs_session *sess)
+{
+    memset(sess, 0, sizeof(*sess));
+    skvs_count(&t_stats->conns, 1);
+    skvs_count(&t_stats->total_conns, 1);
+}
+/*---------------------------------------------------------------------------*/
+int skvs_lock_report(struct skvs_ctx *ctx, size_t n, char *buf, size_t size,
+                     size_t *len)
+{
+    hash_lock_prof_t top[SKVS_LOCKS_MAX];
+    struct rwlock_prof *p;
+    int found, i, ret;
+
+    if (n > SKVS_LOCKS_MAX)
+    {
+        n = SKVS_LOCKS_MAX;
+    }
+    found = hash_lock_profile(ctx->table, top, n);
+    for (i = 0; i < found && *len < size; i++)
+    {
+        p = &top[i].prof;
+        ret = snprintf(buf + *len, size - *len,
+                       "LOCK %zu entries %zu reads %lu writes %lu "
+                       "read_waits %lu read_wait_us %lu "
+                       "write_waits %lu write_wait_us %lu "
+                       "max_hold_us %lu max_queue %u\n",
+                       top[i].stripe, top[i].entries, p->reads, p->writes,
+                       p->read_waits, p->read_wait_ns / 1000,
+                       p->write_waits, p->write_wait_ns / 1000,
+                       p->max_hold_ns / 1000, p->max_queue);
+        if (ret < 0 || (size_t)ret >= size - *len)
         {
-            resp = g_msgs[MSG_DELETE_OK];
+            /* no room for a whole line */
+            break;
         }
-        else if (ret == 0)
+        *len += ret;
+    }
+
+    return found < 0 ? -1 : i;
+}
+/*---------------------------------------------------------------------------*/
+void skvs_session_advance(struct skvs_session *sess, size_t sent)
+{
+    struct iovec *iov;
+
+    skvs_count(&t_stats->bytes_out, sent);
+    sess->pending -= sent;
+    while (sess->iov_head < sess->iov_count)
+    {
+        iov = &sess->iov[sess->iov_head];
+        if (sent < iov->iov_len)
         {
-            resp = g_msgs[MSG_NOT_FOUND];
+            iov->iov_base = (char *)iov->iov_base + sent;
+            iov->iov_len -= sent;
+            break;
         }
-        else
+        sent -= iov->iov_len;
+        if (sess->ref[sess->iov_head])
         {
-            resp = g_msgs[MSG_INTERNAL_ERR];
+            value_put(sess->ref[sess->iov_head]);
         }
-        break;
-    case CMD_INVALID:
-    default:
-        resp = g_msgs[MSG_INVALID];
-        break;
+        sess->iov_head++;
+    }
+
+    if (sess->iov_head == sess->iov_count)
+    {
+        /* everything was sent, rewind */
+        sess->iov_head = sess->iov_ready = sess->iov_count = 0;
     }
+}
+/*---------------------------------------------------------------------------*/
+void skvs_session_free(struct skvs_session *sess)
+{
+    int i;
 
-    return resp;
-}
\ No newline at end of file
+    for (i = sess->iov_head; i < sess->iov_count; i++)
+    {
+        if (sess->ref[i])
+        {
+            value_put(sess->ref[i]);
+        }
+    }
+    if (sess->stream.value)
+    {
+        value_put(sess->stream.value);
+    }
+    free(sess->stream.buf);
+    free(sess->iov);
+    free(sess->ref);
+    free(sess->hdr);
+    free(sess->hold);
+    memset(sess, 0, sizeof(*sess));
+    skvs_count(&t_stats->conns, -1);
+}
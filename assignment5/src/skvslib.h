@@ -8,9 +8,22 @@
 #include <string.h>
 #include <errno.h>
 #include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 #include "hashtable.h"
+#include "wal.h"
+#include "snapshot.h"
 #include "common.h"
 /*---------------------------------------------------------------------------*/
+/* lock stripes LOCKS reports by default, and at most, to fit a buffer */
+#define SKVS_LOCKS_TOP 10
+#define SKVS_LOCKS_MAX 16
+/* entries SCAN and PREFIX respond with by default, MAX_MULTI_KEYS at most */
+#define SKVS_SCAN_COUNT 16
+/*---------------------------------------------------------------------------*/
 /* response message indices */
 enum MSG
 {
@@ -21,6 +34,14 @@ enum MSG
     MSG_UPDATE_OK,
     MSG_DELETE_OK,
     MSG_INTERNAL_ERR,
+    MSG_SNAPSHOT_STARTED,
+    MSG_SNAPSHOT_BUSY,
+    MSG_EXPIRE_OK,
+    MSG_HOT_OK,
+    MSG_CAS_OK,
+    MSG_CAS_MISMATCH,
+    MSG_NOT_NUMBER,
+    MSG_OUT_OF_RANGE,
     MSG_COUNT
 };
 /* command indices */
@@ -32,13 +53,185 @@ enum CMD
     CMD_READ,
     CMD_UPDATE,
     CMD_DELETE,
+    CMD_MCREATE,
+    CMD_MREAD,
+    CMD_MDELETE,
+    CMD_SNAPSHOT,
+    CMD_EXPIRE,
+    CMD_HOT,
+    CMD_STATS,
+    CMD_LOCKS,
+    CMD_SCAN,
+    CMD_PREFIX,
+    CMD_GETS,
+    CMD_CAS,
+    CMD_INCR,
+    CMD_DECR,
     CMD_COUNT
 };
 /*---------------------------------------------------------------------------*/
+/*
+ * binary protocol, for clients that need values of any bytes or cannot
+ * afford scanning for line feeds. a connection whose first byte is
+ * SKVS_BIN_REQ speaks it from then on; any other byte starts the text
+ * protocol. every request and response is a header followed by the key
+ * and then the value, as many bytes as the header says:
+ *   magic (1) | opcode (1) | key_len (1) | status (1) | value_len (4) |
+ *   req_id (4)
+ * with the integers in network byte order. the opcode is the enum CMD of
+ * a single-key command, EXPIRE, HOT, SNAPSHOT, STATS or LOCKS. a response
+ * echoes the opcode and the req_id of its request, carries no key, and
+ * the value only when a READ found one, or for STATS and LOCKS, the lines
+ * of the text one. the value of a LOCKS is its n in decimal, if any.
+ * the status of a request holds flags instead. a CREATE or UPDATE with
+ * BIN_FLAG_TTL has the value start with a ttl in seconds, as 4 bytes in
+ * network byte order, and the value of an EXPIRE is nothing but one.
+ * the value of a HOT is as in text, "0", "1" or nothing.
+ */
+#define SKVS_BIN_REQ 0x80     // magic of a request
+#define SKVS_BIN_RES 0x81     // magic of a response
+#define BIN_FLAG_TTL 0x1      // the value starts with a ttl
+/* binary response statuses */
+enum BIN_STATUS
+{
+    BIN_OK,                   // done, or found for a READ
+    BIN_NOT_FOUND,
+    BIN_COLLISION,
+    BIN_INVALID,
+    BIN_INTERNAL_ERR,
+    BIN_BUSY,                 // a snapshot is running already
+};
+struct skvs_bin_hdr
+{
+    uint8_t magic;
+    uint8_t opcode;
+    uint8_t key_len;
+    uint8_t status;           // flags in requests
+    uint32_t value_len;
+    uint32_t req_id;          // opaque to the server
+};
+/* protocols of a session */
+enum PROTO
+{
+    PROTO_UNKNOWN,            // nothing received yet
+    PROTO_TEXT,
+    PROTO_BINARY,
+};
+/*---------------------------------------------------------------------------*/
+/* SKVS configuration */
+struct skvs_conf {
+    size_t hash_size;
+    size_t buckets_per_lock; // buckets sharing a lock stripe
+    int delay;          // rwlock delay for semantic tests
+    int lock_policy;    // enum RWLOCK_POLICY of the stripe locks
+    int lockfree_read;  // serve reads without taking bucket locks
+    int open_addressing; // use the open-addressing table engine
+    hash_fn_t hash_fn;  // NULL for the default hash
+    const char *wal_path; // write-ahead log, or NULL for none
+    int wal_interval;   // ms between log syncs
+    const char *snapshot_path; // snapshot file, or NULL for none
+    int snapshot_interval; // s between periodic snapshots, 0 for none
+    size_t max_value;   // largest value accepted, in bytes
+    size_t mem_limit;   // bytes the entries may take, 0 for no bound
+    int num_workers;    // threads counting apart, see skvs_worker_init()
+    int ordered_index;  // keep the keys in order for SCAN and PREFIX
+};
+/*---------------------------------------------------------------------------*/
+/*
+ * counters of a worker thread. only the worker writes them, with plain
+ * stores, and STATS sums those of all the workers as it reads them. each
+ * takes cache lines of its own, so that no two workers write to one.
+ */
+struct skvs_stats {
+    uint64_t cmds[CMD_COUNT]; // requests of each command
+    uint64_t read_hits;       // keys READ or MREAD found
+    uint64_t read_misses;
+    uint64_t bytes_in;        // request bytes served
+    uint64_t bytes_out;       // response bytes sent
+    uint64_t conns;           // opened less closed, wrapping below 0
+    uint64_t total_conns;     // opened
+    struct rwlock_wait lock_wait; // waits for stripe locks
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+/*---------------------------------------------------------------------------*/
+/*
+ * a worker whose responses wait for the log. it sets want to the lowest
+ * lsn it waits for, and the log flusher clears it and writes to the
+ * eventfd once that lsn is durable, which wakes the worker's event loop.
+ */
+struct skvs_waiter {
+    _Atomic uint64_t want;    // lsn to be woken at, 0 for none
+    int fd;                   // eventfd
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+/*---------------------------------------------------------------------------*/
 /* SKVS context */
 struct skvs_ctx {
     int sock;
     hashtable_t *table;
+    struct wal *wal;
+    size_t max_value;
+
+    /* snapshots, see skvs_snapshot() */
+    char *snap_path;
+    int snap_interval;
+    pthread_mutex_t snap_lock; // protects the fields below
+    pid_t snap_pid;           // child writing a snapshot, or 0
+    uint64_t snap_lsn;        // last log record it holds
+    time_t snap_time;         // when the last one started
+    struct snapshot_map snap_map; // loaded at startup, backing entries
+
+    /* per-worker counters, see struct skvs_stats */
+    struct skvs_stats *stats;
+    int num_workers;
+    time_t start_time;
+
+    /* per worker, with a write-ahead log, see skvs_worker_fd() */
+    struct skvs_waiter *waiters;
+};
+/*
+ * a CREATE or UPDATE too large for the receive buffer, whose value is
+ * gathered apart from it. a binary value has its size up front, and is
+ * received straight into a value of that size; a text value is gathered
+ * on the heap up to the line feed. either is bounded by max_value.
+ */
+struct skvs_stream {
+    enum CMD cmd;
+    char key[MAX_KEY_LEN + 1];
+    value_t *value;   // binary, or NULL
+    char *buf;        // text, or NULL
+    size_t len;       // bytes received so far
+    size_t cap;       // of buf
+};
+/* responses queued before end, that wait for the log up to lsn */
+struct skvs_hold {
+    int end;          // iovec index
+    uint64_t lsn;
+};
+/* per-connection protocol state */
+struct skvs_session {
+    /* pending responses, sent in order with writev() */
+    struct iovec *iov;
+    value_t **ref;    // value backing each iovec, released once sent
+    int iov_head;     // first iovec not completely sent
+    int iov_ready;    // first iovec held back, see skvs_session_release()
+    int iov_count;
+    int iov_cap;
+    size_t pending;   // bytes not yet sent, held back included
+
+    /* holds on the responses, in the order they were queued */
+    struct skvs_hold *hold;
+    int hold_head;
+    int hold_count;
+    int hold_cap;
+
+    /* binary response headers, at the index of their iovec */
+    struct skvs_bin_hdr *hdr;
+
+    enum PROTO proto; // chosen by the first byte received
+    struct skvs_bin_hdr req; // binary request being served
+    struct skvs_stream stream;
+    int skip;         // discarding the rest of a too long request line
+    size_t discard;   // bytes of a too large binary request left to drop
+    int close;        // the client asked to close the connection
 };
 /*---------------------------------------------------------------------------*/
 /**
@@ -46,7 +239,7 @@ struct skvs_ctx {
  * returns NULL when any internal errors occur.
  * returns the SKVS context pointer on success.
  */
-struct skvs_ctx *skvs_init(size_t hash_size, int delay);
+struct skvs_ctx *skvs_init(const struct skvs_conf *conf);
 /*---------------------------------------------------------------------------*/
 /**
  * destroys SKVS context and the hash table.
@@ -57,14 +250,140 @@ struct skvs_ctx *skvs_init(size_t hash_size, int delay);
 int skvs_destroy(struct skvs_ctx *ctx, int dump);
 /*---------------------------------------------------------------------------*/
 /**
- * returns the complete SKVS commands for the given request on success
- * returns NULL when the request is incomplete.
- * 
- * !Caveat!
- * The return value has no line feed.
- * You should copy the return value to application buffer,
- * and add a line feed at the end.
- */
-const char *skvs_serve(struct skvs_ctx *ctx, char *rbuf, size_t rlen, int* isFree);
+ * makes the calling thread count what it serves in the idx-th counters
+ * of the context, its waits for stripe locks included. a thread that
+ * does not call it counts in counters shared with any other such thread.
+ * returns -1 when idx is not below the num_workers of the configuration.
+ * returns 0 on success.
+ */
+int skvs_worker_init(struct skvs_ctx *ctx, int idx);
+/*---------------------------------------------------------------------------*/
+/**
+ * returns the eventfd that becomes readable when responses of the calling
+ * worker that were held back may be released, see skvs_session_release(),
+ * or -1 without a write-ahead log or a call to skvs_worker_init().
+ */
+int skvs_worker_fd(void);
+/*---------------------------------------------------------------------------*/
+/**
+ * initializes a session for a new connection, and counts it as open
+ * until skvs_session_free().
+ */
+void skvs_session_init(struct skvs_session *sess);
+/*---------------------------------------------------------------------------*/
+/**
+ * serves every complete request in rbuf in order and queues the
+ * responses to the session.
+ * in text, a request is a line, and so is each response.
+ * CREATE and UPDATE take a ttl in seconds after the value, if any, and
+ * "EXPIRE key ttl" sets the ttl of a key, or clears it with 0.
+ * "HOT key [1]" flags the lock stripe of a key as hot, and "HOT key 0"
+ * clears the flag, see hash_set_hot().
+ * STATS responds with a "STAT name value" line for each of the counters
+ * summed over the workers and the figures of the table, and then "END".
+ * "LOCKS [n]" responds with a "LOCK stripe ..." line for each of the n
+ * lock stripes waited for the longest, SKVS_LOCKS_TOP by default, and then
+ * "END", see skvs_lock_report(). it is invalid unless the locks are built
+ * with RWLOCK_PROFILE.
+ * multi-key commands (MCREATE, MREAD, MDELETE) respond with one line per
+ * key, in the order the keys were given. they are text only.
+ * "SCAN from to [count]" responds with a "key value" line for each of the
+ * first count keys k with from <= k < to, in the order of their bytes,
+ * SKVS_SCAN_COUNT by default, and "PREFIX prefix [count [from]]" for
+ * those starting with prefix, from from on. either ends with "NEXT key"
+ * when more keys are in range, for the next request to start at, or with
+ * "END". they are text only, and invalid unless the ordered index is on.
+ * "GETS key" responds with "version value", the value as READ would and
+ * its version, and "CAS key version value" updates key to value only if
+ * it still has that version, see hash_cas(). "INCR key [delta]" and
+ * "DECR key [delta]" add to or take from a decimal value, 1 by default,
+ * and respond with the result, see hash_incr(). they are text only.
+ * a trailing partial request is left unconsumed for the next call, but
+ * for a CREATE or UPDATE too large for rbuf, whose value is gathered apart
+ * as it comes, see struct skvs_stream. values up to max_value are taken.
+ * with a write-ahead log, the responses to the changes made are held
+ * back until the changes are durable, and so are those queued after
+ * them, so one log sync covers a whole batch and the worker goes on
+ * serving meanwhile. a thread without skvs_worker_fd() waits for the log
+ * before returning instead.
+ * returns -1 when any internal errors occur.
+ * returns the number of bytes consumed from rbuf on success.
+ */
+ssize_t skvs_serve(struct skvs_ctx *ctx, struct skvs_session *sess,
+                   char *rbuf, size_t rlen);
+/*---------------------------------------------------------------------------*/
+/**
+ * tells where the next bytes received should go while a binary value too
+ * large for the receive buffer is coming in, so that they are read
+ * straight into it, and sets *len to how many are still due.
+ * returns NULL when they go to the receive buffer.
+ */
+char *skvs_stream_buf(struct skvs_session *sess, size_t *len);
+/*---------------------------------------------------------------------------*/
+/**
+ * accounts for len bytes received to skvs_stream_buf(), and serves the
+ * request as skvs_serve() would once the value is complete.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success.
+ */
+int skvs_stream_done(struct skvs_ctx *ctx, struct skvs_session *sess,
+                     size_t len);
+/*---------------------------------------------------------------------------*/
+/**
+ * starts writing a snapshot of the table in a forked child, unless one
+ * is running already. the table is frozen only while forking, and the
+ * write-ahead log is rotated at the same point, so that the records the
+ * snapshot holds can be dropped once it is complete.
+ * returns -1 when any internal errors occur, or snapshots are off.
+ * returns 0 when a snapshot is running already.
+ * returns 1 when one was started.
+ */
+int skvs_snapshot(struct skvs_ctx *ctx);
+/*---------------------------------------------------------------------------*/
+/**
+ * does the periodic work of the server: reaps a finished snapshot child,
+ * and starts the periodic snapshot when it is due.
+ * the server calls it about once a second.
+ */
+void skvs_tick(struct skvs_ctx *ctx);
+/*---------------------------------------------------------------------------*/
+/**
+ * reclaims a batch of keys that have expired, for the workers to call
+ * between events.
+ * returns the number of expiry timers that fired, so that the caller
+ * comes back soon while there are more.
+ */
+int skvs_expire(struct skvs_ctx *ctx);
+/*---------------------------------------------------------------------------*/
+/**
+ * writes a "LOCK stripe ..." line for each of the n lock stripes waited
+ * for the longest to buf, holding size bytes, as far as it has room, and
+ * adds the bytes written to *len. each line has the entries of the
+ * stripe and its rwlock_profile(), with times in us.
+ * returns -1 when the locks are built without RWLOCK_PROFILE.
+ * returns the number of lines on success.
+ */
+int skvs_lock_report(struct skvs_ctx *ctx, size_t n, char *buf, size_t size,
+                     size_t *len);
+/*---------------------------------------------------------------------------*/
+/**
+ * makes the held back responses whose changes are durable by now ready to
+ * be sent, for the worker to call once skvs_worker_fd() is readable.
+ * returns -1 when the log could not be written.
+ * returns 1 when responses are still held back.
+ * returns 0 when none are.
+ */
+int skvs_session_release(struct skvs_ctx *ctx, struct skvs_session *sess);
+/*---------------------------------------------------------------------------*/
+/**
+ * marks sent bytes of the queued responses as done,
+ * and releases the buffers that are completely sent.
+ */
+void skvs_session_advance(struct skvs_session *sess, size_t sent);
+/*---------------------------------------------------------------------------*/
+/**
+ * releases all the resources of the session.
+ */
+void skvs_session_free(struct skvs_session *sess);
 /*---------------------------------------------------------------------------*/
 #endif // _SKVSLIB_H
\ No newline at end of file
@@ -0,0 +1,303 @@
+/*---------------------------------------------------------------------------*/
+/* slab.c                                                                    */
+/* Author: Yeonjae Kim                                                       */
+/*---------------------------------------------------------------------------*/
+#include "slab.h"
+/*---------------------------------------------------------------------------*/
+/* size classes, about four per power of two */
+static const size_t g_class_sizes[] = {
+    16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256,
+    320, 384, 448, 512, 640, 768, 896, 1024, 1280, 1536, 1792, 2048,
+    2560, 3072, 3584, 4096};
+#define SLAB_CLASSES (sizeof(g_class_sizes) / sizeof(g_class_sizes[0]))
+/* class of each size, in steps of 16 bytes */
+static unsigned char g_class_of[SLAB_MAX_SIZE / 16 + 1];
+/*---------------------------------------------------------------------------*/
+/* free objects are linked through their first word */
+struct free_obj
+{
+    struct free_obj *next;
+};
+/*---------------------------------------------------------------------------*/
+/* shared depot of a size class */
+struct slab_depot
+{
+    pthread_mutex_t lock;
+    struct free_obj *free;   // returned by threads
+    char *carve;             // rest of the newest slab
+    size_t carve_left;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+/*---------------------------------------------------------------------------*/
+/* per-thread cache, kept on its own cache line */
+struct slab_cache
+{
+    struct free_obj *free[SLAB_CLASSES];
+    unsigned int count[SLAB_CLASSES];
+    /* bytes allocated minus bytes freed by the thread, read by others */
+    atomic_long in_use;
+    struct slab_cache *next;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+/*---------------------------------------------------------------------------*/
+/* slabs stay linked here, so that nothing looks leaked at exit */
+struct slab_hdr
+{
+    struct slab_hdr *next;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+/*---------------------------------------------------------------------------*/
+static struct slab_depot g_depots[SLAB_CLASSES];
+static _Atomic(struct slab_cache *) g_caches;
+static _Atomic(struct slab_hdr *) g_slabs;
+static atomic_long g_reserved;
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_key;
+static __thread struct slab_cache *t_cache;
+/*---------------------------------------------------------------------------*/
+/* returns the objects of a thread's cache to the depots when it exits */
+static void slab_cache_flush(void *arg)
+{
+    struct slab_cache *cache = arg;
+    struct slab_depot *depot;
+    struct free_obj *obj;
+    size_t c;
+
+    for (c = 0; c < SLAB_CLASSES; c++)
+    {
+        depot = &g_depots[c];
+        pthread_mutex_lock(&depot->lock);
+        while ((obj = cache->free[c]) != NULL)
+        {
+            cache->free[c] = obj->next;
+            obj->next = depot->free;
+            depot->free = obj;
+        }
+        pthread_mutex_unlock(&depot->lock);
+        cache->count[c] = 0;
+    }
+    /* the cache stays registered for its in_use count */
+}
+/*---------------------------------------------------------------------------*/
+static void slab_once(void)
+{
+    size_t c, i;
+
+    for (c = 0, i = 0; i <= SLAB_MAX_SIZE / 16; i++)
+    {
+        if (i * 16 > g_class_sizes[c])
+        {
+            c++;
+        }
+        g_class_of[i] = c;
+    }
+    for (c = 0; c < SLAB_CLASSES; c++)
+    {
+        pthread_mutex_init(&g_depots[c].lock, NULL);
+    }
+    pthread_key_create(&g_key, slab_cache_flush);
+}
+/*---------------------------------------------------------------------------*/
+/* returns the calling thread's cache, registering it on first use */
+static struct slab_cache *slab_cache(void)
+{
+    struct slab_cache *cache = t_cache, *head;
+
+    if (cache)
+    {
+        return cache;
+    }
+
+    pthread_once(&g_once, slab_once);
+    cache = aligned_alloc(CACHE_LINE_SIZE, sizeof(struct slab_cache));
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+    memset(cache, 0, sizeof(*cache));
+
+    /* caches are only ever pushed, so a lock-free push is enough */
+    head = atomic_load(&g_caches);
+    do
+    {
+        cache->next = head;
+    } while (!atomic_compare_exchange_weak(&g_caches, &head, cache));
+    pthread_setspecific(g_key, cache);
+
+    t_cache = cache;
+    return cache;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * moves up to SLAB_BATCH objects of class c from the depot to the cache,
+ * carving a new slab when the depot has none.
+ * returns -1 when out of memory.
+ * returns 0 on success.
+ */
+static int slab_refill(struct slab_cache *cache, size_t c)
+{
+    struct slab_depot *depot = &g_depots[c];
+    struct free_obj *obj;
+    struct slab_hdr *slab;
+    size_t size = g_class_sizes[c];
+    int n = 0;
+
+    pthread_mutex_lock(&depot->lock);
+    while (n < SLAB_BATCH && (obj = depot->free) != NULL)
+    {
+        depot->free = obj->next;
+        obj->next = cache->free[c];
+        cache->free[c] = obj;
+        n++;
+    }
+    while (n < SLAB_BATCH)
+    {
+        if (depot->carve_left < size)
+        {
+            slab = malloc(SLAB_SIZE);
+            if (slab == NULL)
+            {
+                break;
+            }
+            slab->next = atomic_load(&g_slabs);
+            while (!atomic_compare_exchange_weak(&g_slabs, &slab->next,
+                                                 slab))
+                ;
+            atomic_fetch_add_explicit(&g_reserved, SLAB_SIZE,
+                                      memory_order_relaxed);
+            depot->carve = (char *)(slab + 1);
+            depot->carve_left = SLAB_SIZE - sizeof(struct slab_hdr);
+        }
+        obj = (struct free_obj *)depot->carve;
+        depot->carve += size;
+        depot->carve_left -= size;
+        obj->next = cache->free[c];
+        cache->free[c] = obj;
+        n++;
+    }
+    pthread_mutex_unlock(&depot->lock);
+    cache->count[c] += n;
+
+    return n > 0 ? 0 : -1;
+}
+/*---------------------------------------------------------------------------*/
+/* moves SLAB_BATCH objects of class c from the cache back to the depot */
+static void slab_drain(struct slab_cache *cache, size_t c)
+{
+    struct slab_depot *depot = &g_depots[c];
+    struct free_obj *first, *last;
+    int n;
+
+    /* unlink the batch before taking the lock */
+    first = last = cache->free[c];
+    for (n = 1; n < SLAB_BATCH; n++)
+    {
+        last = last->next;
+    }
+    cache->free[c] = last->next;
+    cache->count[c] -= SLAB_BATCH;
+
+    pthread_mutex_lock(&depot->lock);
+    last->next = depot->free;
+    depot->free = first;
+    pthread_mutex_unlock(&depot->lock);
+}
+/*---------------------------------------------------------------------------*/
+void *slab_alloc(size_t size)
+{
+    struct slab_cache *cache = slab_cache();
+    struct free_obj *obj;
+    size_t c;
+    void *ptr;
+
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+    if (size > SLAB_MAX_SIZE)
+    {
+        ptr = malloc(size);
+        if (ptr)
+        {
+            atomic_fetch_add_explicit(&cache->in_use, size,
+                                      memory_order_relaxed);
+            atomic_fetch_add_explicit(&g_reserved, size,
+                                      memory_order_relaxed);
+        }
+        return ptr;
+    }
+
+    c = g_class_of[(size + 15) / 16];
+    if (cache->free[c] == NULL && slab_refill(cache, c) < 0)
+    {
+        return NULL;
+    }
+    obj = cache->free[c];
+    cache->free[c] = obj->next;
+    cache->count[c]--;
+
+    /* only this thread writes it, so a plain add is enough */
+    atomic_store_explicit(&cache->in_use,
+                          atomic_load_explicit(&cache->in_use,
+                                               memory_order_relaxed) +
+                          g_class_sizes[c], memory_order_relaxed);
+
+    return obj;
+}
+/*---------------------------------------------------------------------------*/
+void slab_free(void *ptr, size_t size)
+{
+    struct slab_cache *cache = slab_cache();
+    struct free_obj *obj = ptr;
+    size_t c;
+
+    if (ptr == NULL)
+    {
+        return;
+    }
+    if (size > SLAB_MAX_SIZE)
+    {
+        free(ptr);
+        atomic_fetch_sub_explicit(&g_reserved, size, memory_order_relaxed);
+        if (cache)
+        {
+            atomic_fetch_sub_explicit(&cache->in_use, size,
+                                      memory_order_relaxed);
+        }
+        return;
+    }
+
+    c = g_class_of[(size + 15) / 16];
+    if (cache == NULL)
+    {
+        /* no cache could be set up, so hand it to the depot right away */
+        pthread_mutex_lock(&g_depots[c].lock);
+        obj->next = g_depots[c].free;
+        g_depots[c].free = obj;
+        pthread_mutex_unlock(&g_depots[c].lock);
+        return;
+    }
+    obj->next = cache->free[c];
+    cache->free[c] = obj;
+    if (++cache->count[c] > SLAB_CACHE_MAX)
+    {
+        slab_drain(cache, c);
+    }
+
+    atomic_store_explicit(&cache->in_use,
+                          atomic_load_explicit(&cache->in_use,
+                                               memory_order_relaxed) -
+                          g_class_sizes[c], memory_order_relaxed);
+}
+/*---------------------------------------------------------------------------*/
+void slab_stats(struct slab_stats *stats)
+{
+    struct slab_cache *cache;
+    long in_use = 0;
+
+    for (cache = atomic_load(&g_caches); cache; cache = cache->next)
+    {
+        in_use += atomic_load_explicit(&cache->in_use, memory_order_relaxed);
+    }
+    /* a thread may be counted before a free made elsewhere */
+    stats->in_use = in_use > 0 ? in_use : 0;
+    stats->reserved = atomic_load_explicit(&g_reserved,
+                                           memory_order_relaxed);
+}
@@ -0,0 +1,54 @@
+/*---------------------------------------------------------------------------*/
+/* slab.h                                                                    */
+/* Author: Yeonjae Kim                                                       */
+/*---------------------------------------------------------------------------*/
+#ifndef _SLAB_H
+#define _SLAB_H
+/*---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "common.h"
+/*---------------------------------------------------------------------------*/
+/*
+ * size-classed slab allocator for table entries.
+ *
+ * every thread keeps a free list per size class, and trades objects with
+ * a shared depot in batches, so that most allocations and frees touch no
+ * shared state. the depot carves new objects out of large slabs, which
+ * are never handed back to the system. frees are sized: the caller passes
+ * the size it allocated, so objects carry no header.
+ *
+ * sizes beyond the largest class go to malloc().
+ */
+/*---------------------------------------------------------------------------*/
+#define SLAB_SIZE (256 * 1024)   // bytes carved into objects at a time
+#define SLAB_MAX_SIZE 4096       // largest size class
+#define SLAB_BATCH 32            // objects moved to or from the depot
+#define SLAB_CACHE_MAX 128       // objects a thread keeps per class
+/*---------------------------------------------------------------------------*/
+struct slab_stats
+{
+    size_t in_use;     // bytes of the size classes handed out
+    size_t reserved;   // bytes taken from the system
+};
+/*---------------------------------------------------------------------------*/
+/**
+ * allocates size bytes.
+ * returns NULL when out of memory.
+ */
+void *slab_alloc(size_t size);
+/*---------------------------------------------------------------------------*/
+/**
+ * frees ptr, which was allocated with slab_alloc(size).
+ */
+void slab_free(void *ptr, size_t size);
+/*---------------------------------------------------------------------------*/
+/**
+ * collects the memory usage of all threads.
+ */
+void slab_stats(struct slab_stats *stats);
+/*---------------------------------------------------------------------------*/
+#endif // _SLAB_H
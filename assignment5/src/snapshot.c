@@ -0,0 +1,311 @@
+/*---------------------------------------------------------------------------*/
+/* snapshot.c                                                                */
+/* Author: Yeonjae Kim                                                       */
+/*---------------------------------------------------------------------------*/
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+#include "persist.h"
+/*---------------------------------------------------------------------------*/
+/* buffered output to one region of the file */
+struct snap_region
+{
+    off_t off;                // where buf goes
+    size_t len;
+    char buf[SNAPSHOT_BUF_SIZE];
+};
+/*---------------------------------------------------------------------------*/
+/* state of snapshot_save(), on the stack of the child */
+struct snap_writer
+{
+    int fd;
+    uint64_t count;
+    uint64_t limit;           // entries the index has room for
+    uint32_t crc;
+    struct snap_region index;
+    struct snap_region data;
+};
+/*---------------------------------------------------------------------------*/
+static int region_flush(int fd, struct snap_region *r)
+{
+    if (pwrite_all(fd, r->buf, r->len, r->off) < 0)
+    {
+        return -1;
+    }
+    r->off += r->len;
+    r->len = 0;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+region_put(int fd, struct snap_region *r, const void *data, size_t len)
+{
+    if (r->len + len > sizeof(r->buf))
+    {
+        if (region_flush(fd, r) < 0)
+        {
+            return -1;
+        }
+        if (len > sizeof(r->buf))
+        {
+            if (pwrite_all(fd, data, len, r->off) < 0)
+            {
+                return -1;
+            }
+            r->off += len;
+            return 0;
+        }
+    }
+    memcpy(r->buf + r->len, data, len);
+    r->len += len;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+snap_visit(void *arg, uint64_t hash, const char *key, const value_t *value)
+{
+    struct snap_writer *w = arg;
+    struct snapshot_ent ent;
+
+    if (w->count == w->limit)
+    {
+        /* the table changed after all */
+        return -1;
+    }
+
+    /* zeroed, so that the padding does not change the crc */
+    memset(&ent, 0, sizeof(ent));
+    ent.hash = hash;
+    ent.key_len = strlen(key);
+    memcpy(ent.key, key, ent.key_len);
+    ent.value_off = w->data.off + w->data.len;
+    ent.value_len = value->len;
+    ent.expire_at = value->expire_at;
+    w->crc = crc32_update(w->crc, &ent, sizeof(ent));
+    w->count++;
+
+    if (region_put(w->fd, &w->data, value->data, value->len + 1) < 0 ||
+        region_put(w->fd, &w->index, &ent, sizeof(ent)) < 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+int snapshot_save(hashtable_t *table, const char *path, uint64_t lsn)
+{
+    TRACE_PRINT();
+    struct snap_writer w;
+    struct snapshot_hdr hdr;
+    char tmp[PATH_MAX];
+
+    if (snprintf(tmp, sizeof(tmp), "%s%s", path, SNAPSHOT_TMP_SUFFIX) >=
+        (int)sizeof(tmp))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    w.fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w.fd < 0)
+    {
+        perror("open");
+        return -1;
+    }
+
+    /* the table is frozen, so the index size is known up front */
+    w.count = 0;
+    w.limit = hash_count(table);
+    w.crc = 0;
+    w.index.off = SNAPSHOT_INDEX_OFF;
+    w.index.len = 0;
+    w.data.off = SNAPSHOT_INDEX_OFF + w.limit * sizeof(struct snapshot_ent);
+    w.data.len = 0;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = SNAPSHOT_MAGIC;
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.lsn = lsn;
+    hdr.seed = table->seed;
+    hdr.data_off = w.data.off;
+    if (hash_foreach(table, snap_visit, &w) < 0 || w.count != w.limit ||
+        region_flush(w.fd, &w.index) < 0 ||
+        region_flush(w.fd, &w.data) < 0)
+    {
+        goto fail;
+    }
+    hdr.count = w.count;
+    hdr.data_len = w.data.off - hdr.data_off;
+    hdr.crc = w.crc;
+    if (pwrite_all(w.fd, &hdr, sizeof(hdr), 0) < 0 || fsync(w.fd) < 0)
+    {
+        goto fail;
+    }
+    if (close(w.fd) < 0)
+    {
+        w.fd = -1;
+        goto fail;
+    }
+    w.fd = -1;
+
+    /* the old snapshot stays until the new one is complete */
+    if (rename(tmp, path) < 0 || sync_dir(path) < 0)
+    {
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    perror("snapshot");
+    if (w.fd >= 0)
+    {
+        close(w.fd);
+    }
+    unlink(tmp);
+    return -1;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * checks that the header describes a file of size bytes.
+ * returns -1 when it does not.
+ * returns 0 otherwise.
+ */
+static int snapshot_check(const struct snapshot_hdr *hdr, size_t size)
+{
+    if (hdr->magic != SNAPSHOT_MAGIC || hdr->version != SNAPSHOT_VERSION)
+    {
+        return -1;
+    }
+    if (hdr->count > (size - SNAPSHOT_INDEX_OFF) /
+                     sizeof(struct snapshot_ent) ||
+        hdr->data_off != SNAPSHOT_INDEX_OFF +
+                         hdr->count * sizeof(struct snapshot_ent) ||
+        hdr->data_off > size || hdr->data_len != size - hdr->data_off)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+int snapshot_load(hashtable_t *table, const char *path, uint64_t *lsn,
+                  struct snapshot_map *map)
+{
+    TRACE_PRINT();
+    const struct snapshot_hdr *hdr;
+    const struct snapshot_ent *index, *ent;
+    struct stat st;
+    char *base;
+    value_t *value;
+    uint64_t i, h, now = ttl_now();
+    int fd, ret, rehash;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        if (errno == ENOENT)
+        {
+            return 0;
+        }
+        perror("open");
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < SNAPSHOT_INDEX_OFF)
+    {
+        close(fd);
+        goto corrupt;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+    map->base = base;
+    map->size = st.st_size;
+
+    hdr = (const struct snapshot_hdr *)base;
+    if (snapshot_check(hdr, map->size) < 0)
+    {
+        goto corrupt;
+    }
+    index = (const struct snapshot_ent *)(base + SNAPSHOT_INDEX_OFF);
+
+    /* the index is read through now, the values when they are asked for */
+    posix_madvise(base, hdr->data_off, POSIX_MADV_WILLNEED);
+    if (hdr->data_len)
+    {
+        posix_madvise(base + hdr->data_off, hdr->data_len,
+                      POSIX_MADV_RANDOM);
+    }
+    if (crc32_update(0, index, hdr->count * sizeof(*index)) != hdr->crc)
+    {
+        goto corrupt;
+    }
+
+    rehash = hash_set_seed(table, hdr->seed) < 0;
+    if (hash_reserve(table, hdr->count) < 0)
+    {
+        return -1;
+    }
+    for (i = 0; i < hdr->count; i++)
+    {
+        ent = &index[i];
+        if (ent->key_len > MAX_KEY_LEN || ent->key[ent->key_len] != '\0' ||
+            ent->value_off < hdr->data_off || ent->value_off > map->size ||
+            ent->value_len >= map->size - ent->value_off ||
+            base[ent->value_off + ent->value_len] != '\0')
+        {
+            goto corrupt;
+        }
+        if (i == 0 && !rehash && hash_key(table, ent->key) != ent->hash)
+        {
+            /* made with another hash function */
+            rehash = 1;
+        }
+        if (ent->expire_at && ent->expire_at <= now)
+        {
+            continue;
+        }
+        h = rehash ? hash_key(table, ent->key) : ent->hash;
+
+        value = value_wrap(base + ent->value_off, ent->value_len);
+        if (value == NULL)
+        {
+            return -1;
+        }
+        value->expire_at = ent->expire_at;
+        ret = hash_insert_mapped(table, h, ent->key, value);
+        if (ret <= 0)
+        {
+            value_put(value);
+        }
+        if (ret < 0)
+        {
+            return -1;
+        }
+    }
+    *lsn = hdr->lsn;
+
+    return 1;
+
+corrupt:
+    fprintf(stderr, "Snapshot %s is corrupt\n", path);
+    return -1;
+}
+/*---------------------------------------------------------------------------*/
+void snapshot_unmap(struct snapshot_map *map)
+{
+    if (map->base)
+    {
+        munmap(map->base, map->size);
+        map->base = NULL;
+    }
+}
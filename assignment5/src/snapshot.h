@@ -0,0 +1,99 @@
+/*---------------------------------------------------------------------------*/
+/* snapshot.h                                                                */
+/* Author: Yeonjae Kim                                                       */
+/*---------------------------------------------------------------------------*/
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+/*---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "hashtable.h"
+#include "common.h"
+/*---------------------------------------------------------------------------*/
+/*
+ * point-in-time snapshots of a table.
+ *
+ * the server forks with the table frozen, and the child writes the
+ * snapshot from its copy-on-write image of the table while the parent
+ * goes on serving. the file is written next to path and renamed over it
+ * once synced, so a crash leaves the previous snapshot intact.
+ *
+ * the file is laid out to be served from where it is mapped:
+ *   header | index: an entry per key | data: the values
+ * an index entry takes a cache line, holding the key's hash, the key
+ * itself, its expiry, and the offset of the value, null-terminated in
+ * the data. entries that have expired by the time it is loaded are left
+ * out.
+ * loading maps the file and walks the index only; the table points at the
+ * keys and values in the mapping, and the pages of a value are read on
+ * its first access. an update copies the new value to the heap as usual.
+ *
+ * hashes are only valid with the seed they were made with, which the
+ * header keeps. the crc covers the index but not the data, whose pages
+ * would all have to be read to check it.
+ */
+/*---------------------------------------------------------------------------*/
+#define SNAPSHOT_MAGIC 0x50414e53u     // "SNAP"
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_INDEX_OFF 64          // the index starts on a cache line
+#define SNAPSHOT_TMP_SUFFIX ".tmp"
+#define SNAPSHOT_BUF_SIZE (32 * 1024)  // bytes written at a time per region
+/*---------------------------------------------------------------------------*/
+struct snapshot_hdr
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t lsn;             // last log record the snapshot holds
+    uint64_t count;           // index entries
+    uint64_t seed;            // of the table the hashes were made in
+    uint64_t data_off;        // the index ends there
+    uint64_t data_len;
+    uint32_t crc;             // of the index
+    uint32_t reserved;
+};
+/*---------------------------------------------------------------------------*/
+struct snapshot_ent
+{
+    uint64_t hash;
+    uint64_t value_off;       // from the start of the file
+    uint64_t expire_at;       // ms since the epoch, or 0 for never
+    uint32_t value_len;       // without the null terminator
+    uint8_t key_len;
+    char key[MAX_KEY_LEN + 1];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+/*---------------------------------------------------------------------------*/
+/* a loaded snapshot, mapped as long as the table refers to it */
+struct snapshot_map
+{
+    void *base;
+    size_t size;
+};
+/*---------------------------------------------------------------------------*/
+/**
+ * writes every entry of the table to path, taking no lock and allocating
+ * nothing, for a child forked with the table frozen.
+ * returns -1 when any errors occur.
+ * returns 0 on success.
+ */
+int snapshot_save(hashtable_t *table, const char *path, uint64_t lsn);
+/*---------------------------------------------------------------------------*/
+/**
+ * maps the snapshot at path and inserts its entries to the empty table,
+ * adopting the seed of the snapshot, and sets *lsn.
+ * map is set as soon as the file is mapped, and should be released with
+ * snapshot_unmap() only after the table is destroyed, even on failure.
+ * returns -1 when the snapshot is unreadable or corrupt.
+ * returns 0 when there is no snapshot.
+ * returns 1 on success.
+ */
+int snapshot_load(hashtable_t *table, const char *path, uint64_t *lsn,
+                  struct snapshot_map *map);
+/*---------------------------------------------------------------------------*/
+/**
+ * unmaps a loaded snapshot, if any.
+ */
+void snapshot_unmap(struct snapshot_map *map);
+/*---------------------------------------------------------------------------*/
+#endif // _SNAPSHOT_H
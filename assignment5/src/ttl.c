@@ -0,0 +1,246 @@
+/*---------------------------------------------------------------------------*/
+/* ttl.c                                                                     */
+/* Author: Yeonjae Kim                                                       */
+/*---------------------------------------------------------------------------*/
+#include <time.h>
+#include "ttl.h"
+#include "slab.h"
+/*---------------------------------------------------------------------------*/
+#define TTL_MASK (TTL_SLOTS - 1)
+/* ticks from now the wheel reaches */
+#define TTL_REACH (1ull << (TTL_BITS * TTL_LEVELS))
+/*---------------------------------------------------------------------------*/
+uint64_t ttl_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * puts a timer in its slot, relative to the tick the shard is at.
+ * the tick is rounded up, so that a timer never fires early.
+ * the caller holds the shard lock.
+ */
+static void shard_place(struct ttl_shard *shard, struct ttl_timer *timer)
+{
+    uint64_t when, diff;
+    int level;
+
+    when = (timer->expire_at + TTL_TICK_MS - 1) / TTL_TICK_MS;
+    if (when < shard->tick)
+    {
+        /* due already */
+        when = shard->tick;
+    }
+    diff = when - shard->tick;
+    if (diff >= TTL_REACH)
+    {
+        /* parked, and placed again once the top level comes around */
+        when = shard->tick + TTL_REACH - 1;
+        diff = TTL_REACH - 1;
+    }
+
+    for (level = 0; level < TTL_LEVELS - 1; level++)
+    {
+        if (diff < 1ull << (TTL_BITS * (level + 1)))
+        {
+            break;
+        }
+    }
+    timer->next = shard->slots[level][(when >> (TTL_BITS * level)) &
+                                      TTL_MASK];
+    shard->slots[level][(when >> (TTL_BITS * level)) & TTL_MASK] = timer;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * runs the tick the shard is at: whenever a level turns over, the slot
+ * of the level above that comes next moves down, and then the timers of
+ * the tick's slot fire.
+ * the caller holds the shard lock.
+ */
+static void shard_tick(struct ttl_shard *shard)
+{
+    struct ttl_timer *timer, *next;
+    uint64_t t = shard->tick;
+    int level;
+
+    for (level = 1; level < TTL_LEVELS; level++)
+    {
+        if ((t >> (TTL_BITS * (level - 1))) & TTL_MASK)
+        {
+            break;
+        }
+        timer = shard->slots[level][(t >> (TTL_BITS * level)) & TTL_MASK];
+        shard->slots[level][(t >> (TTL_BITS * level)) & TTL_MASK] = NULL;
+        for (; timer; timer = next)
+        {
+            next = timer->next;
+            shard_place(shard, timer);
+        }
+    }
+
+    timer = shard->slots[0][t & TTL_MASK];
+    shard->slots[0][t & TTL_MASK] = NULL;
+    for (; timer; timer = next)
+    {
+        next = timer->next;
+        if ((timer->expire_at + TTL_TICK_MS - 1) / TTL_TICK_MS > t)
+        {
+            /* a parked timer that is not due yet */
+            shard->tick = t + 1;
+            shard_place(shard, timer);
+            shard->tick = t;
+            continue;
+        }
+        timer->next = shard->due;
+        shard->due = timer;
+    }
+    shard->tick = t + 1;
+}
+/*---------------------------------------------------------------------------*/
+static void timer_free_list(struct ttl_timer *timer)
+{
+    struct ttl_timer *next;
+
+    for (; timer; timer = next)
+    {
+        next = timer->next;
+        slab_free(timer, sizeof(*timer));
+    }
+}
+/*---------------------------------------------------------------------------*/
+struct ttl_wheel *ttl_init(void)
+{
+    TRACE_PRINT();
+    struct ttl_wheel *wheel;
+    uint64_t tick = ttl_now() / TTL_TICK_MS;
+    int i;
+
+    wheel = aligned_alloc(CACHE_LINE_SIZE, sizeof(*wheel));
+    if (wheel == NULL)
+    {
+        return NULL;
+    }
+    memset(wheel, 0, sizeof(*wheel));
+
+    for (i = 0; i < TTL_SHARDS; i++)
+    {
+        pthread_mutex_init(&wheel->shards[i].lock, NULL);
+        wheel->shards[i].tick = tick;
+    }
+    atomic_init(&wheel->next_shard, 0);
+    atomic_init(&wheel->idle_until, tick);
+
+    return wheel;
+}
+/*---------------------------------------------------------------------------*/
+void ttl_destroy(struct ttl_wheel *wheel)
+{
+    TRACE_PRINT();
+    struct ttl_shard *shard;
+    int i, level, slot;
+
+    for (i = 0; i < TTL_SHARDS; i++)
+    {
+        shard = &wheel->shards[i];
+        for (level = 0; level < TTL_LEVELS; level++)
+        {
+            for (slot = 0; slot < TTL_SLOTS; slot++)
+            {
+                timer_free_list(shard->slots[level][slot]);
+            }
+        }
+        timer_free_list(shard->due);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(wheel);
+}
+/*---------------------------------------------------------------------------*/
+int ttl_add(struct ttl_wheel *wheel, uint64_t hash, const char *key,
+            uint64_t expire_at)
+{
+    TRACE_PRINT();
+    struct ttl_shard *shard = &wheel->shards[hash % TTL_SHARDS];
+    struct ttl_timer *timer;
+
+    timer = slab_alloc(sizeof(*timer));
+    if (timer == NULL)
+    {
+        return -1;
+    }
+    timer->hash = hash;
+    timer->expire_at = expire_at;
+    strncpy(timer->key, key, MAX_KEY_LEN);
+    timer->key[MAX_KEY_LEN] = '\0';
+
+    pthread_mutex_lock(&shard->lock);
+    shard_place(shard, timer);
+    pthread_mutex_unlock(&shard->lock);
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+int ttl_expire(struct ttl_wheel *wheel, uint64_t now,
+               ttl_fire_fn_t fn, void *arg)
+{
+    struct ttl_shard *shard;
+    struct ttl_timer *fired = NULL, *timer, *next;
+    uint64_t tick = now / TTL_TICK_MS;
+    unsigned int start;
+    int i, n = 0, all = 1;
+
+    if (tick < atomic_load_explicit(&wheel->idle_until,
+                                    memory_order_relaxed))
+    {
+        /* what is due has been handed out already */
+        return 0;
+    }
+
+    start = atomic_fetch_add_explicit(&wheel->next_shard, 1,
+                                      memory_order_relaxed);
+    for (i = 0; i < TTL_SHARDS && n < TTL_BATCH; i++)
+    {
+        shard = &wheel->shards[(start + i) % TTL_SHARDS];
+        if (pthread_mutex_trylock(&shard->lock) != 0)
+        {
+            /* someone else is on it */
+            all = 0;
+            continue;
+        }
+        while (shard->tick <= tick)
+        {
+            shard_tick(shard);
+        }
+        while (shard->due && n < TTL_BATCH)
+        {
+            timer = shard->due;
+            shard->due = timer->next;
+            timer->next = fired;
+            fired = timer;
+            n++;
+        }
+        if (shard->due)
+        {
+            all = 0;
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+    if (all && i == TTL_SHARDS)
+    {
+        atomic_store_explicit(&wheel->idle_until, tick + 1,
+                              memory_order_relaxed);
+    }
+
+    /* the wheel is unlocked, so that fn may take the table's locks */
+    for (timer = fired; timer; timer = next)
+    {
+        next = timer->next;
+        fn(arg, timer->hash, timer->key);
+        slab_free(timer, sizeof(*timer));
+    }
+
+    return n;
+}
@@ -0,0 +1,99 @@
+/*---------------------------------------------------------------------------*/
+/* ttl.h                                                                     */
+/* Author: Yeonjae Kim                                                       */
+/*---------------------------------------------------------------------------*/
+#ifndef _TTL_H
+#define _TTL_H
+/*---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "common.h"
+/*---------------------------------------------------------------------------*/
+/*
+ * expiry timers of keys, on a hierarchical timer wheel.
+ *
+ * level 0 of the wheel has a slot per tick, and every level above has a
+ * slot per turn of the level below. a timer goes to the lowest level
+ * whose span reaches it, and moves a level down whenever the wheel turns
+ * to its slot, so adding and firing a timer take constant time however
+ * many keys there are, and no key is ever scanned for. a timer beyond
+ * the reach of the wheel is parked in its top level, and placed again
+ * when it comes around.
+ *
+ * the wheel is split into shards by hash, each with its own lock, and the
+ * workers advance the shards a batch of timers at a time, skipping a
+ * shard someone else is advancing. a fired timer only says that the key
+ * may have expired: it may have been deleted or given a later expiry
+ * meanwhile, which the caller checks.
+ */
+/*---------------------------------------------------------------------------*/
+#define TTL_TICK_MS 100             // granularity of the wheel
+#define TTL_BITS 6
+#define TTL_SLOTS (1 << TTL_BITS)   // per level
+#define TTL_LEVELS 4                // reaching 2^24 ticks, about 19 days
+#define TTL_SHARDS 16
+#define TTL_BATCH 64                // timers fired per ttl_expire()
+/*---------------------------------------------------------------------------*/
+struct ttl_timer
+{
+    struct ttl_timer *next;
+    uint64_t hash;
+    uint64_t expire_at;       // ms since the epoch
+    char key[MAX_KEY_LEN + 1];
+};
+/*---------------------------------------------------------------------------*/
+struct ttl_shard
+{
+    pthread_mutex_t lock;
+    uint64_t tick;            // the next tick to run
+    struct ttl_timer *due;    // fired, not handed out yet
+    struct ttl_timer *slots[TTL_LEVELS][TTL_SLOTS];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+/*---------------------------------------------------------------------------*/
+struct ttl_wheel
+{
+    struct ttl_shard shards[TTL_SHARDS];
+    atomic_uint next_shard;   // where the next ttl_expire() starts
+    _Atomic uint64_t idle_until; // no timer fires before this tick
+};
+/*---------------------------------------------------------------------------*/
+/* called for every fired timer, with no lock of the wheel held */
+typedef void (*ttl_fire_fn_t)(void *arg, uint64_t hash, const char *key);
+/*---------------------------------------------------------------------------*/
+/**
+ * returns the current time in ms since the epoch, as expiries are kept.
+ */
+uint64_t ttl_now(void);
+/*---------------------------------------------------------------------------*/
+/**
+ * creates an empty wheel starting at the current time.
+ * returns NULL when any internal errors occur.
+ */
+struct ttl_wheel *ttl_init(void);
+/*---------------------------------------------------------------------------*/
+/**
+ * frees the wheel and every timer on it.
+ */
+void ttl_destroy(struct ttl_wheel *wheel);
+/*---------------------------------------------------------------------------*/
+/**
+ * adds a timer for key, whose hash is hash, at expire_at.
+ * returns -1 when any internal errors occur.
+ * returns 0 on success.
+ */
+int ttl_add(struct ttl_wheel *wheel, uint64_t hash, const char *key,
+            uint64_t expire_at);
+/*---------------------------------------------------------------------------*/
+/**
+ * advances the wheel to now, and calls fn for at most TTL_BATCH timers
+ * that have fired, which are freed afterwards.
+ * returns the number of timers fired.
+ */
+int ttl_expire(struct ttl_wheel *wheel, uint64_t now,
+               ttl_fire_fn_t fn, void *arg);
+/*---------------------------------------------------------------------------*/
+#endif // _TTL_H
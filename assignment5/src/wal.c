@@ -0,0 +1,618 @@
+/*---------------------------------------------------------------------------*/
+/* wal.c                                                                     */
+/* Author: Yeonjae Kim                                                       */
+/*---------------------------------------------------------------------------*/
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "wal.h"
+#include "persist.h"
+/*---------------------------------------------------------------------------*/
+static __thread uint64_t t_lsn;
+/*---------------------------------------------------------------------------*/
+static uint32_t
+wal_crc(const struct wal_hdr *hdr, const char *key, const char *value)
+{
+    uint32_t crc;
+
+    crc = crc32_update(0, &hdr->op, sizeof(*hdr) - sizeof(hdr->crc));
+    crc = crc32_update(crc, key, hdr->key_len);
+
+    return crc32_update(crc, value, hdr->value_len);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * opens the log file at path, and leaves it positioned at the first
+ * record. a new or empty file gets a header starting after base, which
+ * is then synced with the directory entry.
+ * returns -1 when any errors occur, with errno set.
+ * returns the descriptor on success, with *file_base set.
+ */
+static int
+wal_open_file(const char *path, int create, uint64_t base,
+              uint64_t *file_base)
+{
+    struct wal_file_hdr fhdr;
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDWR | (create ? O_CREAT : 0), 0644);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    if (st.st_size < (off_t)sizeof(fhdr))
+    {
+        /* new, or its header never made it to the disk */
+        memset(&fhdr, 0, sizeof(fhdr));
+        fhdr.magic = WAL_MAGIC;
+        fhdr.base_lsn = base;
+        if (ftruncate(fd, 0) < 0 ||
+            write_all(fd, &fhdr, sizeof(fhdr)) < 0 ||
+            fdatasync(fd) < 0 || sync_dir(path) < 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    else if (pread(fd, &fhdr, sizeof(fhdr), 0) != sizeof(fhdr) ||
+             fhdr.magic != WAL_MAGIC ||
+             lseek(fd, sizeof(fhdr), SEEK_SET) < 0)
+    {
+        DEBUG_PRINT("%s is not a log", path);
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    *file_base = fhdr.base_lsn;
+
+    return fd;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * applies the intact records of the log file after from_lsn, reading
+ * from the current position of fd. the records of the file start after
+ * base.
+ * returns -1 when any internal errors occur.
+ * returns the size of the intact records on success.
+ */
+static off_t wal_replay(int fd, uint64_t base, uint64_t from_lsn,
+                        wal_apply_fn_t apply, void *arg)
+{
+    struct wal_hdr hdr;
+    char key[UINT8_MAX + 1], *value = NULL, *tmp;
+    size_t cap = 0;
+    off_t good = 0;
+    FILE *fp;
+
+    fp = fdopen(dup(fd), "r");
+    if (fp == NULL)
+    {
+        return -1;
+    }
+
+    while (fread(&hdr, sizeof(hdr), 1, fp) == 1)
+    {
+        if (hdr.value_len > WAL_MAX_VALUE_LEN)
+        {
+            break;
+        }
+        if (hdr.value_len + 1 > cap)
+        {
+            tmp = realloc(value, hdr.value_len + 1);
+            if (tmp == NULL)
+            {
+                free(value);
+                fclose(fp);
+                return -1;
+            }
+            value = tmp;
+            cap = hdr.value_len + 1;
+        }
+        if (fread(key, 1, hdr.key_len, fp) != hdr.key_len ||
+            fread(value, 1, hdr.value_len, fp) != hdr.value_len ||
+            wal_crc(&hdr, key, value) != hdr.crc)
+        {
+            /* torn or corrupt tail */
+            break;
+        }
+        good += sizeof(hdr) + hdr.key_len + hdr.value_len;
+        if (base + good <= from_lsn)
+        {
+            /* already in the snapshot */
+            continue;
+        }
+        key[hdr.key_len] = '\0';
+        value[hdr.value_len] = '\0';
+        apply(arg, hdr.op, key, value, hdr.value_len);
+    }
+
+    free(value);
+    fclose(fp);
+
+    return good;
+}
+/*---------------------------------------------------------------------------*/
+static long elapsed_ms(const struct timespec *since)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - since->tv_sec) * 1000 +
+           (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * moves the current log file to <path>.old and starts a new one after
+ * lsn, which the retired file ends at. called by the flusher only.
+ * returns -1 when any errors occur.
+ * returns 0 on success.
+ */
+static int wal_switch(struct wal *wal, uint64_t lsn)
+{
+    uint64_t base;
+    int fd;
+
+    if (rename(wal->path, wal->old_path) < 0)
+    {
+        return -1;
+    }
+    /* syncing the directory for the new file covers the rename too */
+    fd = wal_open_file(wal->path, 1, lsn, &base);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    close(wal->fd);
+    wal->fd = fd;
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * tells the writer set with wal_set_notify() how far the log is durable.
+ * called by the flusher with the lock held, which it drops meanwhile.
+ */
+static void wal_notify(struct wal *wal)
+{
+    wal_notify_fn_t fn = wal->notify;
+    void *arg = wal->notify_arg;
+    uint64_t lsn;
+
+    if (fn == NULL)
+    {
+        return;
+    }
+    lsn = wal->error ? UINT64_MAX : atomic_load(&wal->durable_lsn);
+    pthread_mutex_unlock(&wal->lock);
+    fn(arg, lsn);
+    pthread_mutex_lock(&wal->lock);
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * writes and syncs the appended records in batches.
+ * the buffer is swapped out under the lock, so appends go on while the
+ * previous batch is being synced. the records of a rotation go first,
+ * to the file being retired.
+ */
+static void *wal_flusher(void *arg)
+{
+    struct wal *wal = arg;
+    struct timespec start, pause;
+    char *buf, *spare = NULL;
+    size_t len, cap = 0, spare_cap = 0;
+    uint64_t lsn;
+    long left;
+    int ret, rotate;
+
+    pthread_mutex_lock(&wal->lock);
+    for (;;)
+    {
+        while (wal->len == 0 && !wal->rotating && !wal->stop)
+        {
+            pthread_cond_wait(&wal->work, &wal->lock);
+        }
+
+        rotate = wal->rotating;
+        if (rotate)
+        {
+            buf = wal->rot_buf;
+            len = wal->rot_len;
+            lsn = wal->rot_lsn;
+            wal->rot_buf = NULL;
+        }
+        else if (wal->len == 0)
+        {
+            break;
+        }
+        else
+        {
+            /* take the batch, leaving the spare buffer for new records */
+            buf = wal->buf;
+            len = wal->len;
+            cap = wal->cap;
+            lsn = wal->lsn;
+            wal->buf = spare;
+            wal->cap = spare_cap;
+            wal->len = 0;
+        }
+        ret = wal->error ? -1 : 0;
+        pthread_mutex_unlock(&wal->lock);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (ret == 0 && (write_all(wal->fd, buf, len) < 0 ||
+                         fdatasync(wal->fd) < 0 ||
+                         (rotate && wal_switch(wal, lsn) < 0)))
+        {
+            perror("wal");
+            ret = -1;
+        }
+        if (rotate)
+        {
+            free(buf);
+        }
+        else
+        {
+            spare = buf;
+            spare_cap = cap;
+        }
+
+        pthread_mutex_lock(&wal->lock);
+        if (ret < 0)
+        {
+            /* a hole in the log would break replay, so stop logging */
+            wal->error = 1;
+        }
+        else
+        {
+            atomic_store(&wal->durable_lsn, lsn);
+        }
+        if (rotate)
+        {
+            wal->rotating = 0;
+            if (ret == 0)
+            {
+                wal->old_lsn = lsn;
+            }
+            /* the records appended since may be waiting already */
+            pthread_cond_broadcast(&wal->synced);
+            wal_notify(wal);
+            continue;
+        }
+        pthread_cond_broadcast(&wal->synced);
+        wal_notify(wal);
+
+        /* let the records of the next batch pile up */
+        left = wal->interval - elapsed_ms(&start);
+        if (left > 0 && !wal->stop)
+        {
+            pthread_mutex_unlock(&wal->lock);
+            pause.tv_sec = left / 1000;
+            pause.tv_nsec = (left % 1000) * 1000000;
+            nanosleep(&pause, NULL);
+            pthread_mutex_lock(&wal->lock);
+        }
+    }
+    pthread_mutex_unlock(&wal->lock);
+    free(spare);
+
+    return NULL;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * replays the log file at path and cuts its torn tail. a file whose
+ * records all come before lsn is emptied, so that new records are not
+ * numbered below the snapshot.
+ * returns -1 when any errors occur.
+ * returns the descriptor positioned at the end on success, with *lsn
+ * moved past its records.
+ */
+static int
+wal_load(const char *path, int create, uint64_t from_lsn, uint64_t *lsn,
+         wal_apply_fn_t apply, void *arg)
+{
+    uint64_t base;
+    off_t good;
+    int fd;
+
+    fd = wal_open_file(path, create, *lsn, &base);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    good = wal_replay(fd, base, from_lsn, apply, arg);
+    if (good < 0)
+    {
+        DEBUG_PRINT("Failed to replay %s", path);
+        close(fd);
+        return -1;
+    }
+    if (base + good < *lsn)
+    {
+        /* behind the snapshot, see wal_open_file() */
+        if (ftruncate(fd, 0) < 0)
+        {
+            close(fd);
+            return -1;
+        }
+        close(fd);
+        return wal_open_file(path, create, *lsn, &base);
+    }
+
+    /* cut a torn tail, so that new records follow the intact ones */
+    if (ftruncate(fd, sizeof(struct wal_file_hdr) + good) < 0 ||
+        lseek(fd, 0, SEEK_END) < 0 || fdatasync(fd) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    *lsn = base + good;
+
+    return fd;
+}
+/*---------------------------------------------------------------------------*/
+struct wal *wal_open(const char *path, int interval, uint64_t from_lsn,
+                     wal_apply_fn_t apply, void *arg)
+{
+    TRACE_PRINT();
+    struct wal *wal;
+    uint64_t lsn = from_lsn;
+    int fd;
+
+    wal = calloc(1, sizeof(struct wal));
+    if (wal == NULL)
+    {
+        return NULL;
+    }
+    wal->interval = interval;
+    wal->path = strdup(path);
+    wal->old_path = malloc(strlen(path) + sizeof(WAL_OLD_SUFFIX));
+    if (wal->path == NULL || wal->old_path == NULL)
+    {
+        goto fail;
+    }
+    sprintf(wal->old_path, "%s%s", path, WAL_OLD_SUFFIX);
+
+    /* left by a snapshot that did not complete */
+    fd = wal_load(wal->old_path, 0, from_lsn, &lsn, apply, arg);
+    if (fd >= 0)
+    {
+        close(fd);
+        if (lsn > from_lsn)
+        {
+            wal->old_lsn = lsn;
+        }
+        else if (unlink(wal->old_path) < 0)
+        {
+            goto fail;
+        }
+    }
+    else if (errno != ENOENT)
+    {
+        goto fail;
+    }
+
+    wal->fd = wal_load(path, 1, from_lsn, &lsn, apply, arg);
+    if (wal->fd < 0)
+    {
+        goto fail;
+    }
+    wal->lsn = lsn;
+    atomic_init(&wal->durable_lsn, lsn);
+
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_cond_init(&wal->work, NULL);
+    pthread_cond_init(&wal->synced, NULL);
+    if (pthread_create(&wal->flusher, NULL, wal_flusher, wal) != 0)
+    {
+        DEBUG_PRINT("Failed to start the log flusher");
+        pthread_mutex_destroy(&wal->lock);
+        pthread_cond_destroy(&wal->work);
+        pthread_cond_destroy(&wal->synced);
+        close(wal->fd);
+        errno = EAGAIN;
+        goto fail;
+    }
+
+    return wal;
+
+fail:
+    perror("wal");
+    free(wal->path);
+    free(wal->old_path);
+    free(wal);
+    return NULL;
+}
+/*---------------------------------------------------------------------------*/
+void wal_close(struct wal *wal)
+{
+    TRACE_PRINT();
+
+    pthread_mutex_lock(&wal->lock);
+    wal->stop = 1;
+    pthread_cond_signal(&wal->work);
+    pthread_mutex_unlock(&wal->lock);
+    pthread_join(wal->flusher, NULL);
+
+    close(wal->fd);
+    pthread_mutex_destroy(&wal->lock);
+    pthread_cond_destroy(&wal->work);
+    pthread_cond_destroy(&wal->synced);
+    free(wal->buf);
+    free(wal->path);
+    free(wal->old_path);
+    free(wal);
+}
+/*---------------------------------------------------------------------------*/
+uint64_t wal_append(struct wal *wal, int op, const char *key,
+                    size_t key_len, const char *value, size_t value_len)
+{
+    struct wal_hdr hdr;
+    size_t size = sizeof(hdr) + key_len + value_len, cap;
+    uint64_t lsn;
+    char *buf;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.op = op;
+    hdr.key_len = key_len;
+    hdr.value_len = value_len;
+    hdr.crc = wal_crc(&hdr, key, value);
+
+    pthread_mutex_lock(&wal->lock);
+    if (wal->len + size > wal->cap)
+    {
+        cap = wal->cap ? wal->cap * 2 : BUFFER_SIZE;
+        while (cap < wal->len + size)
+        {
+            cap *= 2;
+        }
+        buf = realloc(wal->buf, cap);
+        if (buf == NULL)
+        {
+            /* the change is applied but cannot be logged */
+            wal->error = 1;
+            pthread_cond_broadcast(&wal->synced);
+            pthread_mutex_unlock(&wal->lock);
+            return 0;
+        }
+        wal->buf = buf;
+        wal->cap = cap;
+    }
+
+    memcpy(wal->buf + wal->len, &hdr, sizeof(hdr));
+    memcpy(wal->buf + wal->len + sizeof(hdr), key, key_len);
+    if (value_len)
+    {
+        memcpy(wal->buf + wal->len + sizeof(hdr) + key_len, value,
+               value_len);
+    }
+    if (wal->len == 0)
+    {
+        /* the flusher only waits on an empty buffer */
+        pthread_cond_signal(&wal->work);
+    }
+    wal->len += size;
+    wal->lsn += size;
+    lsn = wal->lsn;
+    pthread_mutex_unlock(&wal->lock);
+
+    t_lsn = lsn;
+    return lsn;
+}
+/*---------------------------------------------------------------------------*/
+uint64_t wal_thread_lsn(void)
+{
+    return t_lsn;
+}
+/*---------------------------------------------------------------------------*/
+int wal_wait(struct wal *wal, uint64_t lsn)
+{
+    int ret;
+
+    if (atomic_load(&wal->durable_lsn) >= lsn)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    while (atomic_load(&wal->durable_lsn) < lsn && !wal->error)
+    {
+        pthread_cond_wait(&wal->synced, &wal->lock);
+    }
+    ret = wal->error ? -1 : 0;
+    pthread_mutex_unlock(&wal->lock);
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+int wal_synced(struct wal *wal, uint64_t lsn)
+{
+    int ret;
+
+    if (atomic_load(&wal->durable_lsn) >= lsn)
+    {
+        return 1;
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    ret = wal->error ? -1 : atomic_load(&wal->durable_lsn) >= lsn;
+    pthread_mutex_unlock(&wal->lock);
+
+    return ret;
+}
+/*---------------------------------------------------------------------------*/
+void wal_set_notify(struct wal *wal, wal_notify_fn_t fn, void *arg)
+{
+    TRACE_PRINT();
+
+    pthread_mutex_lock(&wal->lock);
+    wal->notify = fn;
+    wal->notify_arg = arg;
+    pthread_mutex_unlock(&wal->lock);
+}
+/*---------------------------------------------------------------------------*/
+uint64_t wal_lsn(struct wal *wal)
+{
+    uint64_t lsn;
+
+    pthread_mutex_lock(&wal->lock);
+    lsn = wal->lsn;
+    pthread_mutex_unlock(&wal->lock);
+
+    return lsn;
+}
+/*---------------------------------------------------------------------------*/
+int wal_rotate(struct wal *wal)
+{
+    TRACE_PRINT();
+
+    pthread_mutex_lock(&wal->lock);
+    if (wal->old_lsn || wal->rotating || wal->error)
+    {
+        /* the kept file would be overwritten */
+        pthread_mutex_unlock(&wal->lock);
+        return -1;
+    }
+    wal->rot_buf = wal->buf;
+    wal->rot_len = wal->len;
+    wal->rot_lsn = wal->lsn;
+    wal->rotating = 1;
+    wal->buf = NULL;
+    wal->len = wal->cap = 0;
+    pthread_cond_signal(&wal->work);
+    pthread_mutex_unlock(&wal->lock);
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+void wal_drop_old(struct wal *wal, uint64_t lsn)
+{
+    TRACE_PRINT();
+
+    pthread_mutex_lock(&wal->lock);
+    while (wal->rotating && !wal->error)
+    {
+        pthread_cond_wait(&wal->synced, &wal->lock);
+    }
+    /* under the lock, so that no rotation renames a file meanwhile */
+    if (wal->old_lsn && wal->old_lsn <= lsn)
+    {
+        if (unlink(wal->old_path) < 0 && errno != ENOENT)
+        {
+            perror("unlink");
+        }
+        else
+        {
+            wal->old_lsn = 0;
+        }
+    }
+    pthread_mutex_unlock(&wal->lock);
+}
@@ -0,0 +1,169 @@
+/*---------------------------------------------------------------------------*/
+/* wal.h                                                                     */
+/* Author: Yeonjae Kim                                                       */
+/*---------------------------------------------------------------------------*/
+#ifndef _WAL_H
+#define _WAL_H
+/*---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "common.h"
+/*---------------------------------------------------------------------------*/
+/*
+ * append-only write-ahead log with group commit.
+ *
+ * writers append records to an in-memory buffer and get the log sequence
+ * number (lsn) of the record, which is the number of record bytes ever
+ * logged up to and including it. a flusher thread writes the buffer out
+ * and syncs it, at most once per interval, so a single fdatasync() covers
+ * the records of every worker appended meanwhile. a writer that must not
+ * acknowledge before its records are durable waits for their lsn, or is
+ * told once it passes, see wal_set_notify().
+ *
+ * the file starts with a header holding the lsn it starts after, and
+ * records follow, each a header followed by the key and the value:
+ *   crc (4) | op (1) | key_len (1) | reserved (2) | value_len (4)
+ * the crc covers everything after itself. replay stops at the first
+ * record that is short or fails its crc, and the log is cut there, since
+ * only the tail of a crashed write can be torn.
+ *
+ * once a snapshot holds everything up to some lsn, the log is rotated:
+ * the records so far move to <path>.old, which is removed when the
+ * snapshot is complete. replay skips the records the snapshot holds.
+ */
+/*---------------------------------------------------------------------------*/
+#define WAL_DEFAULT_INTERVAL 2        // ms between syncs
+#define WAL_MAX_VALUE_LEN (1u << 30)  // larger lengths mean a corrupt record
+#define WAL_MAGIC 0x4c41574bu         // "KWAL"
+#define WAL_OLD_SUFFIX ".old"
+/*---------------------------------------------------------------------------*/
+struct wal_file_hdr
+{
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t base_lsn;        // lsn of the record before the first one
+};
+/*---------------------------------------------------------------------------*/
+struct wal_hdr
+{
+    uint32_t crc;
+    uint8_t op;
+    uint8_t key_len;
+    uint16_t reserved;
+    uint32_t value_len;
+};
+/*---------------------------------------------------------------------------*/
+/**
+ * tells how far the log is durable, or UINT64_MAX once it failed, so that
+ * every waiter looks. called by the flusher, without the lock.
+ */
+typedef void (*wal_notify_fn_t)(void *arg, uint64_t durable_lsn);
+/*---------------------------------------------------------------------------*/
+struct wal
+{
+    int fd;                   // used by the flusher only
+    int interval;             // ms
+    char *path;
+    char *old_path;
+    pthread_t flusher;
+
+    pthread_mutex_t lock;     // protects everything below
+    pthread_cond_t work;      // records appended, rotating, or stopping
+    pthread_cond_t synced;    // durable_lsn advanced, or rotated
+    char *buf;                // records not written yet
+    size_t len;
+    size_t cap;
+    uint64_t lsn;             // lsn of the last appended record
+    int error;                // writing the log failed, nothing is durable
+    int stop;
+    wal_notify_fn_t notify;   // called as durable_lsn advances, or NULL
+    void *notify_arg;
+
+    /* records appended before wal_rotate(), for the file being retired */
+    char *rot_buf;
+    size_t rot_len;
+    uint64_t rot_lsn;
+    int rotating;
+    uint64_t old_lsn;         // lsn <path>.old ends at, 0 without one
+
+    /* read without the lock by writers checking whether to wait */
+    _Atomic uint64_t durable_lsn;
+};
+/*---------------------------------------------------------------------------*/
+/* applies a replayed record, with the value null-terminated */
+typedef void (*wal_apply_fn_t)(void *arg, int op, const char *key,
+                               const char *value, size_t value_len);
+/*---------------------------------------------------------------------------*/
+/**
+ * opens or creates the log at path, replays the records after from_lsn
+ * through apply, first those of <path>.old if it is still there, and
+ * starts the flusher thread.
+ * returns NULL when any internal errors occur.
+ */
+struct wal *wal_open(const char *path, int interval, uint64_t from_lsn,
+                     wal_apply_fn_t apply, void *arg);
+/*---------------------------------------------------------------------------*/
+/**
+ * syncs what is left, stops the flusher and closes the log.
+ */
+void wal_close(struct wal *wal);
+/*---------------------------------------------------------------------------*/
+/**
+ * appends a record. the value may be NULL for ops without one.
+ * records are replayed in the order they are appended, so the caller
+ * should append while holding whatever orders the change itself.
+ * returns 0 when any internal errors occur, the record's lsn otherwise.
+ */
+uint64_t wal_append(struct wal *wal, int op, const char *key,
+                    size_t key_len, const char *value, size_t value_len);
+/*---------------------------------------------------------------------------*/
+/**
+ * returns the lsn of the last record appended by the calling thread.
+ */
+uint64_t wal_thread_lsn(void);
+/*---------------------------------------------------------------------------*/
+/**
+ * returns the lsn of the last record appended by any thread.
+ */
+uint64_t wal_lsn(struct wal *wal);
+/*---------------------------------------------------------------------------*/
+/**
+ * waits until every record up to lsn is durable.
+ * returns -1 when the log could not be written.
+ * returns 0 on success.
+ */
+int wal_wait(struct wal *wal, uint64_t lsn);
+/*---------------------------------------------------------------------------*/
+/**
+ * checks without waiting whether every record up to lsn is durable.
+ * returns -1 when the log could not be written.
+ * returns 1 when they are durable.
+ * returns 0 when they are not yet.
+ */
+int wal_synced(struct wal *wal, uint64_t lsn);
+/*---------------------------------------------------------------------------*/
+/**
+ * has the flusher call fn each time records become durable, or the log
+ * fails, for writers that do not wait in wal_wait() but go on with other
+ * work meanwhile. fn should not block.
+ */
+void wal_set_notify(struct wal *wal, wal_notify_fn_t fn, void *arg);
+/*---------------------------------------------------------------------------*/
+/**
+ * starts a new log file after the records appended so far, which the
+ * flusher moves to <path>.old. appends go on meanwhile.
+ * returns -1 when <path>.old is still kept, or a rotation is running.
+ * returns 0 on success.
+ */
+int wal_rotate(struct wal *wal);
+/*---------------------------------------------------------------------------*/
+/**
+ * removes <path>.old once a snapshot holds every record up to lsn.
+ */
+void wal_drop_old(struct wal *wal, uint64_t lsn);
+/*---------------------------------------------------------------------------*/
+#endif // _WAL_H